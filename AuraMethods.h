@@ -18,9 +18,9 @@ namespace LuaAura
     int GetCasterGUID(lua_State* L, Aura* aura)
     {
 #ifndef TRINITY
-        Eluna::Push(L, aura->GetCasterGuid());
+        Eluna::PushGUID(L, aura->GetCasterGuid());
 #else
-        Eluna::Push(L, aura->GetCasterGUID());
+        Eluna::PushGUID(L, aura->GetCasterGUID());
 #endif
         return 1;
     }
@@ -12,9 +12,9 @@ namespace LuaCorpse
     int GetOwnerGUID(lua_State* L, Corpse* corpse)
     {
 #ifndef TRINITY
-        Eluna::Push(L, corpse->GetOwnerGuid());
+        Eluna::PushGUID(L, corpse->GetOwnerGuid());
 #else
-        Eluna::Push(L, corpse->GetOwnerGUID());
+        Eluna::PushGUID(L, corpse->GetOwnerGUID());
 #endif
         return 1;
     }
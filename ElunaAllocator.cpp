@@ -0,0 +1,144 @@
+/*
+* Copyright (C) 2010 - 2014 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+#include "ElunaAllocator.h"
+
+// Bytes carved from an arena for a size class at a time
+#define REFILL_BYTES 4096
+
+ElunaAllocator::ElunaAllocator(bool pooled) : pooled(pooled), liveBytes(0), peakBytes(0), systemCount(0), arenaUsed(ARENA_SIZE)
+{
+    for (uint32 i = 0; i < CLASS_COUNT; ++i)
+    {
+        freeLists[i] = NULL;
+        classStats[i].live = 0;
+        classStats[i].free = 0;
+    }
+}
+
+ElunaAllocator::~ElunaAllocator()
+{
+    for (std::vector<char*>::const_iterator it = arenas.begin(); it != arenas.end(); ++it)
+        free(*it);
+}
+
+void* ElunaAllocator::Alloc(void* ud, void* ptr, size_t osize, size_t nsize)
+{
+    ElunaAllocator* allocator = static_cast<ElunaAllocator*>(ud);
+    if (!nsize)
+    {
+        if (ptr)
+            allocator->Free(ptr, osize);
+        return NULL;
+    }
+    // When ptr is NULL osize is the type of the lua object, not a size
+    if (!ptr)
+        return allocator->Allocate(nsize);
+    return allocator->Reallocate(ptr, osize, nsize);
+}
+
+void* ElunaAllocator::Allocate(size_t size)
+{
+    void* ptr;
+    if (pooled && size <= MAX_POOLED_SIZE)
+    {
+        uint32 sizeClass = GetClass(size);
+        if (!freeLists[sizeClass])
+            Refill(sizeClass);
+        FreeBlock* block = freeLists[sizeClass];
+        if (!block)
+            return NULL;
+        freeLists[sizeClass] = block->next;
+        ++classStats[sizeClass].live;
+        --classStats[sizeClass].free;
+        ptr = block;
+    }
+    else
+    {
+        ptr = malloc(size);
+        if (!ptr)
+            return NULL;
+        ++systemCount;
+    }
+
+    liveBytes += size;
+    if (liveBytes > peakBytes)
+        peakBytes = liveBytes;
+    return ptr;
+}
+
+void ElunaAllocator::Free(void* ptr, size_t size)
+{
+    liveBytes -= size;
+    if (pooled && size <= MAX_POOLED_SIZE)
+    {
+        uint32 sizeClass = GetClass(size);
+        FreeBlock* block = static_cast<FreeBlock*>(ptr);
+        block->next = freeLists[sizeClass];
+        freeLists[sizeClass] = block;
+        --classStats[sizeClass].live;
+        ++classStats[sizeClass].free;
+        return;
+    }
+    --systemCount;
+    free(ptr);
+}
+
+void* ElunaAllocator::Reallocate(void* ptr, size_t osize, size_t nsize)
+{
+    bool oldPooled = pooled && osize <= MAX_POOLED_SIZE;
+    bool newPooled = pooled && nsize <= MAX_POOLED_SIZE;
+
+    // Block stays in the same size class or in the system allocator
+    if ((oldPooled && newPooled && GetClass(osize) == GetClass(nsize)) || (!oldPooled && !newPooled))
+    {
+        if (!oldPooled)
+        {
+            ptr = realloc(ptr, nsize);
+            if (!ptr)
+                return NULL;
+        }
+        liveBytes = liveBytes - osize + nsize;
+        if (liveBytes > peakBytes)
+            peakBytes = liveBytes;
+        return ptr;
+    }
+
+    void* newPtr = Allocate(nsize);
+    if (!newPtr)
+        return NULL;
+    memcpy(newPtr, ptr, osize < nsize ? osize : nsize);
+    Free(ptr, osize);
+    return newPtr;
+}
+
+void ElunaAllocator::Refill(uint32 sizeClass)
+{
+    size_t blockSize = GetClassSize(sizeClass);
+    size_t blocks = REFILL_BYTES / blockSize;
+    if (!blocks)
+        blocks = 1;
+    size_t bytes = blocks * blockSize;
+
+    if (arenaUsed + bytes > ARENA_SIZE)
+    {
+        char* arena = static_cast<char*>(malloc(ARENA_SIZE));
+        if (!arena)
+            return;
+        arenas.push_back(arena);
+        arenaUsed = 0;
+    }
+
+    char* start = arenas.back() + arenaUsed;
+    arenaUsed += bytes;
+    for (size_t i = 0; i < blocks; ++i)
+    {
+        FreeBlock* block = reinterpret_cast<FreeBlock*>(start + i * blockSize);
+        block->next = freeLists[sizeClass];
+        freeLists[sizeClass] = block;
+    }
+    classStats[sizeClass].free += blocks;
+}
@@ -0,0 +1,74 @@
+/*
+* Copyright (C) 2010 - 2014 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+#ifndef ELUNAALLOCATOR_H
+#define ELUNAALLOCATOR_H
+
+#include "Common.h"
+
+// lua_Alloc implementation for the Eluna lua state.
+// When pooled, small blocks come from per size class free lists that are refilled from larger arenas
+// and never go back to the system allocator before the state is closed.
+// Larger blocks and the non pooled mode use the system allocator. Stats are kept in both modes.
+// A lua state is only used from one thread, so there is no locking.
+class ElunaAllocator
+{
+public:
+    enum
+    {
+        CLASS_GRANULARITY   = 16,
+        CLASS_COUNT         = 32,   // Largest pooled block is CLASS_COUNT * CLASS_GRANULARITY bytes
+        MAX_POOLED_SIZE     = CLASS_COUNT * CLASS_GRANULARITY,
+        ARENA_SIZE          = 64 * 1024
+    };
+
+    struct SizeClassStats
+    {
+        uint32 live;        // Blocks in use
+        uint32 free;        // Blocks in the free list
+    };
+
+    explicit ElunaAllocator(bool pooled);
+    ~ElunaAllocator();
+
+    // lua_Alloc, ud is the ElunaAllocator
+    static void* Alloc(void* ud, void* ptr, size_t osize, size_t nsize);
+
+    bool IsPooled() const { return pooled; }
+    size_t GetLiveBytes() const { return liveBytes; }
+    size_t GetPeakBytes() const { return peakBytes; }
+    size_t GetArenaBytes() const { return arenas.size() * size_t(ARENA_SIZE); }
+    uint32 GetSystemCount() const { return systemCount; } // Blocks from the system allocator
+    SizeClassStats const& GetClassStats(uint32 sizeClass) const { return classStats[sizeClass]; }
+    static size_t GetClassSize(uint32 sizeClass) { return size_t(sizeClass + 1) * CLASS_GRANULARITY; }
+
+private:
+    ElunaAllocator(ElunaAllocator const&);
+    ElunaAllocator& operator=(ElunaAllocator const&);
+
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    static uint32 GetClass(size_t size) { return uint32((size - 1) / CLASS_GRANULARITY); }
+
+    void* Allocate(size_t size);
+    void Free(void* ptr, size_t size);
+    void* Reallocate(void* ptr, size_t osize, size_t nsize);
+    void Refill(uint32 sizeClass);
+
+    bool pooled;
+    size_t liveBytes;
+    size_t peakBytes;
+    uint32 systemCount;
+    size_t arenaUsed;   // Bytes used from the last arena
+    FreeBlock* freeLists[CLASS_COUNT];
+    SizeClassStats classStats[CLASS_COUNT];
+    std::vector<char*> arenas;
+};
+
+#endif
@@ -0,0 +1,73 @@
+/*
+* Copyright (C) 2010 - 2014 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+#include "ElunaBytecodeCache.h"
+#include <cstdio>
+#include <cstring>
+
+#define BYTECODE_MAGIC  "ELUNABC1"
+
+uint64 ElunaBytecodeCache::HashBytes(const char* data, size_t size)
+{
+    uint64 hash = UI64LIT(14695981039346656037);
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= uint8(data[i]);
+        hash *= UI64LIT(1099511628211);
+    }
+    return hash;
+}
+
+std::string ElunaBytecodeCache::GetFileName(const std::string& path)
+{
+    uint64 pathHash = HashBytes(path.c_str(), path.length());
+    char name[32];
+    snprintf(name, sizeof(name), "%08x%08x.luac", uint32(pathHash >> 32), uint32(pathHash));
+    return name;
+}
+
+ElunaBytecodeCache::Status ElunaBytecodeCache::Check(const std::string& entry, const std::string& path, uint64 mtime, uint64 size, size_t& chunkOffset)
+{
+    Header header;
+    if (entry.size() < sizeof(header))
+        return ENTRY_STALE;
+    memcpy(&header, entry.data(), sizeof(header));
+    size_t offset = sizeof(header) + header.pathLength;
+    if (memcmp(header.magic, BYTECODE_MAGIC, sizeof(header.magic)) || offset >= entry.size() ||
+        entry.compare(sizeof(header), header.pathLength, path) || header.size != size)
+        return ENTRY_STALE;
+    chunkOffset = offset;
+    return header.mtime == mtime ? ENTRY_VALID : ENTRY_CHECK_HASH;
+}
+
+bool ElunaBytecodeCache::MatchesSource(const std::string& entry, const std::string& source)
+{
+    Header header;
+    memcpy(&header, entry.data(), sizeof(header));
+    return header.hash == HashBytes(source.data(), source.size());
+}
+
+void ElunaBytecodeCache::Touch(std::string& entry, uint64 mtime)
+{
+    Header header;
+    memcpy(&header, entry.data(), sizeof(header));
+    header.mtime = mtime;
+    memcpy(&entry[0], &header, sizeof(header));
+}
+
+void ElunaBytecodeCache::Build(std::string& entry, const std::string& path, uint64 mtime, uint64 size, uint64 hash, const std::string& chunk)
+{
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BYTECODE_MAGIC, sizeof(header.magic));
+    header.mtime = mtime;
+    header.size = size;
+    header.hash = hash;
+    header.pathLength = uint32(path.length());
+    entry.assign(reinterpret_cast<const char*>(&header), sizeof(header));
+    entry += path;
+    entry += chunk;
+}
@@ -0,0 +1,52 @@
+/*
+* Copyright (C) 2010 - 2014 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+#ifndef ELUNABYTECODECACHE_H
+#define ELUNABYTECODECACHE_H
+
+#include "Common.h"
+#include <string>
+
+// Entries of the bytecode cache folder, see Eluna::CompileScript.
+// An entry is a Header followed by the script path and the dumped chunk.
+// It is up to date when the script's size and modification time match. A script with a new
+// modification time but the same content hash keeps its entry, which is then touched.
+struct ElunaBytecodeCache
+{
+    struct Header
+    {
+        char magic[8];
+        uint64 mtime;       // Script's modification time when it was compiled
+        uint64 size;        // Script's size
+        uint64 hash;        // Script's content hash
+        uint32 pathLength;
+    };
+
+    enum Status
+    {
+        ENTRY_STALE,        // Compile the script again
+        ENTRY_VALID,        // Load the chunk
+        ENTRY_CHECK_HASH    // Only the modification time differs, valid if the source hash matches, see MatchesSource
+    };
+
+    // FNV-1a
+    static uint64 HashBytes(const char* data, size_t size);
+
+    // Name of the script's entry in the cache folder
+    static std::string GetFileName(const std::string& path);
+
+    // Checks the entry against the script. chunkOffset is set to the chunk's offset in the entry when it is not stale
+    static Status Check(const std::string& entry, const std::string& path, uint64 mtime, uint64 size, size_t& chunkOffset);
+
+    static bool MatchesSource(const std::string& entry, const std::string& source);
+
+    // Sets the entry's modification time after the source was found unchanged
+    static void Touch(std::string& entry, uint64 mtime);
+
+    static void Build(std::string& entry, const std::string& path, uint64 mtime, uint64 size, uint64 hash, const std::string& chunk);
+};
+
+#endif
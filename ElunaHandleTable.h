@@ -0,0 +1,252 @@
+/*
+* Copyright (C) 2010 - 2014 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+#ifndef ELUNAHANDLETABLE_H
+#define ELUNAHANDLETABLE_H
+
+#include "Common.h"
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+// Validity table for pushed objects that are not memory managed by lua.
+// Each object gets a slot and the userdata remembers the slot's generation.
+// Removing the object bumps the generation, so checking a pointer is an array read and a compare.
+// With per map states an object can be pushed in several states. Shared tables register their slots
+// in a global registry, so Invalidate can bump the generations in the other tables at once from any thread.
+// The slots are freed by the owning table in ReleasePending.
+struct ElunaHandleTable
+{
+    enum
+    {
+        CHUNK_BITS      = 8,
+        CHUNK_SIZE      = 1 << CHUNK_BITS,
+        CHUNK_MASK      = CHUNK_SIZE - 1,
+        REGISTRY_SHARDS = 64
+    };
+
+    struct Slot
+    {
+        const void* ptr;
+        std::atomic<uint32> generation; // Also bumped by other threads, see Invalidate
+        uint32 owned;                   // Generation the handles were given, differs once invalidated
+        bool shared;                    // Registered in the registry
+    };
+
+    // A table holding a slot for an object
+    struct Owner
+    {
+        ElunaHandleTable* table;
+        uint32 slot;
+        std::atomic<uint32>* generation;
+    };
+
+    typedef std::vector<Owner> OwnerList;
+    typedef UNORDERED_MAP<const void*, OwnerList> OwnerMap;
+
+    struct RegistryShard
+    {
+        std::mutex lock;
+        OwnerMap owners;    // owners[ptr] = tables holding a slot for the object
+    };
+
+    typedef std::vector<Slot*> ChunkList;
+    typedef UNORDERED_MAP<const void*, uint32> SlotIndex;
+    typedef std::pair<const void*, uint32> PendingRelease;
+
+    ChunkList Chunks;   // Slots are allocated in chunks that never move, so other threads can hold a generation's address
+    uint32 SlotCount;
+    std::vector<uint32> FreeSlots;
+    SlotIndex Index;    // Index[ptr] = slot
+    bool Shared;        // Slots are registered for Invalidate
+
+    std::mutex PendingLock;
+    std::vector<PendingRelease> Pending;    // Slots invalidated by other threads
+    std::atomic<bool> HasPending;
+
+    ElunaHandleTable(bool shared): SlotCount(0), Shared(shared), HasPending(false)
+    {
+    }
+
+    ~ElunaHandleTable()
+    {
+        // Other threads can not reach the table once it is out of the registry
+        for (SlotIndex::const_iterator it = Index.begin(); it != Index.end(); ++it)
+            if (GetSlot(it->second).shared)
+                Unregister(it->first, it->second);
+        for (ChunkList::const_iterator it = Chunks.begin(); it != Chunks.end(); ++it)
+            delete[] *it;
+    }
+
+    Slot& GetSlot(uint32 slot)
+    {
+        return Chunks[slot >> CHUNK_BITS][slot & CHUNK_MASK];
+    }
+
+    const Slot& GetSlot(uint32 slot) const
+    {
+        return Chunks[slot >> CHUNK_BITS][slot & CHUNK_MASK];
+    }
+
+    // Returns the slot of the object, creating a new one if needed.
+    // Objects that are only pushed in this table, like borrowed packets, are not shared
+    uint32 Acquire(const void* ptr, bool shared = true)
+    {
+        SlotIndex::iterator it = Index.find(ptr);
+        if (it != Index.end())
+        {
+            const Slot& slot = GetSlot(it->second);
+            if (slot.generation == slot.owned)
+                return it->second;
+            // Invalidated by another thread, so this is a new object at the same address.
+            // The old slot is freed in ReleasePending
+            Index.erase(it);
+        }
+
+        uint32 index;
+        if (!FreeSlots.empty())
+        {
+            index = FreeSlots.back();
+            FreeSlots.pop_back();
+        }
+        else
+        {
+            if (!(SlotCount & CHUNK_MASK))
+            {
+                Slot* chunk = new Slot[CHUNK_SIZE];
+                for (uint32 i = 0; i < CHUNK_SIZE; ++i)
+                {
+                    chunk[i].ptr = NULL;
+                    chunk[i].generation = 1;
+                    chunk[i].owned = 1;
+                    chunk[i].shared = false;
+                }
+                Chunks.push_back(chunk);
+            }
+            index = SlotCount++;
+        }
+
+        Slot& slot = GetSlot(index);
+        slot.ptr = ptr;
+        slot.shared = Shared && shared;
+        Index[ptr] = index;
+        if (slot.shared)
+            Register(ptr, index);
+        return index;
+    }
+
+    // Invalidates all handles to the object in this table and frees its slot
+    void Release(const void* ptr)
+    {
+        SlotIndex::iterator it = Index.find(ptr);
+        if (it == Index.end())
+            return;
+        uint32 index = it->second;
+        Index.erase(it);
+        Free(index);
+    }
+
+    // Frees the slots invalidated by other threads. The objects that still had their slot are added to released
+    void ReleasePending(std::vector<const void*>& released)
+    {
+        if (!HasPending)
+            return;
+        std::vector<PendingRelease> pending;
+        {
+            std::lock_guard<std::mutex> guard(PendingLock);
+            pending.swap(Pending);
+            HasPending = false;
+        }
+        for (std::vector<PendingRelease>::const_iterator it = pending.begin(); it != pending.end(); ++it)
+        {
+            const Slot& slot = GetSlot(it->second);
+            if (slot.ptr != it->first || slot.generation == slot.owned)
+                continue; // Already freed by this table
+            SlotIndex::iterator itr = Index.find(it->first);
+            if (itr != Index.end() && itr->second == it->second)
+            {
+                Index.erase(itr);
+                released.push_back(it->first);
+            }
+            Free(it->second);
+        }
+    }
+
+    uint32 GetGeneration(uint32 slot) const
+    {
+        return GetSlot(slot).owned;
+    }
+
+    bool IsValid(uint32 slot, uint32 generation) const
+    {
+        return slot < SlotCount && GetSlot(slot).generation == generation;
+    }
+
+    // Invalidates the handles to the object in all shared tables, can be called from any thread
+    static void Invalidate(const void* ptr)
+    {
+        RegistryShard& shard = GetShard(ptr);
+        std::lock_guard<std::mutex> guard(shard.lock);
+        OwnerMap::iterator it = shard.owners.find(ptr);
+        if (it == shard.owners.end())
+            return;
+        for (OwnerList::const_iterator itr = it->second.begin(); itr != it->second.end(); ++itr)
+        {
+            ++*itr->generation;
+            std::lock_guard<std::mutex> pendingGuard(itr->table->PendingLock);
+            itr->table->Pending.push_back(PendingRelease(ptr, itr->slot));
+            itr->table->HasPending = true;
+        }
+        shard.owners.erase(it);
+    }
+
+private:
+    void Free(uint32 index)
+    {
+        Slot& slot = GetSlot(index);
+        if (slot.shared)
+            Unregister(slot.ptr, index);
+        slot.ptr = NULL;
+        slot.shared = false;
+        slot.owned = ++slot.generation;
+        FreeSlots.push_back(index);
+    }
+
+    void Register(const void* ptr, uint32 index)
+    {
+        Owner owner = { this, index, &GetSlot(index).generation };
+        RegistryShard& shard = GetShard(ptr);
+        std::lock_guard<std::mutex> guard(shard.lock);
+        shard.owners[ptr].push_back(owner);
+    }
+
+    void Unregister(const void* ptr, uint32 index)
+    {
+        RegistryShard& shard = GetShard(ptr);
+        std::lock_guard<std::mutex> guard(shard.lock);
+        OwnerMap::iterator it = shard.owners.find(ptr);
+        if (it == shard.owners.end())
+            return;
+        for (OwnerList::iterator itr = it->second.begin(); itr != it->second.end(); ++itr)
+        {
+            if (itr->table == this && itr->slot == index)
+            {
+                it->second.erase(itr);
+                break;
+            }
+        }
+        if (it->second.empty())
+            shard.owners.erase(it);
+    }
+
+    static RegistryShard& GetShard(const void* ptr)
+    {
+        static RegistryShard shards[REGISTRY_SHARDS];
+        return shards[(reinterpret_cast<uintptr_t>(ptr) >> 4) % REGISTRY_SHARDS];
+    }
+};
+
+#endif
@@ -0,0 +1,158 @@
+/*
+* Copyright (C) 2010 - 2014 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+#ifndef ELUNATIMINGWHEEL_H
+#define ELUNATIMINGWHEEL_H
+
+#include "Common.h"
+#include <cstring>
+#include <vector>
+
+// Hierarchical timing wheel of LEVELS levels with SLOTS slots each, so scheduling and unscheduling is O(1).
+// The items are intrusive, T has the members
+//     uint64 expires;     // Tick to expire at
+//     T** slot;           // Head of the slot or list holding the item, NULL when not scheduled
+//     T* slotPrev;
+//     T* slotNext;
+// The items of an expired tick are handed out one at a time by PopExpiring, so handling an item
+// can unschedule or reschedule the items after it.
+template<typename T>
+class ElunaTimingWheel
+{
+public:
+    enum
+    {
+        LEVELS  = 4,
+        BITS    = 8,
+        SLOTS   = 1 << BITS,
+        MASK    = SLOTS - 1
+    };
+
+    ElunaTimingWheel(): Expiring(NULL), CurrentTick(0)
+    {
+        memset(Wheel, 0, sizeof(Wheel));
+    }
+
+    uint64 GetTick() const { return CurrentTick; }
+
+    // Schedules the item at its expires tick, ticks already run are moved to the next one
+    void Schedule(T* item)
+    {
+        if (item->expires <= CurrentTick)
+            item->expires = CurrentTick + 1;
+        Insert(item);
+    }
+
+    // Advances the wheel up to target and stops at the first tick that has items.
+    // Returns true with the items of GetTick() expiring, false once target is reached
+    bool Advance(uint64 target)
+    {
+        while (CurrentTick < target)
+        {
+            ++CurrentTick;
+
+            // Higher level slots are cascaded when the lower levels wrap around
+            for (uint32 level = LEVELS - 1; level > 0; --level)
+                if (!(CurrentTick & ((uint64(1) << (BITS * level)) - 1)))
+                    Cascade(level, uint32(CurrentTick >> (BITS * level)) & MASK);
+
+            T*& slot = Wheel[0][CurrentTick & MASK];
+            if (slot)
+            {
+                Expire(slot);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Makes the items of the list expiring, the list is left empty. Only valid when nothing is expiring
+    void Expire(T*& list)
+    {
+        Expiring = list;
+        list = NULL;
+        for (T* item = Expiring; item; item = item->slotNext)
+            item->slot = &Expiring;
+    }
+
+    // Unschedules and returns the next expiring item, NULL when none are left
+    T* PopExpiring()
+    {
+        T* item = Expiring;
+        if (item)
+            Unschedule(item);
+        return item;
+    }
+
+    // Unschedules all items, expiring ones included, and appends them to items
+    void TakeAll(std::vector<T*>& items)
+    {
+        for (uint32 level = 0; level < LEVELS; ++level)
+            for (uint32 index = 0; index < SLOTS; ++index)
+                while (T* item = Wheel[level][index])
+                {
+                    Unschedule(item);
+                    items.push_back(item);
+                }
+        while (T* item = PopExpiring())
+            items.push_back(item);
+    }
+
+    static void Link(T* item, T** slot)
+    {
+        item->slot = slot;
+        item->slotPrev = NULL;
+        item->slotNext = *slot;
+        if (*slot)
+            (*slot)->slotPrev = item;
+        *slot = item;
+    }
+
+    static void Unschedule(T* item)
+    {
+        if (!item->slot)
+            return;
+        if (item->slotNext)
+            item->slotNext->slotPrev = item->slotPrev;
+        if (item->slotPrev)
+            item->slotPrev->slotNext = item->slotNext;
+        else
+            *item->slot = item->slotNext;
+        item->slot = NULL;
+    }
+
+private:
+    // Puts the item in the slot of the lowest level that reaches its tick
+    void Insert(T* item)
+    {
+        uint64 delta = item->expires - CurrentTick;
+        uint32 level = 0;
+        while (level < LEVELS - 1 && delta >= (uint64(1) << (BITS * (level + 1))))
+            ++level;
+        uint32 index = uint32(item->expires >> (BITS * level)) & MASK;
+
+        Link(item, &Wheel[level][index]);
+    }
+
+    // Moves the items of a higher level slot to the lower levels
+    void Cascade(uint32 level, uint32 index)
+    {
+        T* item = Wheel[level][index];
+        Wheel[level][index] = NULL;
+        while (item)
+        {
+            T* next = item->slotNext;
+            Insert(item); // Items of the current tick go to its level 0 slot, which is checked after cascading
+            item = next;
+        }
+    }
+
+    T* Wheel[LEVELS][SLOTS];
+    T* Expiring;        // Items of the tick being run
+    uint64 CurrentTick;
+};
+
+#endif
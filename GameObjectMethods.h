@@ -117,10 +117,12 @@ namespace LuaGameObject
         luaL_checktype(L, 2, LUA_TFUNCTION);
         uint32 delay = Eluna::CHECKVAL<uint32>(L, 3);
         uint32 repeats = Eluna::CHECKVAL<uint32>(L, 4);
+        if (!sEluna->m_EventMgr->CanAddEvent(go))
+            return luaL_error(L, "events of an object can only be registered on the object's map with per map states");
 
         lua_pushvalue(L, 2);
         int functionRef = luaL_ref(L, LUA_REGISTRYINDEX);
-        functionRef = sEluna->m_EventMgr->AddEvent(&go->m_Events, functionRef, delay, repeats, go);
+        functionRef = sEluna->m_EventMgr->AddEvent(go, functionRef, delay, repeats);
         if (functionRef)
             Eluna::Push(L, functionRef);
         return 1;
@@ -129,13 +131,13 @@ namespace LuaGameObject
     int RemoveEventById(lua_State* L, GameObject* go)
     {
         int eventId = Eluna::CHECKVAL<int>(L, 2);
-        sEluna->m_EventMgr->RemoveEvent(&go->m_Events, eventId);
+        sEluna->m_EventMgr->RemoveEvent(go, eventId);
         return 0;
     }
 
     int RemoveEvents(lua_State* /*L*/, GameObject* go)
     {
-        sEluna->m_EventMgr->RemoveEvents(&go->m_Events);
+        sEluna->m_EventMgr->RemoveEvents(go);
         return 0;
     }
 
@@ -159,6 +159,134 @@ namespace LuaGlobalFunctions
         return 1;
     }
 
+    int GetMemoryStats(lua_State* L)
+    {
+        void* ud = NULL;
+        lua_getallocf(L, &ud);
+        ElunaAllocator const* allocator = static_cast<ElunaAllocator const*>(ud);
+
+        lua_newtable(L);
+        int tbl = lua_gettop(L);
+
+        Eluna::Push(L, allocator->IsPooled());
+        lua_setfield(L, tbl, "pooled");
+        Eluna::Push(L, double(allocator->GetLiveBytes()));
+        lua_setfield(L, tbl, "live");
+        Eluna::Push(L, double(allocator->GetPeakBytes()));
+        lua_setfield(L, tbl, "peak");
+        Eluna::Push(L, double(allocator->GetArenaBytes()));
+        lua_setfield(L, tbl, "arenas");
+        Eluna::Push(L, allocator->GetSystemCount());
+        lua_setfield(L, tbl, "system");
+
+        // classes[blockSize] = { live = blocks in use, free = blocks in free list }
+        lua_newtable(L);
+        int classes = lua_gettop(L);
+        for (uint32 i = 0; i < ElunaAllocator::CLASS_COUNT; ++i)
+        {
+            ElunaAllocator::SizeClassStats const& stats = allocator->GetClassStats(i);
+            if (!stats.live && !stats.free)
+                continue;
+            Eluna::Push(L, uint32(ElunaAllocator::GetClassSize(i)));
+            lua_newtable(L);
+            Eluna::Push(L, stats.live);
+            lua_setfield(L, -2, "live");
+            Eluna::Push(L, stats.free);
+            lua_setfield(L, -2, "free");
+            lua_settable(L, classes);
+        }
+        lua_setfield(L, tbl, "classes");
+
+        lua_settop(L, tbl);
+        return 1;
+    }
+
+    int GetGCStats(lua_State* L)
+    {
+        ElunaGCStats const& stats = sEluna->m_GCStats;
+
+        lua_newtable(L);
+        int tbl = lua_gettop(L);
+
+        Eluna::Push(L, sEluna->m_GCBudget);
+        lua_setfield(L, tbl, "budget");
+        Eluna::Push(L, sEluna->m_GCStepSize);
+        lua_setfield(L, tbl, "stepSize");
+        Eluna::Push(L, stats.steps);
+        lua_setfield(L, tbl, "steps");
+        Eluna::Push(L, stats.cycles);
+        lua_setfield(L, tbl, "cycles");
+        Eluna::Push(L, double(stats.totalTime));
+        lua_setfield(L, tbl, "totalTime");
+        Eluna::Push(L, stats.lastPause);
+        lua_setfield(L, tbl, "lastPause");
+        Eluna::Push(L, stats.maxPause);
+        lua_setfield(L, tbl, "maxPause");
+        Eluna::Push(L, stats.lastSteps);
+        lua_setfield(L, tbl, "lastSteps");
+        Eluna::Push(L, lua_gc(L, LUA_GCCOUNT, 0));
+        lua_setfield(L, tbl, "memory");
+
+        lua_settop(L, tbl);
+        return 1;
+    }
+
+    int GetHookStats(lua_State* L)
+    {
+        uint32 sampleRate = sEluna->m_ProfileSampleRate;
+
+        lua_newtable(L);
+        int tbl = lua_gettop(L);
+        uint32 i = 0;
+
+        for (Eluna::HandlerStatsMap::const_iterator it = sEluna->m_HandlerStats.begin(); it != sEluna->m_HandlerStats.end(); ++it)
+        {
+            ElunaHandlerStats const& stats = it->second;
+
+            lua_newtable(L);
+            int handler = lua_gettop(L);
+
+            Eluna::Push(L, stats.group);
+            lua_setfield(L, handler, "group");
+            Eluna::Push(L, stats.event);
+            lua_setfield(L, handler, "event");
+            Eluna::Push(L, stats.entry);
+            lua_setfield(L, handler, "entry");
+            Eluna::Push(L, stats.source);
+            lua_setfield(L, handler, "source");
+            Eluna::Push(L, stats.samples * sampleRate);
+            lua_setfield(L, handler, "calls");
+            Eluna::Push(L, stats.samples);
+            lua_setfield(L, handler, "samples");
+            Eluna::Push(L, stats.errors);
+            lua_setfield(L, handler, "errors");
+            Eluna::Push(L, double(stats.totalTime));
+            lua_setfield(L, handler, "totalTime");
+            Eluna::Push(L, stats.maxTime);
+            lua_setfield(L, handler, "maxTime");
+
+            lua_rawseti(L, tbl, ++i);
+        }
+
+        lua_settop(L, tbl);
+        return 1;
+    }
+
+    int GetErrorStats(lua_State* L)
+    {
+        lua_newtable(L);
+        int tbl = lua_gettop(L);
+
+        for (Eluna::ErrorStatsMap::const_iterator it = sEluna->m_ErrorStats.begin(); it != sEluna->m_ErrorStats.end(); ++it)
+        {
+            Eluna::Push(L, it->second.count);
+            lua_setfield(L, tbl, it->first.c_str());
+        }
+
+        lua_settop(L, tbl);
+        return 1;
+    }
+
     int GetGuildByLeaderGUID(lua_State* L)
     {
         uint64 guid = Eluna::CHECKVAL<uint64>(L, 1);
@@ -176,14 +304,14 @@ namespace LuaGlobalFunctions
     int GetPlayerGUID(lua_State* L)
     {
         uint32 lowguid = Eluna::CHECKVAL<uint32>(L, 1);
-        Eluna::Push(L, MAKE_NEW_GUID(lowguid, 0, HIGHGUID_PLAYER));
+        Eluna::PushGUID(L, MAKE_NEW_GUID(lowguid, 0, HIGHGUID_PLAYER));
         return 1;
     }
 
     int GetItemGUID(lua_State* L)
     {
         uint32 lowguid = Eluna::CHECKVAL<uint32>(L, 1);
-        Eluna::Push(L, MAKE_NEW_GUID(lowguid, 0, HIGHGUID_ITEM));
+        Eluna::PushGUID(L, MAKE_NEW_GUID(lowguid, 0, HIGHGUID_ITEM));
         return 1;
     }
 
@@ -191,7 +319,7 @@ namespace LuaGlobalFunctions
     {
         uint32 lowguid = Eluna::CHECKVAL<uint32>(L, 1);
         uint32 entry = Eluna::CHECKVAL<uint32>(L, 2);
-        Eluna::Push(L, MAKE_NEW_GUID(lowguid, entry, HIGHGUID_GAMEOBJECT));
+        Eluna::PushGUID(L, MAKE_NEW_GUID(lowguid, entry, HIGHGUID_GAMEOBJECT));
         return 1;
     }
 
@@ -199,7 +327,15 @@ namespace LuaGlobalFunctions
     {
         uint32 lowguid = Eluna::CHECKVAL<uint32>(L, 1);
         uint32 entry = Eluna::CHECKVAL<uint32>(L, 2);
-        Eluna::Push(L, MAKE_NEW_GUID(lowguid, entry, HIGHGUID_UNIT));
+        Eluna::PushGUID(L, MAKE_NEW_GUID(lowguid, entry, HIGHGUID_UNIT));
+        return 1;
+    }
+
+    int ToGUID(lua_State* L)
+    {
+        uint64 guid = Eluna::CHECKVAL<uint64>(L, 1);
+
+        Eluna::PushGUID(L, guid);
         return 1;
     }
 
@@ -283,8 +419,8 @@ namespace LuaGlobalFunctions
     {
         uint32 entry = Eluna::CHECKVAL<uint32>(L, 1);
         uint32 ev = Eluna::CHECKVAL<uint32>(L, 2);
-        luaL_checktype(L, 2, LUA_TFUNCTION);
-        lua_pushvalue(L, 2);
+        luaL_checktype(L, 3, LUA_TFUNCTION);
+        lua_pushvalue(L, 3);
         int functionRef = luaL_ref(L, LUA_REGISTRYINDEX);
         if (functionRef > 0)
             sEluna->Register(HookMgr::REGTYPE_PACKET, entry, ev, functionRef);
@@ -295,6 +431,32 @@ namespace LuaGlobalFunctions
     {
         uint32 ev = Eluna::CHECKVAL<uint32>(L, 1);
         luaL_checktype(L, 2, LUA_TFUNCTION);
+
+        // Packet events can be limited to an opcode or a table of opcodes
+        if (lua_istable(L, 3))
+        {
+            for (int i = 1; i <= int(lua_rawlen(L, 3)); ++i)
+            {
+                lua_rawgeti(L, 3, i);
+                uint32 opcode = Eluna::CHECKVAL<uint32>(L, -1);
+                lua_pop(L, 1);
+                lua_pushvalue(L, 2);
+                int functionRef = luaL_ref(L, LUA_REGISTRYINDEX);
+                if (functionRef > 0)
+                    sEluna->RegisterPacketFilter(ev, opcode, functionRef);
+            }
+            return 0;
+        }
+        if (!lua_isnoneornil(L, 3))
+        {
+            uint32 opcode = Eluna::CHECKVAL<uint32>(L, 3);
+            lua_pushvalue(L, 2);
+            int functionRef = luaL_ref(L, LUA_REGISTRYINDEX);
+            if (functionRef > 0)
+                sEluna->RegisterPacketFilter(ev, opcode, functionRef);
+            return 0;
+        }
+
         lua_pushvalue(L, 2);
         int functionRef = luaL_ref(L, LUA_REGISTRYINDEX);
         if (functionRef > 0)
@@ -306,9 +468,14 @@ namespace LuaGlobalFunctions
     {
         uint32 ev = Eluna::CHECKVAL<uint32>(L, 1);
         luaL_checktype(L, 2, LUA_TFUNCTION);
+        bool deferred = Eluna::CHECKVAL<bool>(L, 3, false);
         lua_pushvalue(L, 2);
         int functionRef = luaL_ref(L, LUA_REGISTRYINDEX);
-        if (functionRef > 0)
+        if (functionRef <= 0)
+            return 0;
+        if (deferred)
+            sEluna->RegisterDeferred(HookMgr::REGTYPE_PLAYER, ev, functionRef);
+        else
             sEluna->Register(HookMgr::REGTYPE_PLAYER, 0, ev, functionRef);
         return 0;
     }
@@ -317,9 +484,14 @@ namespace LuaGlobalFunctions
     {
         uint32 ev = Eluna::CHECKVAL<uint32>(L, 1);
         luaL_checktype(L, 2, LUA_TFUNCTION);
+        bool deferred = Eluna::CHECKVAL<bool>(L, 3, false);
         lua_pushvalue(L, 2);
         int functionRef = luaL_ref(L, LUA_REGISTRYINDEX);
-        if (functionRef > 0)
+        if (functionRef <= 0)
+            return 0;
+        if (deferred)
+            sEluna->RegisterDeferred(HookMgr::REGTYPE_GUILD, ev, functionRef);
+        else
             sEluna->Register(HookMgr::REGTYPE_GUILD, 0, ev, functionRef);
         return 0;
     }
@@ -328,9 +500,14 @@ namespace LuaGlobalFunctions
     {
         uint32 ev = Eluna::CHECKVAL<uint32>(L, 1);
         luaL_checktype(L, 2, LUA_TFUNCTION);
+        bool deferred = Eluna::CHECKVAL<bool>(L, 3, false);
         lua_pushvalue(L, 2);
         int functionRef = luaL_ref(L, LUA_REGISTRYINDEX);
-        if (functionRef > 0)
+        if (functionRef <= 0)
+            return 0;
+        if (deferred)
+            sEluna->RegisterDeferred(HookMgr::REGTYPE_GROUP, ev, functionRef);
+        else
             sEluna->Register(HookMgr::REGTYPE_GROUP, 0, ev, functionRef);
         return 0;
     }
@@ -518,7 +695,7 @@ namespace LuaGlobalFunctions
 
         lua_pushvalue(L, 1);
         int functionRef = luaL_ref(L, LUA_REGISTRYINDEX);
-        functionRef = sEluna->m_EventMgr->AddEvent(&sEluna->m_EventMgr->GlobalEvents, functionRef, delay, repeats);
+        functionRef = sEluna->m_EventMgr->AddEvent(NULL, functionRef, delay, repeats);
         if (functionRef)
             Eluna::Push(L, functionRef);
         else
@@ -529,12 +706,12 @@ namespace LuaGlobalFunctions
     int RemoveEventById(lua_State* L)
     {
         int eventId = Eluna::CHECKVAL<int>(L, 1);
-        bool all_Events = Eluna::CHECKVAL<bool>(L, 1, false);
+        bool all_Events = Eluna::CHECKVAL<bool>(L, 2, false);
 
         if (all_Events)
             sEluna->m_EventMgr->RemoveEvent(eventId);
         else
-            sEluna->m_EventMgr->RemoveEvent(&sEluna->m_EventMgr->GlobalEvents, eventId);
+            sEluna->m_EventMgr->RemoveEvent(NULL, eventId);
         return 0;
     }
 
@@ -545,10 +722,68 @@ namespace LuaGlobalFunctions
         if (all_Events)
             sEluna->m_EventMgr->RemoveEvents();
         else
-            sEluna->m_EventMgr->GlobalEvents.KillAllEvents(true);
+            sEluna->m_EventMgr->RemoveEvents(NULL);
         return 0;
     }
 
+    int RunCoroutine(lua_State* L)
+    {
+        luaL_checktype(L, 1, LUA_TFUNCTION);
+        int narg = lua_gettop(L) - 1;
+
+        lua_State* co = lua_newthread(L);
+        lua_insert(L, 1);
+        lua_xmove(L, co, narg + 1);
+        int threadRef = luaL_ref(L, LUA_REGISTRYINDEX);
+        sEluna->m_EventMgr->AddCoroutine(co, threadRef, narg);
+        return 0;
+    }
+
+    int Sleep(lua_State* L)
+    {
+        uint32 delay = Eluna::CHECKVAL<uint32>(L, 1);
+        return sEluna->m_EventMgr->Wait(L, delay, 0, 0, NULL);
+    }
+
+    int WaitForTicks(lua_State* L)
+    {
+        uint32 ticks = Eluna::CHECKVAL<uint32>(L, 1, 1);
+        if (!ticks)
+            return 0;
+        return sEluna->m_EventMgr->Wait(L, 0, ticks, 0, NULL);
+    }
+
+    // WaitUntil keeps the predicate and interval on the coroutine's stack between the checks
+    static int WaitUntilCheck(lua_State* L);
+
+    static int WaitUntilStep(lua_State* L)
+    {
+        lua_settop(L, 2);
+        lua_pushvalue(L, 1);
+        lua_callk(L, 0, 1, 0, &WaitUntilCheck);
+        return WaitUntilCheck(L);
+    }
+
+    static int WaitUntilCheck(lua_State* L)
+    {
+        if (lua_toboolean(L, 3))
+            return 0;
+        lua_settop(L, 2);
+        uint32 interval = uint32(lua_tointeger(L, 2));
+        if (!interval)
+            return sEluna->m_EventMgr->Wait(L, 0, 1, 0, &WaitUntilStep);
+        return sEluna->m_EventMgr->Wait(L, interval, 0, 0, &WaitUntilStep);
+    }
+
+    int WaitUntil(lua_State* L)
+    {
+        luaL_checktype(L, 1, LUA_TFUNCTION);
+        uint32 interval = Eluna::CHECKVAL<uint32>(L, 2, 0);
+        lua_settop(L, 1);
+        Eluna::Push(L, interval);
+        return WaitUntilStep(L);
+    }
+
     int PerformIngameSpawn(lua_State* L)
     {
         int spawntype = Eluna::CHECKVAL<int>(L, 1);
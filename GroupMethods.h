@@ -116,9 +116,9 @@ namespace LuaGroup
     int GetLeaderGUID(lua_State* L, Group* group)
     {
 #ifndef TRINITY
-        Eluna::Push(L, group->GetLeaderGuid());
+        Eluna::PushGUID(L, group->GetLeaderGuid());
 #else
-        Eluna::Push(L, group->GetLeaderGUID());
+        Eluna::PushGUID(L, group->GetLeaderGUID());
 #endif
         return 1;
     }
@@ -138,7 +138,7 @@ namespace LuaGroup
 #ifdef CLASSIC
         Eluna::Push(L, group->GetId());
 #else
-        Eluna::Push(L, group->GET_GUID());
+        Eluna::PushGUID(L, group->GET_GUID());
 #endif
         return 1;
     }
@@ -147,9 +147,9 @@ namespace LuaGroup
     {
         const char* name = Eluna::CHECKVAL<const char*>(L, 2);
 #ifndef TRINITY
-        Eluna::Push(L, group->GetMemberGuid(name));
+        Eluna::PushGUID(L, group->GetMemberGuid(name));
 #else
-        Eluna::Push(L, group->GetMemberGUID(name));
+        Eluna::PushGUID(L, group->GetMemberGUID(name));
 #endif
         return 1;
     }
@@ -54,9 +54,9 @@ namespace LuaGuild
     int GetLeaderGUID(lua_State* L, Guild* guild)
     {
 #ifndef TRINITY
-        Eluna::Push(L, guild->GetLeaderGuid());
+        Eluna::PushGUID(L, guild->GetLeaderGuid());
 #else
-        Eluna::Push(L, guild->GetLeaderGUID());
+        Eluna::PushGUID(L, guild->GetLeaderGUID());
 #endif
         return 1;
     }
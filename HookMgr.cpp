@@ -25,16 +25,26 @@ FOR_RET(iter)
 ENDCALL();
 */
 
+// Queues the hook call for handlers registered as deferred, the arguments are the ones pushed for the event
+#define EVENT_DEFER(BINDMAP, EVENT, ...) \
+    if (sEluna->BINDMAP->HasDeferred(EVENT)) \
+        sEluna->m_Deferred->Queue(sEluna->BINDMAP->groupName, EVENT, sEluna->BINDMAP->DeferredBindings[EVENT], __VA_ARGS__);
+
 // RET is a return statement
 #define EVENT_BEGIN(BINDMAP, EVENT, RET) \
     if (!BINDMAP->HasEvents(EVENT)) \
         RET; \
+    EVENT_BEGIN_BINDS(BINDMAP, EVENT, sEluna->BINDMAP->Bindings[EVENT])
+
+// Same as EVENT_BEGIN for the given list of function refs
+#define EVENT_BEGIN_BINDS(BINDMAP, EVENT, BINDS) \
     lua_State* L = sEluna->L; \
     const char* _LuaBindType = sEluna->BINDMAP->groupName; \
     uint32 _LuaEvent = EVENT; \
     int _LuaStackTop = lua_gettop(L); \
-    for (size_t i = 0; i < sEluna->BINDMAP->Bindings[_LuaEvent].size(); ++i) \
-        lua_rawgeti(L, LUA_REGISTRYINDEX, (sEluna->BINDMAP->Bindings[_LuaEvent][i])); \
+    const std::vector<int>& _LuaBinds = BINDS; \
+    for (size_t i = 0; i < _LuaBinds.size(); ++i) \
+        lua_rawgeti(L, LUA_REGISTRYINDEX, _LuaBinds[i]); \
     int _LuaFuncTop = lua_gettop(L); \
     int _LuaFuncCount = _LuaFuncTop-_LuaStackTop; \
     Eluna::Push(L, _LuaEvent);
@@ -52,7 +62,7 @@ ENDCALL();
     { \
         for (int i = 0; i <= _LuaParams; ++i) \
             lua_pushvalue(L, _LuaFuncTop+i); \
-        Eluna::ExecuteCall(L, _LuaParams, _LuaReturnValues); \
+        sEluna->ExecuteHandler(_LuaParams, _LuaReturnValues, _LuaBindType, _LuaEvent, 0, _LuaBinds[_LuaFuncTop - _LuaStackTop - 1]); \
         lua_remove(L, _LuaFuncTop--); \
     } \
     for (int i = _LuaParams; i > 0; --i) \
@@ -61,7 +71,18 @@ ENDCALL();
 
 // RET is a return statement
 #define ENTRY_BEGIN(BINDMAP, ENTRY, EVENT, RET) \
-    int _Luabind = sEluna->BINDMAP->GetBind(ENTRY, EVENT); \
+    uint32 _LuaEntry = ENTRY; \
+    int _Luabind = sEluna->BINDMAP->GetBind(_LuaEntry, EVENT); \
+    ENTRY_BEGIN_BIND(BINDMAP, EVENT, RET)
+
+// Same as ENTRY_BEGIN, BINDS is the entry's bindings from GetBindMap (can be NULL)
+#define ENTRY_BEGIN_REF(BINDMAP, BINDS, ENTRY, EVENT, RET) \
+    uint32 _LuaEntry = ENTRY; \
+    const std::vector<int>* _LuaEntryBinds = BINDS; \
+    int _Luabind = _LuaEntryBinds ? (*_LuaEntryBinds)[EVENT] : 0; \
+    ENTRY_BEGIN_BIND(BINDMAP, EVENT, RET)
+
+#define ENTRY_BEGIN_BIND(BINDMAP, EVENT, RET) \
     if (!_Luabind) \
         RET; \
     lua_State* L = sEluna->L; \
@@ -76,7 +97,7 @@ ENDCALL();
 #define ENTRY_EXECUTE(RETVALS) \
     int _LuaReturnValues = RETVALS; \
     int _LuaParams = lua_gettop(L) - _LuaStackTop - 1; \
-    Eluna::ExecuteCall(L, _LuaParams, _LuaReturnValues);
+    sEluna->ExecuteHandler(_LuaParams, _LuaReturnValues, _LuaBindType, _LuaEvent, _LuaEntry, _Luabind);
 
 #define FOR_RETS(IT) \
     for (int IT = _LuaStackTop + 1; IT <= lua_gettop(L); ++IT)
@@ -155,18 +176,27 @@ void Eluna::OnExpire(AuctionHouseObject* ah)
 // Packet
 bool Eluna::OnPacketSend(WorldSession* session, WorldPacket& packet)
 {
+    uint32 opcode = packet.GetOpcode();
+    if (opcode >= NUM_MSG_TYPES || !PacketSendOpcodes.test(opcode))
+        return true;
+
     bool result = true;
     Player* player = NULL;
     if (session)
         player = session->GetPlayer();
-    OnPacketSendAny(player, packet, result);
+    if (ServerEventBindings->HasEvents(SERVER_EVENT_ON_PACKET_SEND))
+        OnPacketSendAny(player, packet, result, ServerEventBindings->Bindings[SERVER_EVENT_ON_PACKET_SEND]);
+    if (const PacketFilterBind::ElunaBindingMap* binds = PacketSendFilterBindings->GetBindMap(opcode))
+        OnPacketSendAny(player, packet, result, *binds);
     OnPacketSendOne(player, packet, result);
     return result;
 }
-void Eluna::OnPacketSendAny(Player* player, WorldPacket& packet, bool& result)
+void Eluna::OnPacketSendAny(Player* player, WorldPacket& packet, bool& result, const std::vector<int>& binds)
 {
-    EVENT_BEGIN(ServerEventBindings, SERVER_EVENT_ON_PACKET_SEND, return);
-    Push(L, new WorldPacket(packet));
+    EVENT_BEGIN_BINDS(ServerEventBindings, SERVER_EVENT_ON_PACKET_SEND, binds);
+    size_t rpos = packet.rpos();
+    WorldPacket* replacement = NULL;
+    ElunaTemplate<WorldPacket>::pushBorrowed(L, &packet);
     Push(L, player);
     EVENT_EXECUTE(2);
     FOR_RETS(i)
@@ -174,19 +204,31 @@ void Eluna::OnPacketSendAny(Player* player, WorldPacket& packet, bool& result)
         if (lua_isnoneornil(L, i))
             continue;
         if (WorldPacket* data = CHECKOBJ<WorldPacket>(L, i, false))
-            packet = *data;
+        {
+            if (data != &packet)
+                replacement = data;
+        }
         if (!CHECKVAL<bool>(L, i, true))
         {
             result = false;
             break;
         }
     }
+    // Several handlers can return the same packet, so only the last replacement is moved and only once
+    if (replacement)
+        packet = std::move(*replacement);
     ENDCALL();
+    // The borrowed packet can not be used after the hook and reads from it must not move the core's read position
+    m_Handles.Release(&packet);
+    if (!replacement)
+        packet.rpos(rpos);
 }
 void Eluna::OnPacketSendOne(Player* player, WorldPacket& packet, bool& result)
 {
     ENTRY_BEGIN(PacketEventBindings, OpcodesList(packet.GetOpcode()), PACKET_EVENT_ON_PACKET_SEND, return);
-    Push(L, new WorldPacket(packet));
+    size_t rpos = packet.rpos();
+    WorldPacket* replacement = NULL;
+    ElunaTemplate<WorldPacket>::pushBorrowed(L, &packet);
     Push(L, player);
     ENTRY_EXECUTE(2);
     FOR_RETS(i)
@@ -194,30 +236,49 @@ void Eluna::OnPacketSendOne(Player* player, WorldPacket& packet, bool& result)
         if (lua_isnoneornil(L, i))
             continue;
         if (WorldPacket* data = CHECKOBJ<WorldPacket>(L, i, false))
-            packet = *data;
+        {
+            if (data != &packet)
+                replacement = data;
+        }
         if (!CHECKVAL<bool>(L, i, true))
         {
             result = false;
             break;
         }
     }
+    // Several handlers can return the same packet, so only the last replacement is moved and only once
+    if (replacement)
+        packet = std::move(*replacement);
     ENDCALL();
+    // The borrowed packet can not be used after the hook and reads from it must not move the core's read position
+    m_Handles.Release(&packet);
+    if (!replacement)
+        packet.rpos(rpos);
 }
 
 bool Eluna::OnPacketReceive(WorldSession* session, WorldPacket& packet)
 {
+    uint32 opcode = packet.GetOpcode();
+    if (opcode >= NUM_MSG_TYPES || !PacketReceiveOpcodes.test(opcode))
+        return true;
+
     bool result = true;
     Player* player = NULL;
     if (session)
         player = session->GetPlayer();
-    OnPacketReceiveAny(player, packet, result);
+    if (ServerEventBindings->HasEvents(SERVER_EVENT_ON_PACKET_RECEIVE))
+        OnPacketReceiveAny(player, packet, result, ServerEventBindings->Bindings[SERVER_EVENT_ON_PACKET_RECEIVE]);
+    if (const PacketFilterBind::ElunaBindingMap* binds = PacketReceiveFilterBindings->GetBindMap(opcode))
+        OnPacketReceiveAny(player, packet, result, *binds);
     OnPacketReceiveOne(player, packet, result);
     return result;
 }
-void Eluna::OnPacketReceiveAny(Player* player, WorldPacket& packet, bool& result)
+void Eluna::OnPacketReceiveAny(Player* player, WorldPacket& packet, bool& result, const std::vector<int>& binds)
 {
-    EVENT_BEGIN(ServerEventBindings, SERVER_EVENT_ON_PACKET_RECEIVE, return);
-    Push(L, new WorldPacket(packet));
+    EVENT_BEGIN_BINDS(ServerEventBindings, SERVER_EVENT_ON_PACKET_RECEIVE, binds);
+    size_t rpos = packet.rpos();
+    WorldPacket* replacement = NULL;
+    ElunaTemplate<WorldPacket>::pushBorrowed(L, &packet);
     Push(L, player);
     EVENT_EXECUTE(2);
     FOR_RETS(i)
@@ -225,19 +286,31 @@ void Eluna::OnPacketReceiveAny(Player* player, WorldPacket& packet, bool& result
         if (lua_isnoneornil(L, i))
             continue;
         if (WorldPacket* data = CHECKOBJ<WorldPacket>(L, i, false))
-            packet = *data;
+        {
+            if (data != &packet)
+                replacement = data;
+        }
         if (!CHECKVAL<bool>(L, i, true))
         {
             result = false;
             break;
         }
     }
+    // Several handlers can return the same packet, so only the last replacement is moved and only once
+    if (replacement)
+        packet = std::move(*replacement);
     ENDCALL();
+    // The borrowed packet can not be used after the hook and reads from it must not move the core's read position
+    m_Handles.Release(&packet);
+    if (!replacement)
+        packet.rpos(rpos);
 }
 void Eluna::OnPacketReceiveOne(Player* player, WorldPacket& packet, bool& result)
 {
     ENTRY_BEGIN(PacketEventBindings, OpcodesList(packet.GetOpcode()), PACKET_EVENT_ON_PACKET_RECEIVE, return);
-    Push(L, new WorldPacket(packet));
+    size_t rpos = packet.rpos();
+    WorldPacket* replacement = NULL;
+    ElunaTemplate<WorldPacket>::pushBorrowed(L, &packet);
     Push(L, player);
     ENTRY_EXECUTE(2);
     FOR_RETS(i)
@@ -245,14 +318,24 @@ void Eluna::OnPacketReceiveOne(Player* player, WorldPacket& packet, bool& result
         if (lua_isnoneornil(L, i))
             continue;
         if (WorldPacket* data = CHECKOBJ<WorldPacket>(L, i, false))
-            packet = *data;
+        {
+            if (data != &packet)
+                replacement = data;
+        }
         if (!CHECKVAL<bool>(L, i, true))
         {
             result = false;
             break;
         }
     }
+    // Several handlers can return the same packet, so only the last replacement is moved and only once
+    if (replacement)
+        packet = std::move(*replacement);
     ENDCALL();
+    // The borrowed packet can not be used after the hook and reads from it must not move the core's read position
+    m_Handles.Release(&packet);
+    if (!replacement)
+        packet.rpos(rpos);
 }
 
 // AddOns
@@ -315,11 +398,26 @@ void Eluna::OnWorldUpdate(uint32 diff)
 {
     if (reload)
     {
-        ReloadEluna();
-        return;
+        if (ConfigMgr::GetBoolDefault("Eluna.BackgroundReload", false))
+            StartBackgroundReload();
+        else
+        {
+            ReloadEluna();
+            return;
+        }
     }
+    // Deletes this state if a new one was swapped in
+    if (FinishBackgroundReload())
+        return;
+    ReleasePending();
 
+    m_Deferred->Drain(); // Queued calls refer to the bindings by index, run them before scripts are reloaded
+    RemoveDisabledHandlers();
+    if (m_Watcher)
+        m_Watcher->Update();
+    RunCommands();
     m_EventMgr->Update(diff);
+    StepGC(diff);
     EVENT_BEGIN(ServerEventBindings, WORLD_EVENT_ON_UPDATE, return);
     Push(L, diff);
     EVENT_EXECUTE(0);
@@ -520,10 +618,35 @@ bool Eluna::OnCommand(Player* player, const char* text)
             std::transform(reload.begin(), reload.end(), reload.begin(), ::tolower);
             if (reload == "reload")
             {
+                // .reload eluna [script]
+                std::string script;
+                std::string::size_type space = eluna.find(' ');
+                if (space != std::string::npos)
+                {
+                    script = eluna.substr(space + 1);
+                    eluna.erase(space);
+                }
                 std::transform(eluna.begin(), eluna.end(), eluna.begin(), ::tolower);
                 if (std::string("eluna").find(eluna) == 0)
                 {
-                    Eluna::reload = true;
+                    if (script.empty())
+                        Eluna::reload = true;
+                    else if (GEluna)
+                    {
+                        std::lock_guard<std::mutex> guard(GEluna->m_CommandsLock);
+                        GEluna->m_ScriptReloads.push_back(script);
+                    }
+                    return false;
+                }
+            }
+            else if (reload == "eluna")
+            {
+                // .eluna stats [reset], run by GEluna as the stats of all states are needed
+                std::transform(eluna.begin(), eluna.end(), eluna.begin(), ::tolower);
+                if ((eluna == "stats" || eluna == "stats reset") && GEluna)
+                {
+                    std::lock_guard<std::mutex> guard(GEluna->m_CommandsLock);
+                    GEluna->m_StatsRequests.push_back(std::make_pair(player ? uint64(player->GET_GUID()) : uint64(0), eluna == "stats reset"));
                     return false;
                 }
             }
@@ -547,17 +670,19 @@ bool Eluna::OnCommand(Player* player, const char* text)
 
 void Eluna::OnLootItem(Player* pPlayer, Item* pItem, uint32 count, uint64 guid)
 {
+    EVENT_DEFER(PlayerEventBindings, PLAYER_EVENT_ON_LOOT_ITEM, pPlayer, pItem, count, guid);
     EVENT_BEGIN(PlayerEventBindings, PLAYER_EVENT_ON_LOOT_ITEM, return);
     Push(L, pPlayer);
     Push(L, pItem);
     Push(L, count);
-    Push(L, guid);
+    PushGUID(L, guid);
     EVENT_EXECUTE(0);
     ENDCALL();
 }
 
 void Eluna::OnLootMoney(Player* pPlayer, uint32 amount)
 {
+    EVENT_DEFER(PlayerEventBindings, PLAYER_EVENT_ON_LOOT_MONEY, pPlayer, amount);
     EVENT_BEGIN(PlayerEventBindings, PLAYER_EVENT_ON_LOOT_MONEY, return);
     Push(L, pPlayer);
     Push(L, amount);
@@ -567,6 +692,7 @@ void Eluna::OnLootMoney(Player* pPlayer, uint32 amount)
 
 void Eluna::OnFirstLogin(Player* pPlayer)
 {
+    EVENT_DEFER(PlayerEventBindings, PLAYER_EVENT_ON_FIRST_LOGIN, pPlayer);
     EVENT_BEGIN(PlayerEventBindings, PLAYER_EVENT_ON_FIRST_LOGIN, return);
     Push(L, pPlayer);
     EVENT_EXECUTE(0);
@@ -575,6 +701,7 @@ void Eluna::OnFirstLogin(Player* pPlayer)
 
 void Eluna::OnRepop(Player* pPlayer)
 {
+    EVENT_DEFER(PlayerEventBindings, PLAYER_EVENT_ON_REPOP, pPlayer);
     EVENT_BEGIN(PlayerEventBindings, PLAYER_EVENT_ON_REPOP, return);
     Push(L, pPlayer);
     EVENT_EXECUTE(0);
@@ -583,6 +710,7 @@ void Eluna::OnRepop(Player* pPlayer)
 
 void Eluna::OnResurrect(Player* pPlayer)
 {
+    EVENT_DEFER(PlayerEventBindings, PLAYER_EVENT_ON_RESURRECT, pPlayer);
     EVENT_BEGIN(PlayerEventBindings, PLAYER_EVENT_ON_RESURRECT, return);
     Push(L, pPlayer);
     EVENT_EXECUTE(0);
@@ -591,6 +719,7 @@ void Eluna::OnResurrect(Player* pPlayer)
 
 void Eluna::OnQuestAbandon(Player* pPlayer, uint32 questId)
 {
+    EVENT_DEFER(PlayerEventBindings, PLAYER_EVENT_ON_QUEST_ABANDON, pPlayer, questId);
     EVENT_BEGIN(PlayerEventBindings, PLAYER_EVENT_ON_QUEST_ABANDON, return);
     Push(L, pPlayer);
     Push(L, questId);
@@ -600,6 +729,7 @@ void Eluna::OnQuestAbandon(Player* pPlayer, uint32 questId)
 
 void Eluna::OnEquip(Player* pPlayer, Item* pItem, uint8 bag, uint8 slot)
 {
+    EVENT_DEFER(PlayerEventBindings, PLAYER_EVENT_ON_EQUIP, pPlayer, pItem, bag, slot);
     EVENT_BEGIN(PlayerEventBindings, PLAYER_EVENT_ON_EQUIP, return);
     Push(L, pPlayer);
     Push(L, pItem);
@@ -638,6 +768,7 @@ void Eluna::OnPlayerEnterCombat(Player* pPlayer, Unit* pEnemy)
 
 void Eluna::OnPlayerLeaveCombat(Player* pPlayer)
 {
+    EVENT_DEFER(PlayerEventBindings, PLAYER_EVENT_ON_LEAVE_COMBAT, pPlayer);
     EVENT_BEGIN(PlayerEventBindings, PLAYER_EVENT_ON_LEAVE_COMBAT, return);
     Push(L, pPlayer);
     EVENT_EXECUTE(0);
@@ -646,6 +777,7 @@ void Eluna::OnPlayerLeaveCombat(Player* pPlayer)
 
 void Eluna::OnPVPKill(Player* pKiller, Player* pKilled)
 {
+    EVENT_DEFER(PlayerEventBindings, PLAYER_EVENT_ON_KILL_PLAYER, pKiller, pKilled);
     EVENT_BEGIN(PlayerEventBindings, PLAYER_EVENT_ON_KILL_PLAYER, return);
     Push(L, pKiller);
     Push(L, pKilled);
@@ -673,6 +805,7 @@ void Eluna::OnPlayerKilledByCreature(Creature* pKiller, Player* pKilled)
 
 void Eluna::OnLevelChanged(Player* pPlayer, uint8 oldLevel)
 {
+    EVENT_DEFER(PlayerEventBindings, PLAYER_EVENT_ON_LEVEL_CHANGE, pPlayer, oldLevel);
     EVENT_BEGIN(PlayerEventBindings, PLAYER_EVENT_ON_LEVEL_CHANGE, return);
     Push(L, pPlayer);
     Push(L, oldLevel);
@@ -682,6 +815,7 @@ void Eluna::OnLevelChanged(Player* pPlayer, uint8 oldLevel)
 
 void Eluna::OnFreeTalentPointsChanged(Player* pPlayer, uint32 newPoints)
 {
+    EVENT_DEFER(PlayerEventBindings, PLAYER_EVENT_ON_TALENTS_CHANGE, pPlayer, newPoints);
     EVENT_BEGIN(PlayerEventBindings, PLAYER_EVENT_ON_TALENTS_CHANGE, return);
     Push(L, pPlayer);
     Push(L, newPoints);
@@ -691,6 +825,7 @@ void Eluna::OnFreeTalentPointsChanged(Player* pPlayer, uint32 newPoints)
 
 void Eluna::OnTalentsReset(Player* pPlayer, bool noCost)
 {
+    EVENT_DEFER(PlayerEventBindings, PLAYER_EVENT_ON_TALENTS_RESET, pPlayer, noCost);
     EVENT_BEGIN(PlayerEventBindings, PLAYER_EVENT_ON_TALENTS_RESET, return);
     Push(L, pPlayer);
     Push(L, noCost);
@@ -742,6 +877,7 @@ void Eluna::OnReputationChange(Player* pPlayer, uint32 factionID, int32& standin
 
 void Eluna::OnDuelRequest(Player* pTarget, Player* pChallenger)
 {
+    EVENT_DEFER(PlayerEventBindings, PLAYER_EVENT_ON_DUEL_REQUEST, pTarget, pChallenger);
     EVENT_BEGIN(PlayerEventBindings, PLAYER_EVENT_ON_DUEL_REQUEST, return);
     Push(L, pTarget);
     Push(L, pChallenger);
@@ -751,6 +887,7 @@ void Eluna::OnDuelRequest(Player* pTarget, Player* pChallenger)
 
 void Eluna::OnDuelStart(Player* pStarter, Player* pChallenger)
 {
+    EVENT_DEFER(PlayerEventBindings, PLAYER_EVENT_ON_DUEL_START, pStarter, pChallenger);
     EVENT_BEGIN(PlayerEventBindings, PLAYER_EVENT_ON_DUEL_START, return);
     Push(L, pStarter);
     Push(L, pChallenger);
@@ -760,6 +897,7 @@ void Eluna::OnDuelStart(Player* pStarter, Player* pChallenger)
 
 void Eluna::OnDuelEnd(Player* pWinner, Player* pLoser, DuelCompleteType type)
 {
+    EVENT_DEFER(PlayerEventBindings, PLAYER_EVENT_ON_DUEL_END, pWinner, pLoser, type);
     EVENT_BEGIN(PlayerEventBindings, PLAYER_EVENT_ON_DUEL_END, return);
     Push(L, pWinner);
     Push(L, pLoser);
@@ -770,6 +908,7 @@ void Eluna::OnDuelEnd(Player* pWinner, Player* pLoser, DuelCompleteType type)
 
 void Eluna::OnEmote(Player* pPlayer, uint32 emote)
 {
+    EVENT_DEFER(PlayerEventBindings, PLAYER_EVENT_ON_EMOTE, pPlayer, emote);
     EVENT_BEGIN(PlayerEventBindings, PLAYER_EVENT_ON_EMOTE, return);
     Push(L, pPlayer);
     Push(L, emote);
@@ -779,11 +918,12 @@ void Eluna::OnEmote(Player* pPlayer, uint32 emote)
 
 void Eluna::OnTextEmote(Player* pPlayer, uint32 textEmote, uint32 emoteNum, uint64 guid)
 {
+    EVENT_DEFER(PlayerEventBindings, PLAYER_EVENT_ON_TEXT_EMOTE, pPlayer, textEmote, emoteNum, guid);
     EVENT_BEGIN(PlayerEventBindings, PLAYER_EVENT_ON_TEXT_EMOTE, return);
     Push(L, pPlayer);
     Push(L, textEmote);
     Push(L, emoteNum);
-    Push(L, guid);
+    PushGUID(L, guid);
     EVENT_EXECUTE(0);
     ENDCALL();
 }
@@ -800,6 +940,7 @@ void Eluna::OnSpellCast(Player* pPlayer, Spell* pSpell, bool skipCheck)
 
 void Eluna::OnLogin(Player* pPlayer)
 {
+    EVENT_DEFER(PlayerEventBindings, PLAYER_EVENT_ON_LOGIN, pPlayer);
     EVENT_BEGIN(PlayerEventBindings, PLAYER_EVENT_ON_LOGIN, return);
     Push(L, pPlayer);
     EVENT_EXECUTE(0);
@@ -808,6 +949,7 @@ void Eluna::OnLogin(Player* pPlayer)
 
 void Eluna::OnLogout(Player* pPlayer)
 {
+    EVENT_DEFER(PlayerEventBindings, PLAYER_EVENT_ON_LOGOUT, pPlayer);
     EVENT_BEGIN(PlayerEventBindings, PLAYER_EVENT_ON_LOGOUT, return);
     Push(L, pPlayer);
     EVENT_EXECUTE(0);
@@ -824,6 +966,7 @@ void Eluna::OnCreate(Player* pPlayer)
 
 void Eluna::OnDelete(uint32 guidlow)
 {
+    EVENT_DEFER(PlayerEventBindings, PLAYER_EVENT_ON_CHARACTER_DELETE, guidlow);
     EVENT_BEGIN(PlayerEventBindings, PLAYER_EVENT_ON_CHARACTER_DELETE, return);
     Push(L, guidlow);
     EVENT_EXECUTE(0);
@@ -832,6 +975,7 @@ void Eluna::OnDelete(uint32 guidlow)
 
 void Eluna::OnSave(Player* pPlayer)
 {
+    EVENT_DEFER(PlayerEventBindings, PLAYER_EVENT_ON_SAVE, pPlayer);
     EVENT_BEGIN(PlayerEventBindings, PLAYER_EVENT_ON_SAVE, return);
     Push(L, pPlayer);
     EVENT_EXECUTE(0);
@@ -840,6 +984,7 @@ void Eluna::OnSave(Player* pPlayer)
 
 void Eluna::OnBindToInstance(Player* pPlayer, Difficulty difficulty, uint32 mapid, bool permanent)
 {
+    EVENT_DEFER(PlayerEventBindings, PLAYER_EVENT_ON_BIND_TO_INSTANCE, pPlayer, difficulty, mapid, permanent);
     EVENT_BEGIN(PlayerEventBindings, PLAYER_EVENT_ON_BIND_TO_INSTANCE, return);
     Push(L, pPlayer);
     Push(L, difficulty);
@@ -851,6 +996,7 @@ void Eluna::OnBindToInstance(Player* pPlayer, Difficulty difficulty, uint32 mapi
 
 void Eluna::OnUpdateZone(Player* pPlayer, uint32 newZone, uint32 newArea)
 {
+    EVENT_DEFER(PlayerEventBindings, PLAYER_EVENT_ON_UPDATE_ZONE, pPlayer, newZone, newArea);
     EVENT_BEGIN(PlayerEventBindings, PLAYER_EVENT_ON_UPDATE_ZONE, return);
     Push(L, pPlayer);
     Push(L, newZone);
@@ -861,6 +1007,7 @@ void Eluna::OnUpdateZone(Player* pPlayer, uint32 newZone, uint32 newArea)
 
 void Eluna::OnMapChanged(Player* player)
 {
+    EVENT_DEFER(PlayerEventBindings, PLAYER_EVENT_ON_MAP_CHANGE, player);
     EVENT_BEGIN(PlayerEventBindings, PLAYER_EVENT_ON_MAP_CHANGE, return);
     Push(L, player);
     EVENT_EXECUTE(0);
@@ -1057,6 +1204,7 @@ void Eluna::OnRemovePassenger(Vehicle* vehicle, Unit* passenger)
 
 void Eluna::OnAddMember(Guild* guild, Player* player, uint32 plRank)
 {
+    EVENT_DEFER(GuildEventBindings, GUILD_EVENT_ON_ADD_MEMBER, guild, player, plRank);
     EVENT_BEGIN(GuildEventBindings, GUILD_EVENT_ON_ADD_MEMBER, return);
     Push(L, guild);
     Push(L, player);
@@ -1067,6 +1215,7 @@ void Eluna::OnAddMember(Guild* guild, Player* player, uint32 plRank)
 
 void Eluna::OnRemoveMember(Guild* guild, Player* player, bool isDisbanding)
 {
+    EVENT_DEFER(GuildEventBindings, GUILD_EVENT_ON_REMOVE_MEMBER, guild, player, isDisbanding);
     EVENT_BEGIN(GuildEventBindings, GUILD_EVENT_ON_REMOVE_MEMBER, return);
     Push(L, guild);
     Push(L, player);
@@ -1077,6 +1226,7 @@ void Eluna::OnRemoveMember(Guild* guild, Player* player, bool isDisbanding)
 
 void Eluna::OnMOTDChanged(Guild* guild, const std::string& newMotd)
 {
+    EVENT_DEFER(GuildEventBindings, GUILD_EVENT_ON_MOTD_CHANGE, guild, newMotd);
     EVENT_BEGIN(GuildEventBindings, GUILD_EVENT_ON_MOTD_CHANGE, return);
     Push(L, guild);
     Push(L, newMotd);
@@ -1086,6 +1236,7 @@ void Eluna::OnMOTDChanged(Guild* guild, const std::string& newMotd)
 
 void Eluna::OnInfoChanged(Guild* guild, const std::string& newInfo)
 {
+    EVENT_DEFER(GuildEventBindings, GUILD_EVENT_ON_INFO_CHANGE, guild, newInfo);
     EVENT_BEGIN(GuildEventBindings, GUILD_EVENT_ON_INFO_CHANGE, return);
     Push(L, guild);
     Push(L, newInfo);
@@ -1095,6 +1246,7 @@ void Eluna::OnInfoChanged(Guild* guild, const std::string& newInfo)
 
 void Eluna::OnCreate(Guild* guild, Player* leader, const std::string& name)
 {
+    EVENT_DEFER(GuildEventBindings, GUILD_EVENT_ON_CREATE, guild, leader, name);
     EVENT_BEGIN(GuildEventBindings, GUILD_EVENT_ON_CREATE, return);
     Push(L, guild);
     Push(L, leader);
@@ -1105,6 +1257,7 @@ void Eluna::OnCreate(Guild* guild, Player* leader, const std::string& name)
 
 void Eluna::OnDisband(Guild* guild)
 {
+    EVENT_DEFER(GuildEventBindings, GUILD_EVENT_ON_DISBAND, guild);
     EVENT_BEGIN(GuildEventBindings, GUILD_EVENT_ON_DISBAND, return);
     Push(L, guild);
     EVENT_EXECUTE(0);
@@ -1151,6 +1304,7 @@ void Eluna::OnItemMove(Guild* guild, Player* player, Item* pItem, bool isSrcBank
 
 void Eluna::OnEvent(Guild* guild, uint8 eventType, uint32 playerGuid1, uint32 playerGuid2, uint8 newRank)
 {
+    EVENT_DEFER(GuildEventBindings, GUILD_EVENT_ON_EVENT, guild, eventType, playerGuid1, playerGuid2, newRank);
     EVENT_BEGIN(GuildEventBindings, GUILD_EVENT_ON_EVENT, return);
     Push(L, guild);
     Push(L, eventType);
@@ -1163,6 +1317,7 @@ void Eluna::OnEvent(Guild* guild, uint8 eventType, uint32 playerGuid1, uint32 pl
 
 void Eluna::OnBankEvent(Guild* guild, uint8 eventType, uint8 tabId, uint32 playerGuid, uint32 itemOrMoney, uint16 itemStackCount, uint8 destTabId)
 {
+    EVENT_DEFER(GuildEventBindings, GUILD_EVENT_ON_BANK_EVENT, guild, eventType, tabId, playerGuid, itemOrMoney, itemStackCount, destTabId);
     EVENT_BEGIN(GuildEventBindings, GUILD_EVENT_ON_BANK_EVENT, return);
     Push(L, guild);
     Push(L, eventType);
@@ -1177,27 +1332,30 @@ void Eluna::OnBankEvent(Guild* guild, uint8 eventType, uint8 tabId, uint32 playe
 // Group
 void Eluna::OnAddMember(Group* group, uint64 guid)
 {
+    EVENT_DEFER(GroupEventBindings, GROUP_EVENT_ON_MEMBER_ADD, group, guid);
     EVENT_BEGIN(GroupEventBindings, GROUP_EVENT_ON_MEMBER_ADD, return);
     Push(L, group);
-    Push(L, guid);
+    PushGUID(L, guid);
     EVENT_EXECUTE(0);
     ENDCALL();
 }
 
 void Eluna::OnInviteMember(Group* group, uint64 guid)
 {
+    EVENT_DEFER(GroupEventBindings, GROUP_EVENT_ON_MEMBER_INVITE, group, guid);
     EVENT_BEGIN(GroupEventBindings, GROUP_EVENT_ON_MEMBER_INVITE, return);
     Push(L, group);
-    Push(L, guid);
+    PushGUID(L, guid);
     EVENT_EXECUTE(0);
     ENDCALL();
 }
 
 void Eluna::OnRemoveMember(Group* group, uint64 guid, uint8 method)
 {
+    EVENT_DEFER(GroupEventBindings, GROUP_EVENT_ON_MEMBER_REMOVE, group, guid, method);
     EVENT_BEGIN(GroupEventBindings, GROUP_EVENT_ON_MEMBER_REMOVE, return);
     Push(L, group);
-    Push(L, guid);
+    PushGUID(L, guid);
     Push(L, method);
     EVENT_EXECUTE(0);
     ENDCALL();
@@ -1205,16 +1363,18 @@ void Eluna::OnRemoveMember(Group* group, uint64 guid, uint8 method)
 
 void Eluna::OnChangeLeader(Group* group, uint64 newLeaderGuid, uint64 oldLeaderGuid)
 {
+    EVENT_DEFER(GroupEventBindings, GROUP_EVENT_ON_LEADER_CHANGE, group, newLeaderGuid, oldLeaderGuid);
     EVENT_BEGIN(GroupEventBindings, GROUP_EVENT_ON_LEADER_CHANGE, return);
     Push(L, group);
-    Push(L, newLeaderGuid);
-    Push(L, oldLeaderGuid);
+    PushGUID(L, newLeaderGuid);
+    PushGUID(L, oldLeaderGuid);
     EVENT_EXECUTE(0);
     ENDCALL();
 }
 
 void Eluna::OnDisband(Group* group)
 {
+    EVENT_DEFER(GroupEventBindings, GROUP_EVENT_ON_DISBAND, group);
     EVENT_BEGIN(GroupEventBindings, GROUP_EVENT_ON_DISBAND, return);
     Push(L, group);
     EVENT_EXECUTE(0);
@@ -1223,9 +1383,10 @@ void Eluna::OnDisband(Group* group)
 
 void Eluna::OnCreate(Group* group, uint64 leaderGuid, GroupType groupType)
 {
+    EVENT_DEFER(GroupEventBindings, GROUP_EVENT_ON_CREATE, group, leaderGuid, groupType);
     EVENT_BEGIN(GroupEventBindings, GROUP_EVENT_ON_CREATE, return);
     Push(L, group);
-    Push(L, leaderGuid);
+    PushGUID(L, leaderGuid);
     Push(L, groupType);
     EVENT_EXECUTE(0);
     ENDCALL();
@@ -1241,10 +1402,18 @@ void Eluna::OnCreate(Map* map)
 }
 void Eluna::OnDestroy(Map* map)
 {
-    EVENT_BEGIN(ServerEventBindings, MAP_EVENT_ON_DESTROY, return);
-    Push(L, map);
-    EVENT_EXECUTE(0);
-    ENDCALL();
+    if (ServerEventBindings->HasEvents(MAP_EVENT_ON_DESTROY))
+    {
+        EVENT_BEGIN_BINDS(ServerEventBindings, MAP_EVENT_ON_DESTROY, ServerEventBindings->Bindings[MAP_EVENT_ON_DESTROY]);
+        Push(L, map);
+        EVENT_EXECUTE(0);
+        ENDCALL();
+    }
+    // Events of objects still on the map wait in the global wheel for the object's next map
+    m_EventMgr->RemoveMap(map);
+    // The map's own state goes with the map
+    if (perMapStates)
+        RemoveMapState(map);
 }
 void Eluna::OnPlayerEnter(Map* map, Player* player)
 {
@@ -1264,6 +1433,11 @@ void Eluna::OnPlayerLeave(Map* map, Player* player)
 }
 void Eluna::OnUpdate(Map* map, uint32 diff)
 {
+    // With per map states Map::Update runs this on the map's state
+    if (perMapStates && this == GEluna)
+        OnMissingMapScope();
+    // Events of the objects on the map run in the map's update
+    m_EventMgr->UpdateMap(map, diff);
     EVENT_BEGIN(ServerEventBindings, MAP_EVENT_ON_UPDATE, return);
     Push(L, map);
     Push(L, diff);
@@ -1380,12 +1554,30 @@ struct ElunaCreatureAI : ScriptedAI
 #define me  m_creature
 #endif
 
-    ElunaCreatureAI(Creature* creature): ScriptedAI(creature)
+    typedef EntryBind<HookMgr::CreatureEvents>::ElunaBindingMap ElunaBindingMap;
+
+    // Bindings of the creature's entry, so callbacks do not look them up
+    const ElunaBindingMap* binds;
+    uint32 bindsGeneration;
+
+    ElunaCreatureAI(Creature* creature, const ElunaBindingMap* entryBinds): ScriptedAI(creature),
+        binds(entryBinds), bindsGeneration(sEluna->CreatureEventBindings->Generation)
     {
         JustRespawned();
     }
     ~ElunaCreatureAI() {}
 
+    // Resolves the bindings again only if they were reset, for example by a reload
+    const ElunaBindingMap* GetBinds()
+    {
+        if (bindsGeneration != sEluna->CreatureEventBindings->Generation)
+        {
+            binds = sEluna->CreatureEventBindings->GetBindMap(me->GetEntry());
+            bindsGeneration = sEluna->CreatureEventBindings->Generation;
+        }
+        return binds;
+    }
+
     //Called at World update tick
 #ifndef TRINITY
     void UpdateAI(const uint32 diff) override
@@ -1400,7 +1592,7 @@ struct ElunaCreatureAI : ScriptedAI
         if (!me->HasReactState(REACT_PASSIVE))
             ScriptedAI::UpdateAI(diff);
 #endif
-        ENTRY_BEGIN(CreatureEventBindings, me->GetEntry(), CREATURE_EVENT_ON_AIUPDATE, return);
+        ENTRY_BEGIN_REF(CreatureEventBindings, GetBinds(), me->GetEntry(), CREATURE_EVENT_ON_AIUPDATE, return);
         Eluna::Push(L, me);
         Eluna::Push(L, diff);
         ENTRY_EXECUTE(0);
@@ -1412,7 +1604,7 @@ struct ElunaCreatureAI : ScriptedAI
     void EnterCombat(Unit* target) override
     {
         ScriptedAI::EnterCombat(target);
-        ENTRY_BEGIN(CreatureEventBindings, me->GetEntry(), CREATURE_EVENT_ON_ENTER_COMBAT, return);
+        ENTRY_BEGIN_REF(CreatureEventBindings, GetBinds(), me->GetEntry(), CREATURE_EVENT_ON_ENTER_COMBAT, return);
         Eluna::Push(L, me);
         Eluna::Push(L, target);
         ENTRY_EXECUTE(0);
@@ -1423,7 +1615,7 @@ struct ElunaCreatureAI : ScriptedAI
     void DamageTaken(Unit* attacker, uint32& damage) override
     {
         ScriptedAI::DamageTaken(attacker, damage);
-        ENTRY_BEGIN(CreatureEventBindings, me->GetEntry(), CREATURE_EVENT_ON_DAMAGE_TAKEN, return);
+        ENTRY_BEGIN_REF(CreatureEventBindings, GetBinds(), me->GetEntry(), CREATURE_EVENT_ON_DAMAGE_TAKEN, return);
         Eluna::Push(L, me);
         Eluna::Push(L, attacker);
         Eluna::Push(L, damage);
@@ -1442,7 +1634,7 @@ struct ElunaCreatureAI : ScriptedAI
     {
         ScriptedAI::JustDied(killer);
         On_Reset();
-        ENTRY_BEGIN(CreatureEventBindings, me->GetEntry(), CREATURE_EVENT_ON_DIED, return);
+        ENTRY_BEGIN_REF(CreatureEventBindings, GetBinds(), me->GetEntry(), CREATURE_EVENT_ON_DIED, return);
         Eluna::Push(L, me);
         Eluna::Push(L, killer);
         ENTRY_EXECUTE(0);
@@ -1453,7 +1645,7 @@ struct ElunaCreatureAI : ScriptedAI
     void KilledUnit(Unit* victim) override
     {
         ScriptedAI::KilledUnit(victim);
-        ENTRY_BEGIN(CreatureEventBindings, me->GetEntry(), CREATURE_EVENT_ON_TARGET_DIED, return);
+        ENTRY_BEGIN_REF(CreatureEventBindings, GetBinds(), me->GetEntry(), CREATURE_EVENT_ON_TARGET_DIED, return);
         Eluna::Push(L, me);
         Eluna::Push(L, victim);
         ENTRY_EXECUTE(0);
@@ -1464,7 +1656,7 @@ struct ElunaCreatureAI : ScriptedAI
     void JustSummoned(Creature* summon) override
     {
         ScriptedAI::JustSummoned(summon);
-        ENTRY_BEGIN(CreatureEventBindings, me->GetEntry(), CREATURE_EVENT_ON_JUST_SUMMONED_CREATURE, return);
+        ENTRY_BEGIN_REF(CreatureEventBindings, GetBinds(), me->GetEntry(), CREATURE_EVENT_ON_JUST_SUMMONED_CREATURE, return);
         Eluna::Push(L, me);
         Eluna::Push(L, summon);
         ENTRY_EXECUTE(0);
@@ -1475,7 +1667,7 @@ struct ElunaCreatureAI : ScriptedAI
     void SummonedCreatureDespawn(Creature* summon) override
     {
         ScriptedAI::SummonedCreatureDespawn(summon);
-        ENTRY_BEGIN(CreatureEventBindings, me->GetEntry(), CREATURE_EVENT_ON_SUMMONED_CREATURE_DESPAWN, return);
+        ENTRY_BEGIN_REF(CreatureEventBindings, GetBinds(), me->GetEntry(), CREATURE_EVENT_ON_SUMMONED_CREATURE_DESPAWN, return);
         Eluna::Push(L, me);
         Eluna::Push(L, summon);
         ENTRY_EXECUTE(0);
@@ -1486,7 +1678,7 @@ struct ElunaCreatureAI : ScriptedAI
     void MovementInform(uint32 type, uint32 id) override
     {
         ScriptedAI::MovementInform(type, id);
-        ENTRY_BEGIN(CreatureEventBindings, me->GetEntry(), CREATURE_EVENT_ON_REACH_WP, return);
+        ENTRY_BEGIN_REF(CreatureEventBindings, GetBinds(), me->GetEntry(), CREATURE_EVENT_ON_REACH_WP, return);
         Eluna::Push(L, me);
         Eluna::Push(L, type);
         Eluna::Push(L, id);
@@ -1498,7 +1690,7 @@ struct ElunaCreatureAI : ScriptedAI
     void AttackStart(Unit* target) override
     {
         ScriptedAI::AttackStart(target);
-        ENTRY_BEGIN(CreatureEventBindings, me->GetEntry(), CREATURE_EVENT_ON_PRE_COMBAT, return);
+        ENTRY_BEGIN_REF(CreatureEventBindings, GetBinds(), me->GetEntry(), CREATURE_EVENT_ON_PRE_COMBAT, return);
         Eluna::Push(L, me);
         Eluna::Push(L, target);
         ENTRY_EXECUTE(0);
@@ -1510,7 +1702,7 @@ struct ElunaCreatureAI : ScriptedAI
     {
         ScriptedAI::EnterEvadeMode();
         On_Reset();
-        ENTRY_BEGIN(CreatureEventBindings, me->GetEntry(), CREATURE_EVENT_ON_LEAVE_COMBAT, return);
+        ENTRY_BEGIN_REF(CreatureEventBindings, GetBinds(), me->GetEntry(), CREATURE_EVENT_ON_LEAVE_COMBAT, return);
         Eluna::Push(L, me);
         ENTRY_EXECUTE(0);
         ENDCALL();
@@ -1520,7 +1712,7 @@ struct ElunaCreatureAI : ScriptedAI
     void AttackedBy(Unit* attacker) /*override*/
     {
         //ScriptedAI::AttackedBy(attacker); //dsy: need fix
-        ENTRY_BEGIN(CreatureEventBindings, me->GetEntry(), CREATURE_EVENT_ON_ATTACKED_AT, return);
+        ENTRY_BEGIN_REF(CreatureEventBindings, GetBinds(), me->GetEntry(), CREATURE_EVENT_ON_ATTACKED_AT, return);
         Eluna::Push(L, me);
         Eluna::Push(L, attacker);
         ENTRY_EXECUTE(0);
@@ -1532,7 +1724,7 @@ struct ElunaCreatureAI : ScriptedAI
     {
         ScriptedAI::JustRespawned();
         On_Reset();
-        ENTRY_BEGIN(CreatureEventBindings, me->GetEntry(), CREATURE_EVENT_ON_SPAWN, return);
+        ENTRY_BEGIN_REF(CreatureEventBindings, GetBinds(), me->GetEntry(), CREATURE_EVENT_ON_SPAWN, return);
         Eluna::Push(L, me);
         ENTRY_EXECUTE(0);
         ENDCALL();
@@ -1542,7 +1734,7 @@ struct ElunaCreatureAI : ScriptedAI
     void JustReachedHome() override
     {
         ScriptedAI::JustReachedHome();
-        ENTRY_BEGIN(CreatureEventBindings, me->GetEntry(), CREATURE_EVENT_ON_REACH_HOME, return);
+        ENTRY_BEGIN_REF(CreatureEventBindings, GetBinds(), me->GetEntry(), CREATURE_EVENT_ON_REACH_HOME, return);
         Eluna::Push(L, me);
         ENTRY_EXECUTE(0);
         ENDCALL();
@@ -1552,7 +1744,7 @@ struct ElunaCreatureAI : ScriptedAI
     void ReceiveEmote(Player* player, uint32 emoteId) override
     {
         ScriptedAI::ReceiveEmote(player, emoteId);
-        ENTRY_BEGIN(CreatureEventBindings, me->GetEntry(), CREATURE_EVENT_ON_RECEIVE_EMOTE, return);
+        ENTRY_BEGIN_REF(CreatureEventBindings, GetBinds(), me->GetEntry(), CREATURE_EVENT_ON_RECEIVE_EMOTE, return);
         Eluna::Push(L, me);
         Eluna::Push(L, player);
         Eluna::Push(L, emoteId);
@@ -1564,7 +1756,7 @@ struct ElunaCreatureAI : ScriptedAI
     void CorpseRemoved(uint32& respawnDelay) override
     {
         ScriptedAI::CorpseRemoved(respawnDelay);
-        ENTRY_BEGIN(CreatureEventBindings, me->GetEntry(), CREATURE_EVENT_ON_CORPSE_REMOVED, return);
+        ENTRY_BEGIN_REF(CreatureEventBindings, GetBinds(), me->GetEntry(), CREATURE_EVENT_ON_CORPSE_REMOVED, return);
         Eluna::Push(L, me);
         Eluna::Push(L, respawnDelay);
         ENTRY_EXECUTE(1);
@@ -1588,7 +1780,7 @@ struct ElunaCreatureAI : ScriptedAI
     void MoveInLineOfSight(Unit* who) override
     {
         ScriptedAI::MoveInLineOfSight(who);
-        ENTRY_BEGIN(CreatureEventBindings, me->GetEntry(), CREATURE_EVENT_ON_MOVE_IN_LOS, return);
+        ENTRY_BEGIN_REF(CreatureEventBindings, GetBinds(), me->GetEntry(), CREATURE_EVENT_ON_MOVE_IN_LOS, return);
         Eluna::Push(L, me);
         Eluna::Push(L, who);
         ENTRY_EXECUTE(0);
@@ -1598,7 +1790,7 @@ struct ElunaCreatureAI : ScriptedAI
     // Called on creature initial spawn, respawn, death, evade (leave combat)
     void On_Reset() // Not an override, custom
     {
-        ENTRY_BEGIN(CreatureEventBindings, me->GetEntry(), CREATURE_EVENT_ON_RESET, return);
+        ENTRY_BEGIN_REF(CreatureEventBindings, GetBinds(), me->GetEntry(), CREATURE_EVENT_ON_RESET, return);
         Eluna::Push(L, me);
         ENTRY_EXECUTE(0);
         ENDCALL();
@@ -1608,7 +1800,7 @@ struct ElunaCreatureAI : ScriptedAI
     void SpellHit(Unit* caster, SpellInfo const* spell) override
     {
         ScriptedAI::SpellHit(caster, spell);
-        ENTRY_BEGIN(CreatureEventBindings, me->GetEntry(), CREATURE_EVENT_ON_HIT_BY_SPELL, return);
+        ENTRY_BEGIN_REF(CreatureEventBindings, GetBinds(), me->GetEntry(), CREATURE_EVENT_ON_HIT_BY_SPELL, return);
         Eluna::Push(L, me);
         Eluna::Push(L, caster);
         Eluna::Push(L, spell->Id); // Pass spell object?
@@ -1620,7 +1812,7 @@ struct ElunaCreatureAI : ScriptedAI
     void SpellHitTarget(Unit* target, SpellInfo const* spell) override
     {
         ScriptedAI::SpellHitTarget(target, spell);
-        ENTRY_BEGIN(CreatureEventBindings, me->GetEntry(), CREATURE_EVENT_ON_SPELL_HIT_TARGET, return);
+        ENTRY_BEGIN_REF(CreatureEventBindings, GetBinds(), me->GetEntry(), CREATURE_EVENT_ON_SPELL_HIT_TARGET, return);
         Eluna::Push(L, me);
         Eluna::Push(L, target);
         Eluna::Push(L, spell->Id); // Pass spell object?
@@ -1640,7 +1832,7 @@ struct ElunaCreatureAI : ScriptedAI
     void SummonedCreatureDies(Creature* summon, Unit* killer) override
     {
         ScriptedAI::SummonedCreatureDies(summon, killer);
-        ENTRY_BEGIN(CreatureEventBindings, me->GetEntry(), CREATURE_EVENT_ON_SUMMONED_CREATURE_DIED, return);
+        ENTRY_BEGIN_REF(CreatureEventBindings, GetBinds(), me->GetEntry(), CREATURE_EVENT_ON_SUMMONED_CREATURE_DIED, return);
         Eluna::Push(L, me);
         Eluna::Push(L, summon);
         Eluna::Push(L, killer);
@@ -1652,7 +1844,7 @@ struct ElunaCreatureAI : ScriptedAI
     void OwnerAttackedBy(Unit* attacker) /*override*/
     {
         //ScriptedAI::OwnerAttackedBy(attacker); //dsy: need fix
-        ENTRY_BEGIN(CreatureEventBindings, me->GetEntry(), CREATURE_EVENT_ON_OWNER_ATTACKED_AT, return);
+        ENTRY_BEGIN_REF(CreatureEventBindings, GetBinds(), me->GetEntry(), CREATURE_EVENT_ON_OWNER_ATTACKED_AT, return);
         Eluna::Push(L, me);
         Eluna::Push(L, attacker);
         ENTRY_EXECUTE(0);
@@ -1663,7 +1855,7 @@ struct ElunaCreatureAI : ScriptedAI
     void OwnerAttacked(Unit* target) override
     {
         ScriptedAI::OwnerAttacked(target);
-        ENTRY_BEGIN(CreatureEventBindings, me->GetEntry(), CREATURE_EVENT_ON_OWNER_ATTACKED, return);
+        ENTRY_BEGIN_REF(CreatureEventBindings, GetBinds(), me->GetEntry(), CREATURE_EVENT_ON_OWNER_ATTACKED, return);
         Eluna::Push(L, me);
         Eluna::Push(L, target);
         ENTRY_EXECUTE(0);
@@ -1829,7 +2021,8 @@ void Eluna::OnSpawn(GameObject* gameobject)
 
 CreatureAI* Eluna::GetAI(Creature* creature)
 {
-    if (!CreatureEventBindings->GetBindMap(creature->GetEntry()))
+    const EntryBind<HookMgr::CreatureEvents>::ElunaBindingMap* binds = CreatureEventBindings->GetBindMap(creature->GetEntry());
+    if (!binds)
         return NULL;
-    return new ElunaCreatureAI(creature);
+    return new ElunaCreatureAI(creature, binds);
 }
@@ -89,7 +89,7 @@ namespace HookMgr
         SERVER_EVENT_COUNT
     };
 
-    // RegisterPlayerEvent(eventId, function)
+    // RegisterPlayerEvent(eventId, function[, deferred])
     enum PlayerEvents
     {
         PLAYER_EVENT_ON_CHARACTER_CREATE        =     1,        // (event, player)
@@ -140,7 +140,7 @@ namespace HookMgr
         PLAYER_EVENT_COUNT
     };
 
-    // RegisterGuildEvent(eventId, function)
+    // RegisterGuildEvent(eventId, function[, deferred])
     enum GuildEvents
     {
         // Guild
@@ -159,7 +159,7 @@ namespace HookMgr
         GUILD_EVENT_COUNT
     };
 
-    // RegisterGroupEvent(eventId, function)
+    // RegisterGroupEvent(eventId, function[, deferred])
     enum GroupEvents
     {
         // Group
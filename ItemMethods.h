@@ -218,9 +218,9 @@ namespace LuaItem
     int GetOwnerGUID(lua_State* L, Item* item)
     {
 #ifndef TRINITY
-        Eluna::Push(L, item->GetOwnerGuid());
+        Eluna::PushGUID(L, item->GetOwnerGuid());
 #else
-        Eluna::Push(L, item->GetOwnerGUID());
+        Eluna::PushGUID(L, item->GetOwnerGUID());
 #endif
         return 1;
     }
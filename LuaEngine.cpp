@@ -6,40 +6,117 @@
 
 #include <ace/Dirent.h>
 #include <ace/OS_NS_sys_stat.h>
+#include <atomic>
+#include <cmath>
+#include <thread>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
 #include "HookMgr.h"
 #include "LuaEngine.h"
+#include "ElunaBytecodeCache.h"
 #include "Includes.h"
 
 Eluna::ScriptPaths Eluna::scripts;
 Eluna* Eluna::GEluna = NULL;
+thread_local Eluna* Eluna::threadEluna = NULL;
 bool Eluna::reload = false;
+std::atomic<bool> Eluna::perMapStates(false);
+
+// States of the maps in the per map mode, keyed by map ID and instance ID
+typedef std::map<uint64, Eluna*> MapStateMap;
+static MapStateMap mapStates;
+static std::mutex mapStatesLock;
 
 extern void RegisterFunctions(lua_State* L);
 
-void Eluna::Initialize()
-{
-    uint32 oldMSTime = GetCurrTime();
+// VM instructions between watchdog checks
+#define WATCHDOG_INTERVAL   1000
 
-    scripts.clear();
+// A full reload with Eluna.BackgroundReload builds the new state on this thread, see StartBackgroundReload
+static std::thread* backgroundThread = NULL;
+static std::atomic<bool> backgroundDone(false);
+static Eluna* backgroundEluna = NULL;
+static Eluna::ScriptPaths backgroundScripts;
+static std::string backgroundPath;
+static thread_local bool isBackgroundThread = false;
+
+// Globals the top level code of a script built in the background can call, the rest reach the world. See GuardGlobals
+static const char* const builderGlobals[] =
+{
+    "GetLuaEngine", "GetCoreName", "GetCoreVersion", "GetCoreExpansion",
+    "GetPlayerGUID", "GetItemGUID", "GetObjectGUID", "GetUnitGUID", "GUID", "GetGUIDLow", "GetGUIDType", "GetGUIDEntry",
+    "bit_not", "bit_xor", "bit_rshift", "bit_lshift", "bit_or", "bit_and",
+    "GetMemoryStats", "GetGCStats", "GetHookStats", "GetErrorStats",
+    "CreateLuaEvent", "RemoveEventById", "RemoveEvents", "RunCoroutine", "Sleep", "WaitForTicks", "WaitUntil",
+    "CreatePacket"
+};
 
+std::string Eluna::GetScriptPath()
+{
     std::string folderpath = ConfigMgr::GetStringDefault("Eluna.ScriptPath", "lua_scripts");
 #if PLATFORM == PLATFORM_UNIX || PLATFORM == PLATFORM_APPLE
     if (folderpath[0] == '~')
         if (const char* home = getenv("HOME"))
             folderpath.replace(0, 1, home);
 #endif
+    return folderpath;
+}
+
+void Eluna::FindScripts(const std::string& folderpath, ScriptPaths& paths)
+{
+    uint32 oldMSTime = GetCurrTime();
+
+    paths.clear();
     ELUNA_LOG_INFO("[Eluna]: Searching scripts from `%s`", folderpath.c_str());
-    GetScripts(folderpath, scripts);
-    GetScripts(folderpath + "/extensions", scripts);
+    GetScripts(folderpath, paths);
+    GetScripts(folderpath + "/extensions", paths);
+
+    ELUNA_LOG_INFO("[Eluna]: Loaded %u scripts in %u ms", uint32(paths.size()), GetTimeDiff(oldMSTime));
+}
 
-    ELUNA_LOG_INFO("[Eluna]: Loaded %u scripts in %u ms", uint32(scripts.size()), GetTimeDiff(oldMSTime));
+void Eluna::Initialize()
+{
+    perMapStates = ConfigMgr::GetBoolDefault("Eluna.PerMapStates", false);
+    std::string folderpath = GetScriptPath();
+    FindScripts(folderpath, scripts);
 
     // Create global eluna
-    new Eluna();
+    new Eluna(scripts, true);
+    GEluna->OnCreated(folderpath);
+}
+
+// Runs on the world thread once the state is the global state
+void Eluna::OnCreated(const std::string& folderpath)
+{
+    if (ConfigMgr::GetBoolDefault("Eluna.AutoReload", false))
+        m_Watcher = new ElunaScriptWatcher(*this, folderpath, ConfigMgr::GetIntDefault("Eluna.AutoReloadDelay", 500));
+
+    if (m_BytecodeCacheHits || m_BytecodeCacheMisses)
+    {
+        uint32 hits = m_BytecodeCacheHits;
+        uint32 misses = m_BytecodeCacheMisses;
+        ELUNA_LOG_INFO("[Eluna]: Bytecode cache: loaded %u cached scripts in %u ms (%u us each), compiled %u scripts in %u ms (%u us each)",
+            hits, uint32(m_BytecodeCacheHitTime / 1000), hits ? uint32(m_BytecodeCacheHitTime / hits) : 0,
+            misses, uint32(m_BytecodeCacheMissTime / 1000), misses ? uint32(m_BytecodeCacheMissTime / misses) : 0);
+    }
 }
 
 void Eluna::Uninitialize()
 {
+    // A state being built is finished and thrown away
+    if (backgroundThread)
+    {
+        backgroundThread->join();
+        delete backgroundThread;
+        backgroundThread = NULL;
+        delete backgroundEluna;
+        backgroundEluna = NULL;
+        backgroundScripts.clear();
+    }
+
+    RemoveMapStates();
     delete GEluna;
     scripts.clear();
 }
@@ -53,31 +130,218 @@ void Eluna::ReloadEluna()
     reload = false;
 }
 
-Eluna::Eluna():
-L(luaL_newstate()),
+// Builds the new state on a worker thread while the old one keeps running. The scripts' top level
+// code runs on the worker, where the world functions raise an error. See GuardGlobals and FinishBackgroundReload
+void Eluna::StartBackgroundReload()
+{
+    reload = false;
+    if (backgroundThread)
+        return; // Already building
+
+    eWorld->SendServerMessage(SERVER_MSG_STRING, "Reloading Eluna...");
+    backgroundPath = GetScriptPath();
+    backgroundDone = false;
+    backgroundThread = new std::thread(&Eluna::BuildInBackground);
+}
+
+// Adds the names of the global functions to names
+static void GetGlobalNames(lua_State* L, std::set<std::string>& names)
+{
+    lua_pushglobaltable(L);
+    lua_pushnil(L);
+    while (lua_next(L, -2))
+    {
+        if (lua_type(L, -2) == LUA_TSTRING && lua_iscfunction(L, -1))
+            names.insert(lua_tostring(L, -2));
+        lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+}
+
+// Calls the global function in upvalue 1, named by upvalue 2, unless called on the builder thread
+static int BuilderGuard(lua_State* L)
+{
+    if (isBackgroundThread)
+        return luaL_error(L, "%s can not be called from the top level of a script during a background reload, call it from a hook or timed event",
+            lua_tostring(L, lua_upvalueindex(2)));
+    lua_pushvalue(L, lua_upvalueindex(1));
+    lua_insert(L, 1);
+    lua_call(L, lua_gettop(L) - 1, LUA_MULTRET);
+    return lua_gettop(L);
+}
+
+// Wraps the global functions that reach the world in BuilderGuard. Lua library functions, the
+// functions in builderGlobals and the Register functions are left as they are
+void Eluna::GuardGlobals(const std::set<std::string>& libGlobals)
+{
+    std::set<std::string> allowed(libGlobals);
+    allowed.insert(builderGlobals, builderGlobals + sizeof(builderGlobals) / sizeof(*builderGlobals));
+
+    std::vector<std::string> guarded;
+    lua_pushglobaltable(L);
+    lua_pushnil(L);
+    while (lua_next(L, -2))
+    {
+        if (lua_type(L, -2) == LUA_TSTRING && lua_iscfunction(L, -1))
+        {
+            std::string name(lua_tostring(L, -2));
+            if (!allowed.count(name) && name.compare(0, 8, "Register"))
+                guarded.push_back(name);
+        }
+        lua_pop(L, 1);
+    }
+    // The table is not changed while it is traversed
+    for (std::vector<std::string>::const_iterator it = guarded.begin(); it != guarded.end(); ++it)
+    {
+        lua_getfield(L, -1, it->c_str());
+        lua_pushstring(L, it->c_str());
+        lua_pushcclosure(L, &BuilderGuard, 2);
+        lua_setfield(L, -2, it->c_str());
+    }
+    lua_pop(L, 1);
+}
+
+// Puts back the guarded global functions the scripts did not replace. Run on the world thread before the state is used
+void Eluna::UnguardGlobals()
+{
+    std::vector<std::string> guarded;
+    lua_pushglobaltable(L);
+    lua_pushnil(L);
+    while (lua_next(L, -2))
+    {
+        if (lua_type(L, -2) == LUA_TSTRING && lua_tocfunction(L, -1) == &BuilderGuard)
+            guarded.push_back(lua_tostring(L, -2));
+        lua_pop(L, 1);
+    }
+    for (std::vector<std::string>::const_iterator it = guarded.begin(); it != guarded.end(); ++it)
+    {
+        lua_getfield(L, -1, it->c_str());
+        lua_getupvalue(L, -1, 1);
+        lua_setfield(L, -3, it->c_str());
+        lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+}
+
+void Eluna::BuildInBackground()
+{
+    uint32 oldMSTime = GetCurrTime();
+    isBackgroundThread = true;
+    FindScripts(backgroundPath, backgroundScripts);
+    backgroundEluna = new Eluna(backgroundScripts, false);
+    threadEluna = NULL;
+    ELUNA_LOG_INFO("[Eluna]: Built the new state in the background in %u ms", GetTimeDiff(oldMSTime));
+    backgroundDone = true;
+}
+
+// Makes the state built in the background the global state and closes the old one.
+// Run at the start of world update, returns true if the states were swapped
+bool Eluna::FinishBackgroundReload()
+{
+    if (!backgroundThread || !backgroundDone)
+        return false;
+
+    uint32 oldMSTime = GetCurrTime();
+    backgroundThread->join();
+    delete backgroundThread;
+    backgroundThread = NULL;
+
+    // Map states are created again with the new scripts
+    RemoveMapStates();
+
+    backgroundEluna->UnguardGlobals();
+    Eluna* old = GEluna;
+    GEluna = backgroundEluna;
+    backgroundEluna = NULL;
+    scripts.swap(backgroundScripts);
+    backgroundScripts.clear();
+    GEluna->OnCreated(backgroundPath);
+
+    delete old; // Runs the old state's OnLuaStateClose
+    ELUNA_LOG_INFO("[Eluna]: Swapped in the new state in %u ms", GetTimeDiff(oldMSTime));
+    return true;
+}
+
+Eluna::Eluna(const ScriptPaths& paths, bool global):
+m_Allocator(new ElunaAllocator(ConfigMgr::GetBoolDefault("Eluna.PooledAllocator", false))),
+L(lua_newstate(&ElunaAllocator::Alloc, m_Allocator)),
+m_Handles(perMapStates),
 
 m_EventMgr(new EventMgr(*this)),
+m_Deferred(new ElunaDeferredQueue(*this, ConfigMgr::GetIntDefault("Eluna.DeferredQueueSize", 1024))),
+m_Watcher(NULL),
+m_Map(NULL),
+
+ServerEventBindings(new EventBind<HookMgr::ServerEvents>("ServerEvents", *this, HookMgr::SERVER_EVENT_COUNT)),
+PlayerEventBindings(new EventBind<HookMgr::PlayerEvents>("PlayerEvents", *this, HookMgr::PLAYER_EVENT_COUNT)),
+GuildEventBindings(new EventBind<HookMgr::GuildEvents>("GuildEvents", *this, HookMgr::GUILD_EVENT_COUNT)),
+GroupEventBindings(new EventBind<HookMgr::GroupEvents>("GroupEvents", *this, HookMgr::GROUP_EVENT_COUNT)),
+VehicleEventBindings(new EventBind<HookMgr::VehicleEvents>("VehicleEvents", *this, HookMgr::VEHICLE_EVENT_COUNT)),
 
-ServerEventBindings(new EventBind<HookMgr::ServerEvents>("ServerEvents", *this)),
-PlayerEventBindings(new EventBind<HookMgr::PlayerEvents>("PlayerEvents", *this)),
-GuildEventBindings(new EventBind<HookMgr::GuildEvents>("GuildEvents", *this)),
-GroupEventBindings(new EventBind<HookMgr::GroupEvents>("GroupEvents", *this)),
-VehicleEventBindings(new EventBind<HookMgr::VehicleEvents>("VehicleEvents", *this)),
-
-PacketEventBindings(new EntryBind<HookMgr::PacketEvents>("PacketEvents", *this)),
-CreatureEventBindings(new EntryBind<HookMgr::CreatureEvents>("CreatureEvents", *this)),
-CreatureGossipBindings(new EntryBind<HookMgr::GossipEvents>("GossipEvents (creature)", *this)),
-GameObjectEventBindings(new EntryBind<HookMgr::GameObjectEvents>("GameObjectEvents", *this)),
-GameObjectGossipBindings(new EntryBind<HookMgr::GossipEvents>("GossipEvents (gameobject)", *this)),
-ItemEventBindings(new EntryBind<HookMgr::ItemEvents>("ItemEvents", *this)),
-ItemGossipBindings(new EntryBind<HookMgr::GossipEvents>("GossipEvents (item)", *this)),
-playerGossipBindings(new EntryBind<HookMgr::GossipEvents>("GossipEvents (player)", *this))
+PacketEventBindings(new EntryBind<HookMgr::PacketEvents>("PacketEvents", *this, HookMgr::PACKET_EVENT_COUNT)),
+PacketSendFilterBindings(new PacketFilterBind("PacketEvents (send filter)", *this)),
+PacketReceiveFilterBindings(new PacketFilterBind("PacketEvents (receive filter)", *this)),
+CreatureEventBindings(new EntryBind<HookMgr::CreatureEvents>("CreatureEvents", *this, HookMgr::CREATURE_EVENT_COUNT)),
+CreatureGossipBindings(new EntryBind<HookMgr::GossipEvents>("GossipEvents (creature)", *this, HookMgr::GOSSIP_EVENT_COUNT)),
+GameObjectEventBindings(new EntryBind<HookMgr::GameObjectEvents>("GameObjectEvents", *this, HookMgr::GAMEOBJECT_EVENT_COUNT)),
+GameObjectGossipBindings(new EntryBind<HookMgr::GossipEvents>("GossipEvents (gameobject)", *this, HookMgr::GOSSIP_EVENT_COUNT)),
+ItemEventBindings(new EntryBind<HookMgr::ItemEvents>("ItemEvents", *this, HookMgr::ITEM_EVENT_COUNT)),
+ItemGossipBindings(new EntryBind<HookMgr::GossipEvents>("GossipEvents (item)", *this, HookMgr::GOSSIP_EVENT_COUNT)),
+playerGossipBindings(new EntryBind<HookMgr::GossipEvents>("GossipEvents (player)", *this, HookMgr::GOSSIP_EVENT_COUNT))
 {
+    // The building thread uses a state that is not global from the start
+    if (!global)
+        threadEluna = this;
+
+    lua_atpanic(L, &Eluna::AtPanic);
+
+    m_GCBudget = ConfigMgr::GetIntDefault("Eluna.GCBudget", 0);
+    m_GCStepSize = 8;
+    m_GCBaseline = 0;
+    memset(&m_GCStats, 0, sizeof(m_GCStats));
+
+    m_ProfileSampleRate = ConfigMgr::GetIntDefault("Eluna.ProfileSampleRate", 0);
+
+    m_WatchdogTimeLimit = ConfigMgr::GetIntDefault("Eluna.WatchdogTimeLimit", 0) * 1000;
+    m_WatchdogInstructionLimit = ConfigMgr::GetIntDefault("Eluna.WatchdogInstructionLimit", 0);
+    m_WatchdogMaxOverruns = ConfigMgr::GetIntDefault("Eluna.WatchdogMaxOverruns", 0);
+    m_WatchdogDepth = 0;
+    m_WatchdogDeadline = 0;
+    m_WatchdogInstructions = 0;
+    m_WatchdogTripped = false;
+    if (m_WatchdogTimeLimit || m_WatchdogInstructionLimit)
+        lua_sethook(L, &Eluna::WatchdogHook, LUA_MASKCOUNT, WATCHDOG_INTERVAL);
+
+    m_ErrorReportInterval = ConfigMgr::GetIntDefault("Eluna.ErrorReportInterval", 10000) * 1000;
+    m_ErrorCircuitBreaker = ConfigMgr::GetIntDefault("Eluna.ErrorCircuitBreaker", 0);
+    m_ErrorSuppressed = false;
+
+    m_BytecodeCache = ConfigMgr::GetStringDefault("Eluna.BytecodeCache", "");
+    m_BytecodeCacheHits = 0;
+    m_BytecodeCacheMisses = 0;
+    m_BytecodeCacheHitTime = 0;
+    m_BytecodeCacheMissTime = 0;
+    m_CompileThreads = ConfigMgr::GetIntDefault("Eluna.CompileThreads", 0);
+    if (!m_BytecodeCache.empty())
+    {
+        ACE_stat stat_buf;
+        if (ACE_OS::stat(m_BytecodeCache.c_str(), &stat_buf) == -1)
+            ACE_OS::mkdir(m_BytecodeCache.c_str());
+    }
+
     // open base lua
     luaL_openlibs(L);
+    std::set<std::string> libGlobals;
+    if (isBackgroundThread)
+        GetGlobalNames(L, libGlobals);
     RegisterFunctions(L);
+    RegisterGUID(L);
+    // The scripts' top level code runs on the builder thread, where the world must not be touched
+    if (isBackgroundThread)
+        GuardGlobals(libGlobals);
 
     // Create hidden table with weak values
+    // Keyed by the object pointer as light userdata
     lua_newtable(L);
     lua_newtable(L);
     lua_pushstring(L, "v");
@@ -85,22 +349,48 @@ playerGossipBindings(new EntryBind<HookMgr::GossipEvents>("GossipEvents (player)
     lua_setmetatable(L, -2);
     userdata_table = luaL_ref(L, LUA_REGISTRYINDEX);
 
+    // Create hidden table with weak values for interned GUIDs, see PushGUID
+    lua_newtable(L);
+    lua_newtable(L);
+    lua_pushstring(L, "v");
+    lua_setfield(L, -2, "__mode");
+    lua_setmetatable(L, -2);
+    guid_table = luaL_ref(L, LUA_REGISTRYINDEX);
+
     // Replace this with map insert if making multithread version
-    ASSERT(!Eluna::GEluna);
-    Eluna::GEluna = this;
+    if (global)
+    {
+        ASSERT(!Eluna::GEluna);
+        Eluna::GEluna = this;
+    }
 
     // run scripts
-    RunScripts(scripts);
+    RunScripts(paths);
+
+    // Collection is done in StepGC on world update
+    if (m_GCBudget)
+    {
+        lua_gc(L, LUA_GCSTOP, 0);
+        m_GCBaseline = lua_gc(L, LUA_GCCOUNT, 0);
+    }
 }
 
 Eluna::~Eluna()
 {
+    // The hooks of a state that was swapped out or never swapped in run on it
+    Eluna* previous = threadEluna;
+    threadEluna = this;
+    // Calls queued since the last world update still run on the state they were queued for
+    m_Deferred->Drain();
     OnLuaStateClose();
 
     // Replace this with map remove if making multithread version
-    Eluna::GEluna = NULL;
+    if (Eluna::GEluna == this)
+        Eluna::GEluna = NULL;
 
     delete m_EventMgr;
+    delete m_Deferred;
+    delete m_Watcher;
 
     delete ServerEventBindings;
     delete PlayerEventBindings;
@@ -109,6 +399,8 @@ Eluna::~Eluna()
     delete VehicleEventBindings;
 
     delete PacketEventBindings;
+    delete PacketSendFilterBindings;
+    delete PacketReceiveFilterBindings;
     delete CreatureEventBindings;
     delete CreatureGossipBindings;
     delete GameObjectEventBindings;
@@ -119,6 +411,9 @@ Eluna::~Eluna()
 
     // Must close lua state after deleting stores and mgr
     lua_close(L);
+    delete m_Allocator;
+
+    threadEluna = previous;
 }
 
 // Finds lua script files from given path (including subdirectories) and pushes them to scripts
@@ -167,56 +462,1262 @@ void Eluna::GetScripts(std::string path, ScriptPaths& scripts)
     }
 }
 
-void Eluna::RunScripts(ScriptPaths& scripts)
+void Eluna::RunScripts(const ScriptPaths& scripts)
 {
-    uint32 count = 0;
     // load last first to load extensions first
-    for (ScriptPaths::const_reverse_iterator it = scripts.rbegin(); it != scripts.rend(); ++it)
+    std::vector<std::string> paths(scripts.rbegin(), scripts.rend());
+    std::vector<ElunaCompiledScript> compiled(paths.size());
+    if (m_CompileThreads)
+        CompileScripts(paths, compiled, m_BytecodeCache, m_CompileThreads);
+    else if (!m_BytecodeCache.empty())
+        for (size_t i = 0; i < paths.size(); ++i)
+            CompileScript(L, paths[i], m_BytecodeCache, compiled[i]);
+
+    // Scripts can run each other, so all IDs are needed before the first one runs
+    for (size_t i = 0; i < paths.size(); ++i)
+        GetScriptId(paths[i]);
+
+    uint32 count = 0;
+    for (size_t i = 0; i < paths.size(); ++i)
+        if (RunScript(paths[i], compiled[i]))
+            ++count;
+    ELUNA_LOG_DEBUG("[Eluna]: Loaded %u Lua scripts", count);
+}
+
+// Loads the compiled script, or the file if it was not compiled, and runs it
+bool Eluna::RunScript(const std::string& path, const ElunaCompiledScript& script)
+{
+    uint64 start = GetCurrTimeUs();
+    int err;
+    if (!script.error.empty())
+    {
+        lua_pushstring(L, script.error.c_str());
+        err = LUA_ERRSYNTAX;
+    }
+    else if (!script.chunk.empty())
+        err = luaL_loadbufferx(L, script.chunk.data(), script.chunk.size(), ("@" + path).c_str(), "b");
+    else
+        err = luaL_loadfile(L, path.c_str());
+
+    if (!m_BytecodeCache.empty())
     {
-        if (!luaL_loadfile(L, it->c_str()) && !lua_pcall(L, 0, 0, 0))
+        uint64 loadTime = script.time + GetCurrTimeUs() - start;
+        if (script.cached)
         {
-            // successfully loaded and ran file
-            ELUNA_LOG_DEBUG("[Eluna]: Successfully loaded `%s`", it->c_str());
-            ++count;
+            ++m_BytecodeCacheHits;
+            m_BytecodeCacheHitTime += loadTime;
+        }
+        else
+        {
+            ++m_BytecodeCacheMisses;
+            m_BytecodeCacheMissTime += loadTime;
+        }
+    }
+
+    if (!err && !lua_pcall(L, 0, 0, 0))
+    {
+        // successfully loaded and ran file
+        ELUNA_LOG_DEBUG("[Eluna]: Successfully loaded `%s`", path.c_str());
+        return true;
+    }
+    ELUNA_LOG_ERROR("[Eluna]: Error loading file `%s`", path.c_str());
+    report(L);
+    return false;
+}
+
+// Unregisters the bindings, timed events and coroutines of the functions defined in the script and runs it again.
+// The script's globals are kept. name can be the full path or its end, like "folder/file.lua"
+bool Eluna::ReloadScript(const std::string& name)
+{
+    std::string path;
+    for (ScriptPaths::const_iterator it = scripts.begin(); it != scripts.end(); ++it)
+    {
+        size_t offset = it->length() - name.length();
+        if (*it != name && (it->length() <= name.length() || (*it)[offset - 1] != '/' || it->compare(offset, name.length(), name)))
             continue;
+        if (!path.empty())
+        {
+            ELUNA_LOG_ERROR("[Eluna]: Script name `%s` matches several scripts, use a longer path", name.c_str());
+            return false;
         }
-        ELUNA_LOG_ERROR("[Eluna]: Error loading file `%s`", it->c_str());
-        report(L);
+        path = *it;
     }
-    ELUNA_LOG_DEBUG("[Eluna]: Loaded %u Lua scripts", count);
+    if (path.empty())
+    {
+        ELUNA_LOG_ERROR("[Eluna]: Script `%s` not found, new scripts are loaded with a full reload", name.c_str());
+        return false;
+    }
+
+    uint32 oldMSTime = GetCurrTime();
+    uint32 scriptId = GetScriptId(path);
+
+    std::vector<ElunaBind*> binds;
+    GetBindStores(binds);
+    uint32 bindings = 0;
+    for (std::vector<ElunaBind*>::const_iterator it = binds.begin(); it != binds.end(); ++it)
+        bindings += (*it)->ClearScript(scriptId);
+    uint32 events = m_EventMgr->RemoveScriptEvents(scriptId);
+
+    ElunaCompiledScript script;
+    if (!m_BytecodeCache.empty())
+        CompileScript(L, path, m_BytecodeCache, script);
+    RunScript(path, script);
+
+    ELUNA_LOG_INFO("[Eluna]: Reloaded `%s` in %u ms, removed %u bindings and %u timed events", path.c_str(), GetTimeDiff(oldMSTime), bindings, events);
+    return true;
 }
 
-void Eluna::RemoveRef(const void* obj)
+// Reloads the script in GEluna and in every map state, so their other scripts keep their globals and timers.
+// Run on the world thread while no map is updating
+void Eluna::ReloadScriptInStates(const std::string& name)
 {
-    lua_rawgeti(sEluna->L, LUA_REGISTRYINDEX, sEluna->userdata_table);
-    lua_pushfstring(sEluna->L, "%p", obj);
-    lua_gettable(sEluna->L, -2);
-    if (!lua_isnoneornil(sEluna->L, -1))
+    if (!ReloadScript(name) || !perMapStates || this != GEluna)
+        return;
+
+    std::vector<Eluna*> states;
+    GetStates(states);
+    Eluna* previous = threadEluna;
+    for (std::vector<Eluna*>::const_iterator it = states.begin(); it != states.end(); ++it)
     {
-        lua_pushfstring(sEluna->L, "%p", obj);
-        lua_pushnil(sEluna->L);
-        lua_settable(sEluna->L, -4);
+        if (*it == this)
+            continue;
+        threadEluna = *it;
+        (*it)->ReloadScript(name);
     }
-    lua_pop(sEluna->L, 2);
+    threadEluna = previous;
 }
 
-void Eluna::report(lua_State* L)
+#ifdef __linux__
+ElunaScriptWatcher::ElunaScriptWatcher(Eluna& _E, const std::string& path, uint32 _delay): E(_E), delay(uint64(_delay) * 1000)
 {
-    const char* msg = lua_tostring(L, -1);
-    while (msg)
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd == -1)
+    {
+        ELUNA_LOG_ERROR("[Eluna]: Could not start watching `%s` for script changes", path.c_str());
+        return;
+    }
+    Watch(path);
+    ELUNA_LOG_INFO("[Eluna]: Watching %u folders for script changes", uint32(watches.size()));
+}
+
+ElunaScriptWatcher::~ElunaScriptWatcher()
+{
+    if (fd != -1)
+        close(fd);
+}
+
+// inotify does not watch subfolders, each one gets its own watch
+void ElunaScriptWatcher::Watch(const std::string& path)
+{
+    int wd = inotify_add_watch(fd, path.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR);
+    if (wd == -1)
+        return;
+    watches[wd] = path;
+
+    ACE_Dirent dir;
+    if (dir.open(path.c_str()) == -1)
+        return;
+    ACE_DIRENT* directory = 0;
+    while ((directory = dir.read()))
+    {
+        if (ACE::isdotdir(directory->d_name))
+            continue;
+        std::string fullpath = path + "/" + directory->d_name;
+        ACE_stat stat_buf;
+        if (ACE_OS::lstat(fullpath.c_str(), &stat_buf) != -1 && (stat_buf.st_mode & S_IFMT) == (S_IFDIR))
+            Watch(fullpath);
+    }
+}
+
+void ElunaScriptWatcher::Update()
+{
+    if (fd == -1)
+        return;
+
+    uint64 now = Eluna::GetCurrTimeUs();
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    while ((len = read(fd, buf, sizeof(buf))) > 0)
+    {
+        for (char* ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + reinterpret_cast<struct inotify_event*>(ptr)->len)
+        {
+            const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(ptr);
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                ELUNA_LOG_ERROR("[Eluna]: Script change events were lost, reload the changed scripts with .reload eluna");
+                continue;
+            }
+            if (event->mask & IN_IGNORED)
+            {
+                watches.erase(event->wd);
+                continue;
+            }
+            UNORDERED_MAP<int, std::string>::const_iterator it = watches.find(event->wd);
+            if (it == watches.end() || !event->len)
+                continue;
+
+            std::string path = it->second + "/" + event->name;
+            if (event->mask & IN_ISDIR)
+            {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO))
+                    Watch(path);
+                continue;
+            }
+            if (!(event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) || path.length() < 4 || path.compare(path.length() - 4, 4, ".lua"))
+                continue;
+
+            std::map<std::string, Change>::iterator change = pending.find(path);
+            if (change == pending.end())
+            {
+                Change& added = pending[path];
+                added.first = now;
+                added.last = now;
+            }
+            else
+                change->second.last = now;
+        }
+    }
+
+    // Editors can write a file several times when saving, wait until the changes stop
+    for (std::map<std::string, Change>::iterator it = pending.begin(); it != pending.end();)
+    {
+        if (now - it->second.last < delay)
+        {
+            ++it;
+            continue;
+        }
+
+        // New scripts are added to the script list
+        Eluna::scripts.insert(it->first);
+        E.ReloadScriptInStates(it->first);
+        ELUNA_LOG_INFO("[Eluna]: Reloaded `%s` %u ms after it was changed", it->first.c_str(), uint32((Eluna::GetCurrTimeUs() - it->second.first) / 1000));
+        pending.erase(it++);
+    }
+}
+#else
+ElunaScriptWatcher::ElunaScriptWatcher(Eluna& _E, const std::string& /*path*/, uint32 _delay): E(_E), fd(-1), delay(uint64(_delay) * 1000)
+{
+    ELUNA_LOG_ERROR("[Eluna]: Eluna.AutoReload is only supported on Linux");
+}
+
+ElunaScriptWatcher::~ElunaScriptWatcher()
+{
+}
+
+void ElunaScriptWatcher::Update()
+{
+}
+#endif
+
+uint32 Eluna::GetScriptId(const std::string& path)
+{
+    ScriptIdMap::const_iterator it = m_ScriptIds.find(path);
+    if (it != m_ScriptIds.end())
+        return it->second;
+    uint32 scriptId = m_ScriptIds.size() + 1;
+    m_ScriptIds[path] = scriptId;
+    return scriptId;
+}
+
+// Tags the function in the registry at funcRef with its script
+void Eluna::TagRef(int funcRef)
+{
+    lua_rawgeti(L, LUA_REGISTRYINDEX, funcRef);
+    TagRef(funcRef, L, -1);
+    lua_pop(L, 1);
+}
+
+// Remembers the script defining the function at index as the owner of ref
+void Eluna::TagRef(int ref, lua_State* L, int index)
+{
+    if (m_ScriptIds.empty() || lua_type(L, index) != LUA_TFUNCTION)
+        return;
+
+    lua_Debug ar;
+    lua_pushvalue(L, index);
+    lua_getinfo(L, ">S", &ar);
+    ScriptIdMap::const_iterator it = ar.source[0] == '@' ? m_ScriptIds.find(ar.source + 1) : m_ScriptIds.end();
+    if (it != m_ScriptIds.end())
+        m_RefScripts[ref] = it->second;
+    else
+        m_RefScripts.erase(ref); // The ref number may have belonged to a freed function
+}
+
+// Gets all binding stores of the state
+void Eluna::GetBindStores(std::vector<ElunaBind*>& binds)
+{
+    ElunaBind* stores[] =
+    {
+        ServerEventBindings, PlayerEventBindings, GuildEventBindings, GroupEventBindings, VehicleEventBindings,
+        PacketEventBindings, PacketSendFilterBindings, PacketReceiveFilterBindings,
+        CreatureEventBindings, CreatureGossipBindings, GameObjectEventBindings, GameObjectGossipBindings,
+        ItemEventBindings, ItemGossipBindings, playerGossipBindings
+    };
+    binds.assign(stores, stores + sizeof(stores) / sizeof(*stores));
+}
+
+// Frees a handler's function ref and what is kept about it
+void Eluna::ReleaseRef(int funcRef)
+{
+    luaL_unref(L, LUA_REGISTRYINDEX, funcRef);
+    m_RefScripts.erase(funcRef);
+    m_HandlerStats.erase(funcRef);
+    m_WatchdogOverruns.erase(funcRef);
+    m_HandlerFailures.erase(funcRef);
+}
+
+static bool ReadFile(const std::string& path, std::string& out)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+    char buf[4096];
+    size_t read;
+    while ((read = fread(buf, 1, sizeof(buf), file)))
+        out.append(buf, read);
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+// Writes to a temporary file first so a crash never leaves a partial entry
+static void WriteFile(const std::string& path, const std::string& data)
+{
+    std::string tmpPath = path + ".tmp";
+    FILE* file = fopen(tmpPath.c_str(), "wb");
+    if (!file)
+        return;
+    bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+    ok = !fclose(file) && ok;
+    if (!ok || rename(tmpPath.c_str(), path.c_str()))
+        remove(tmpPath.c_str());
+}
+
+static int DumpWriter(lua_State* /*L*/, const void* p, size_t sz, void* ud)
+{
+    static_cast<std::string*>(ud)->append(static_cast<const char*>(p), sz);
+    return 0;
+}
+
+// Compiles the script to bytecode in the given state, which is left as it was. The bytecode comes
+// from the cache when the cache folder is set and the entry is up to date, see ElunaBytecodeCache.
+// Scripts that are not compiled here are left with an empty chunk and loaded with luaL_loadfile.
+void Eluna::CompileScript(lua_State* L, const std::string& path, const std::string& cacheFolder, ElunaCompiledScript& out)
+{
+    uint64 start = GetCurrTimeUs();
+    out.cached = false;
+    if (path.compare(path.length() - 4, 4, ".lua") != 0)
+        return;
+
+    ACE_stat stat_buf;
+    if (ACE_OS::stat(path.c_str(), &stat_buf) == -1)
+        return;
+    uint64 mtime = uint64(stat_buf.st_mtime);
+    uint64 size = uint64(stat_buf.st_size);
+
+    std::string cachePath;
+    std::string source;
+    bool haveSource = false;
+    if (!cacheFolder.empty())
+    {
+        cachePath = cacheFolder + "/" + ElunaBytecodeCache::GetFileName(path);
+
+        std::string entry;
+        size_t offset = 0;
+        ElunaBytecodeCache::Status status = ElunaBytecodeCache::ENTRY_STALE;
+        if (ReadFile(cachePath, entry))
+            status = ElunaBytecodeCache::Check(entry, path, mtime, size, offset);
+        if (status == ElunaBytecodeCache::ENTRY_CHECK_HASH && (haveSource = ReadFile(path, source)) && ElunaBytecodeCache::MatchesSource(entry, source))
+        {
+            status = ElunaBytecodeCache::ENTRY_VALID;
+            ElunaBytecodeCache::Touch(entry, mtime);
+            WriteFile(cachePath, entry);
+        }
+        // Chunks of another lua version fail to load and are compiled again
+        if (status == ElunaBytecodeCache::ENTRY_VALID)
+        {
+            if (!luaL_loadbufferx(L, entry.data() + offset, entry.size() - offset, path.c_str(), "b"))
+            {
+                lua_pop(L, 1);
+                out.chunk.assign(entry, offset, std::string::npos);
+                out.cached = true;
+                out.time = GetCurrTimeUs() - start;
+                return;
+            }
+            lua_pop(L, 1);
+        }
+    }
+
+    if (!haveSource && !ReadFile(path, source))
+        return;
+
+    uint64 hash = ElunaBytecodeCache::HashBytes(source.data(), source.size());
+    // luaL_loadfile skips a UTF-8 BOM and then the first line if it starts with #, comment it out to keep the line numbers
+    if (!source.compare(0, 3, "\xEF\xBB\xBF"))
+        source.erase(0, 3);
+    // Precompiled chunks are loaded with luaL_loadfile
+    if (!source.compare(0, strlen(LUA_SIGNATURE), LUA_SIGNATURE))
+    {
+        out.time = GetCurrTimeUs() - start;
+        return;
+    }
+    if (!source.empty() && source[0] == '#')
+        source.insert(0, "--");
+    if (luaL_loadbufferx(L, source.data(), source.size(), ("@" + path).c_str(), "t"))
+    {
+        const char* msg = lua_tostring(L, -1);
+        out.error = msg ? msg : "unknown error";
+        lua_pop(L, 1);
+        out.time = GetCurrTimeUs() - start;
+        return;
+    }
+    lua_dump(L, &DumpWriter, &out.chunk);
+    lua_pop(L, 1);
+
+    if (!cachePath.empty() && !out.chunk.empty())
+    {
+        std::string entry;
+        ElunaBytecodeCache::Build(entry, path, mtime, size, hash, out.chunk);
+        WriteFile(cachePath, entry);
+    }
+    out.time = GetCurrTimeUs() - start;
+}
+
+struct ElunaCompileJob
+{
+    const std::vector<std::string>* paths;
+    std::vector<ElunaCompiledScript>* compiled;
+    const std::string* cacheFolder;
+    std::atomic<size_t> next;
+};
+
+static void CompileWorker(ElunaCompileJob* job)
+{
+    // Compiling needs no libraries or live state
+    lua_State* L = luaL_newstate();
+    if (!L)
+        return; // The scripts left are loaded with luaL_loadfile
+    for (size_t i = job->next++; i < job->paths->size(); i = job->next++)
+        Eluna::CompileScript(L, (*job->paths)[i], *job->cacheFolder, (*job->compiled)[i]);
+    lua_close(L);
+}
+
+// Compiles the scripts on worker threads, each with its own throwaway lua state
+void Eluna::CompileScripts(const std::vector<std::string>& paths, std::vector<ElunaCompiledScript>& compiled, const std::string& cacheFolder, uint32 threads)
+{
+    ElunaCompileJob job;
+    job.paths = &paths;
+    job.compiled = &compiled;
+    job.cacheFolder = &cacheFolder;
+    job.next = 0;
+
+    if (threads > paths.size())
+        threads = paths.size();
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+    for (uint32 i = 0; i < threads; ++i)
+        workers.push_back(std::thread(&CompileWorker, &job));
+    for (std::vector<std::thread>::iterator it = workers.begin(); it != workers.end(); ++it)
+        it->join();
+}
+
+void Eluna::RemoveRef(const void* obj)
+{
+    Eluna* E = sEluna;
+    if (!E)
+        return;
+    // Invalidates the handles, the cached userdata is replaced on next push
+    E->m_Handles.Release(obj);
+    // Objects call this when destroyed, other pointers are never event keys
+    E->m_EventMgr->RemoveEvents(static_cast<const Object*>(obj));
+
+    // The object can be pushed in other states running on other threads. Their handles are invalidated at once
+    // and the rest is released by them before they run again
+    if (perMapStates)
+        ElunaHandleTable::Invalidate(obj);
+}
+
+void Eluna::ReleasePending()
+{
+    std::vector<const void*> released;
+    m_Handles.ReleasePending(released);
+    for (std::vector<const void*>::const_iterator it = released.begin(); it != released.end(); ++it)
+        m_EventMgr->RemoveEvents(static_cast<const Object*>(*it));
+}
+
+// Finds or creates the map's state. A new state runs all scripts on the calling map thread
+Eluna* Eluna::GetMapState(Map* map)
+{
+    uint64 key = (uint64(map->GetId()) << 32) | map->GetInstanceId();
+    {
+        std::lock_guard<std::mutex> guard(mapStatesLock);
+        MapStateMap::const_iterator it = mapStates.find(key);
+        if (it != mapStates.end())
+            return it->second;
+    }
+
+    // Creating outside the lock lets other maps keep releasing objects meanwhile
+    Eluna* E = new Eluna(scripts, false);
+    E->m_Map = map;
+    std::lock_guard<std::mutex> guard(mapStatesLock);
+    mapStates[key] = E;
+    return E;
+}
+
+// Run on the world thread while no map is updating
+void Eluna::RemoveMapStates()
+{
+    MapStateMap states;
+    {
+        std::lock_guard<std::mutex> guard(mapStatesLock);
+        states.swap(mapStates);
+    }
+    for (MapStateMap::const_iterator it = states.begin(); it != states.end(); ++it)
+        delete it->second;
+}
+
+// The core calls this when a map instance is unloaded
+void Eluna::RemoveMapState(Map* map)
+{
+    uint64 key = (uint64(map->GetId()) << 32) | map->GetInstanceId();
+    Eluna* E = NULL;
+    {
+        std::lock_guard<std::mutex> guard(mapStatesLock);
+        MapStateMap::iterator it = mapStates.find(key);
+        if (it == mapStates.end())
+            return;
+        E = it->second;
+        mapStates.erase(it);
+    }
+    delete E;
+}
+
+// Gets GEluna and the map states. The map states can only be used while no map is updating
+void Eluna::GetStates(std::vector<Eluna*>& states)
+{
+    if (GEluna)
+        states.push_back(GEluna);
+    std::lock_guard<std::mutex> guard(mapStatesLock);
+    for (MapStateMap::const_iterator it = mapStates.begin(); it != mapStates.end(); ++it)
+        states.push_back(it->second);
+}
+
+// Called when a map updates on GEluna with per map states, which means Map::Update has no ElunaMapScope.
+// Per map states are turned off if no map has its own state yet, see docs/MERGING.md
+void Eluna::OnMissingMapScope()
+{
+    static bool reported = false;
+    std::lock_guard<std::mutex> guard(mapStatesLock);
+    if (!perMapStates || reported)
+        return;
+    reported = true;
+    if (mapStates.empty())
+    {
+        perMapStates = false;
+        ELUNA_LOG_ERROR("[Eluna]: Eluna.PerMapStates is enabled but Map::Update does not create an ElunaMapScope, per map states are disabled. See docs/MERGING.md");
+    }
+    else
+        ELUNA_LOG_ERROR("[Eluna]: A map updated without an ElunaMapScope while other maps have their own states. See docs/MERGING.md");
+}
+
+ElunaMapScope::ElunaMapScope(Map* map, uint32 diff): previous(Eluna::threadEluna)
+{
+    if (!Eluna::perMapStates || !Eluna::GEluna)
+        return;
+
+    Eluna* E = Eluna::GetMapState(map);
+    Eluna::threadEluna = E;
+    E->ReleasePending();
+    E->m_Deferred->Drain();
+    E->RemoveDisabledHandlers();
+    E->m_EventMgr->Update(diff);
+    E->StepGC(diff);
+}
+
+ElunaMapScope::~ElunaMapScope()
+{
+    Eluna::threadEluna = previous;
+}
+
+// Called on errors outside protected calls, the server is aborted after this returns
+int Eluna::AtPanic(lua_State* L)
+{
+    ELUNA_LOG_ERROR("[Eluna]: PANIC: unprotected error in call to Lua API (%s)", lua_tostring(L, -1));
+    return 0;
+}
+
+// Nominal world update diff the GC budget is given for
+#define GC_NOMINAL_DIFF     50
+#define GC_MIN_STEP_SIZE    1
+#define GC_MAX_STEP_SIZE    4096
+
+// Runs incremental GC steps until the time budget for this tick is used.
+// The budget scales with the world diff, as more garbage is made on longer ticks, and is doubled when
+// memory has grown past twice the size left by the last cycle so the collector catches up.
+// The step size is tuned so that a few steps fit in the budget.
+void Eluna::StepGC(uint32 diff)
+{
+    if (!m_GCBudget)
+        return;
+
+    uint64 budget = m_GCBudget;
+    if (diff > GC_NOMINAL_DIFF * 2)
+        budget *= 2;
+    else if (diff > GC_NOMINAL_DIFF)
+        budget = budget * diff / GC_NOMINAL_DIFF;
+    else if (diff < GC_NOMINAL_DIFF / 2)
+        budget /= 2;
+    if (uint32(lua_gc(L, LUA_GCCOUNT, 0)) > m_GCBaseline * 2)
+        budget *= 2;
+
+    uint64 start = GetCurrTimeUs();
+    uint64 now = start;
+    uint32 steps = 0;
+    do
+    {
+        uint64 stepStart = now;
+        bool cycleDone = lua_gc(L, LUA_GCSTEP, m_GCStepSize) != 0;
+        now = GetCurrTimeUs();
+        ++steps;
+
+        if (cycleDone)
+        {
+            ++m_GCStats.cycles;
+            m_GCBaseline = lua_gc(L, LUA_GCCOUNT, 0);
+            break;
+        }
+
+        // Aim for about four steps per budget
+        uint64 stepTime = now - stepStart;
+        if (stepTime * 2 > budget && m_GCStepSize > GC_MIN_STEP_SIZE)
+            m_GCStepSize /= 2;
+        else if (stepTime * 8 < budget && m_GCStepSize < GC_MAX_STEP_SIZE)
+            m_GCStepSize *= 2;
+    } while (now - start < budget);
+
+    uint32 pause = uint32(now - start);
+    m_GCStats.steps += steps;
+    m_GCStats.totalTime += pause;
+    m_GCStats.lastPause = pause;
+    m_GCStats.lastSteps = steps;
+    if (pause > m_GCStats.maxPause)
+        m_GCStats.maxPause = pause;
+}
+
+// Logs and pops the error on top of the stack
+void Eluna::report(lua_State* L)
+{
+    const char* msg = lua_tostring(L, -1);
+    if (msg)
+        ELUNA_LOG_ERROR("%s", msg);
+    lua_pop(L, 1);
+}
+
+// Message handler of ExecuteCall. Errors are grouped by the location they were raised at,
+// only the first error of a location in each Eluna.ErrorReportInterval gets a traceback and is logged
+int Eluna::ErrorHandler(lua_State* L)
+{
+    sEluna->TraceError(L, L, 1);
+    return 1;
+}
+
+// Replaces the error on top of L with the traceback of thread from level, see ErrorHandler.
+// Rate limited errors are left as they are and set m_ErrorSuppressed
+void Eluna::TraceError(lua_State* L, lua_State* thread, int level)
+{
+    const char* msg = lua_tostring(L, -1);
+    if (!msg)
+        msg = lua_pushfstring(L, "(error object is a %s value)", luaL_typename(L, -1));
+
+    // The innermost lua function with line info, errors from C functions get their caller
+    std::string location = "?";
+    lua_Debug ar;
+    for (int i = level; lua_getstack(thread, i, &ar); ++i)
+    {
+        lua_getinfo(thread, "Sl", &ar);
+        if (ar.currentline > 0)
+        {
+            char buff[32];
+            snprintf(buff, 32, ":%d", ar.currentline);
+            location = std::string(ar.short_src) + buff;
+            break;
+        }
+    }
+
+    ElunaErrorStats& stats = m_ErrorStats[location];
+    ++stats.count;
+    uint64 now = GetCurrTimeUs();
+    if (stats.count > 1 && m_ErrorReportInterval && now < stats.lastReport + m_ErrorReportInterval)
+    {
+        ++stats.suppressed;
+        m_ErrorSuppressed = true;
+        return;
+    }
+
+    luaL_traceback(L, thread, msg, level);
+    if (stats.suppressed)
+    {
+        lua_pushfstring(L, "\n(%d more errors at %s since the last report)", int(stats.suppressed), location.c_str());
+        lua_concat(L, 2);
+    }
+    stats.suppressed = 0;
+    stats.lastReport = now;
+}
+
+ElunaDeferredArg& ElunaDeferredCall::Next(uint8 type)
+{
+    if (argCount == args.size())
+        args.push_back(ElunaDeferredArg());
+    ElunaDeferredArg& arg = args[argCount++];
+    arg.type = type;
+    return arg;
+}
+
+void ElunaDeferredCall::Add(Player* player)
+{
+    if (!player)
+    {
+        Next(ElunaDeferredArg::ARG_NIL);
+        return;
+    }
+    Next(ElunaDeferredArg::ARG_PLAYER).guid = player->GET_GUID();
+}
+
+void ElunaDeferredCall::Add(Item* item)
+{
+    if (!item)
+    {
+        Next(ElunaDeferredArg::ARG_NIL);
+        return;
+    }
+    ElunaDeferredArg& arg = Next(ElunaDeferredArg::ARG_ITEM);
+    arg.guid = item->GET_GUID();
+#ifndef TRINITY
+    arg.owner = item->GetOwnerGuid();
+#else
+    arg.owner = item->GetOwnerGUID();
+#endif
+}
+
+void ElunaDeferredCall::Add(Guild* guild)
+{
+    if (!guild)
+    {
+        Next(ElunaDeferredArg::ARG_NIL);
+        return;
+    }
+    Next(ElunaDeferredArg::ARG_GUILD).guid = guild->GetId();
+}
+
+void ElunaDeferredCall::Add(Group* group)
+{
+    if (!group)
+    {
+        Next(ElunaDeferredArg::ARG_NIL);
+        return;
+    }
+#ifndef TRINITY
+    Next(ElunaDeferredArg::ARG_GROUP).owner = group->GetLeaderGuid();
+#else
+    Next(ElunaDeferredArg::ARG_GROUP).owner = group->GetLeaderGUID();
+#endif
+}
+
+void ElunaDeferredCall::Add(const std::string& str)
+{
+    Next(ElunaDeferredArg::ARG_STRING).str = str;
+}
+
+void ElunaDeferredCall::Add(bool boolean)
+{
+    Next(ElunaDeferredArg::ARG_BOOL).boolean = boolean;
+}
+
+void ElunaDeferredCall::Add(int32 number)
+{
+    Next(ElunaDeferredArg::ARG_NUMBER).number = number;
+}
+
+void ElunaDeferredCall::Add(uint32 number)
+{
+    Next(ElunaDeferredArg::ARG_NUMBER).number = number;
+}
+
+void ElunaDeferredCall::Add(uint64 guid)
+{
+    Next(ElunaDeferredArg::ARG_UINT64).guid = guid;
+}
+
+ElunaDeferredQueue::ElunaDeferredQueue(Eluna& _E, uint32 capacity) : E(_E), calls(capacity ? capacity : 1), head(0), count(0), draining(false)
+{
+}
+
+ElunaDeferredCall* ElunaDeferredQueue::Begin(const char* group, uint32 event, const std::vector<int>& binds)
+{
+    if (count == calls.size())
+        Drain();
+
+    // Still full when called from a handler during a drain
+    ElunaDeferredCall* call = count == calls.size() ? new ElunaDeferredCall() : &calls[(head + count) % calls.size()];
+    call->group = group;
+    call->event = event;
+    call->binds = &binds;
+    call->argCount = 0;
+    return call;
+}
+
+void ElunaDeferredQueue::Commit(ElunaDeferredCall* call)
+{
+    if (call >= &calls[0] && call < &calls[0] + calls.size())
+    {
+        ++count;
+        return;
+    }
+    Execute(*call);
+    delete call;
+}
+
+void ElunaDeferredQueue::Drain()
+{
+    if (draining)
+        return;
+
+    draining = true;
+    // The call stays counted while it runs so its slot is not reused
+    for (uint32 pending = count; pending > 0; --pending)
+    {
+        Execute(calls[head]);
+        head = (head + 1) % calls.size();
+        --count;
+    }
+    draining = false;
+}
+
+void ElunaDeferredQueue::Execute(ElunaDeferredCall& call)
+{
+    lua_State* L = E.L;
+    const std::vector<int>& binds = *call.binds;
+    // Same order as EVENT_EXECUTE, the last registered runs first. Indexed as handlers can register more
+    for (size_t i = binds.size(); i > 0; --i)
+    {
+        int funcRef = binds[i - 1];
+        lua_rawgeti(L, LUA_REGISTRYINDEX, funcRef);
+        Eluna::Push(L, call.event);
+        for (uint32 arg = 0; arg < call.argCount; ++arg)
+            PushArg(L, call.args[arg]);
+        E.ExecuteHandler(call.argCount + 1, 0, call.group, call.event, 0, funcRef);
+    }
+}
+
+// Players, items, guilds and groups that no longer exist are pushed as nil, like the hooks push a missing object
+void ElunaDeferredQueue::PushArg(lua_State* L, const ElunaDeferredArg& arg)
+{
+    switch (arg.type)
+    {
+    case ElunaDeferredArg::ARG_BOOL:
+        Eluna::Push(L, arg.boolean);
+        return;
+    case ElunaDeferredArg::ARG_NUMBER:
+        Eluna::Push(L, arg.number);
+        return;
+    case ElunaDeferredArg::ARG_UINT64:
+        Eluna::PushGUID(L, arg.guid);
+        return;
+    case ElunaDeferredArg::ARG_STRING:
+        Eluna::Push(L, arg.str);
+        return;
+    case ElunaDeferredArg::ARG_PLAYER:
+        if (Player* player = eObjectAccessor->FindPlayer(ObjectGuid(arg.guid)))
+            Eluna::Push(L, player);
+        else
+            Eluna::Push(L);
+        return;
+    case ElunaDeferredArg::ARG_ITEM:
+        if (Player* owner = eObjectAccessor->FindPlayer(ObjectGuid(arg.owner)))
+        {
+            if (Item* item = owner->GetItemByGuid(ObjectGuid(arg.guid)))
+            {
+                Eluna::Push(L, item);
+                return;
+            }
+        }
+        Eluna::Push(L);
+        return;
+    case ElunaDeferredArg::ARG_GUILD:
+        if (Guild* guild = eGuildMgr->GetGuildById(uint32(arg.guid)))
+            Eluna::Push(L, guild);
+        else
+            Eluna::Push(L);
+        return;
+    case ElunaDeferredArg::ARG_GROUP:
+        if (Player* leader = eObjectAccessor->FindPlayer(ObjectGuid(arg.owner)))
+        {
+            if (Group* group = leader->GetGroup())
+            {
+                Eluna::Push(L, group);
+                return;
+            }
+        }
+        Eluna::Push(L);
+        return;
+    }
+    Eluna::Push(L);
+}
+
+// Message handler for calls whose errors do not come back to ExecuteCall, reports the error itself
+int Eluna::ReportErrorHandler(lua_State* L)
+{
+    Eluna* E = sEluna;
+    E->m_ErrorSuppressed = false;
+    ErrorHandler(L);
+    if (E->m_ErrorSuppressed)
+        lua_pop(L, 1);
+    else
+        report(L);
+    E->m_ErrorSuppressed = false;
+    return 0;
+}
+
+// Reports the error a coroutine died with, counted and rate limited like handler errors
+void Eluna::ReportThreadError(lua_State* co)
+{
+    int top = lua_gettop(L);
+    lua_xmove(co, L, 1);
+    m_ErrorSuppressed = false;
+    TraceError(L, co, 0);
+    if (!m_ErrorSuppressed)
+        report(L);
+    m_ErrorSuppressed = false;
+    lua_settop(L, top);
+}
+
+// The watchdog budget covers the outermost handler call and everything it triggers
+bool Eluna::BeginWatchdog()
+{
+    if (!m_WatchdogTimeLimit && !m_WatchdogInstructionLimit)
+        return false;
+    if (!m_WatchdogDepth++)
+    {
+        m_WatchdogDeadline = GetCurrTimeUs() + m_WatchdogTimeLimit;
+        m_WatchdogInstructions = 0;
+        m_WatchdogTripped = false;
+    }
+    return true;
+}
+
+void Eluna::EndWatchdog(bool watched)
+{
+    if (watched)
+        --m_WatchdogDepth;
+}
+
+// Returns false if the call raised an error
+bool Eluna::ExecuteCall(int params, int res)
+{
+    int top = lua_gettop(L);
+    luaL_checktype(L, top - params, LUA_TFUNCTION);
+
+    bool watched = BeginWatchdog();
+
+    // The message handler goes below the function and its arguments
+    int base = top - params;
+    lua_pushcfunction(L, &Eluna::ErrorHandler);
+    lua_insert(L, base);
+
+    m_ErrorSuppressed = false;
+    int err = lua_pcall(L, params, res, base);
+    lua_remove(L, base);
+    EndWatchdog(watched);
+
+    if (err)
+    {
+        if (m_ErrorSuppressed)
+            lua_pop(L, 1);
+        else
+            report(L);
+        m_ErrorSuppressed = false;
+        return false;
+    }
+    return true;
+}
+
+// Calls a registered handler and updates its profiling counters.
+// Only every m_ProfileSampleRate'th call of each handler is timed, errors are always counted
+bool Eluna::ExecuteHandler(int params, int res, const char* group, uint32 event, uint32 entry, int funcRef)
+{
+    // A disabled handler is still bound until the next update
+    if (!m_DisabledHandlers.empty() && std::find(m_DisabledHandlers.begin(), m_DisabledHandlers.end(), funcRef) != m_DisabledHandlers.end())
+    {
+        lua_pop(L, params + 1);
+        return false;
+    }
+
+    bool success;
+    if (!m_ProfileSampleRate)
+        success = ExecuteCall(params, res);
+    else
+    {
+        // Each handler counts its own calls, a shared counter would keep measuring the handlers called in step with it.
+        // The record is looked up again after the call since the handler can release its ref
+        uint32& calls = GetHandlerStats(group, event, entry, funcRef).calls;
+        if (++calls < m_ProfileSampleRate)
+        {
+            success = ExecuteCall(params, res);
+            if (!success)
+                ++GetHandlerStats(group, event, entry, funcRef).errors;
+        }
+        else
+        {
+            calls = 0;
+
+            uint64 start = GetCurrTimeUs();
+            success = ExecuteCall(params, res);
+            uint32 time = uint32(GetCurrTimeUs() - start);
+
+            ElunaHandlerStats& stats = GetHandlerStats(group, event, entry, funcRef);
+            ++stats.samples;
+            stats.totalTime += time;
+            if (time > stats.maxTime)
+                stats.maxTime = time;
+            if (!success)
+                ++stats.errors;
+        }
+    }
+
+    if (m_WatchdogTripped && !m_WatchdogDepth)
+    {
+        m_WatchdogTripped = false;
+        OnWatchdogOverrun(group, event, entry, funcRef);
+    }
+
+    // Circuit breaker, failures are only tracked while a handler keeps failing
+    if (!success && m_ErrorCircuitBreaker)
+    {
+        uint32 failures = ++m_HandlerFailures[funcRef];
+        if (failures >= m_ErrorCircuitBreaker)
+        {
+            ELUNA_LOG_ERROR("[Eluna]: %s handler for event %u entry %u failed %u times in a row", group, event, entry, failures);
+            DisableHandler(group, event, entry, funcRef);
+        }
+    }
+    else if (success && !m_HandlerFailures.empty())
+        m_HandlerFailures.erase(funcRef);
+    return success;
+}
+
+// Count hook installed when a watchdog limit is set. Raises an error with a traceback
+// when the running handler is over its budget, and keeps raising it if the script catches it
+void Eluna::WatchdogHook(lua_State* L, lua_Debug* /*ar*/)
+{
+    Eluna* E = sEluna;
+    if (!E->m_WatchdogDepth)
+        return;
+
+    E->m_WatchdogInstructions += WATCHDOG_INTERVAL;
+    if (!E->m_WatchdogTripped)
+    {
+        if (E->m_WatchdogInstructionLimit && E->m_WatchdogInstructions > E->m_WatchdogInstructionLimit)
+            E->m_WatchdogTripped = true;
+        else if (E->m_WatchdogTimeLimit && GetCurrTimeUs() > E->m_WatchdogDeadline)
+            E->m_WatchdogTripped = true;
+        else
+            return;
+    }
+
+    // ErrorHandler adds the traceback
+    luaL_error(L, "handler aborted by the watchdog after %d instructions", int(E->m_WatchdogInstructions));
+}
+
+// Disables the handler after Eluna.WatchdogMaxOverruns overruns
+void Eluna::OnWatchdogOverrun(const char* group, uint32 event, uint32 entry, int funcRef)
+{
+    if (!m_WatchdogMaxOverruns)
+        return;
+
+    uint32 overruns = ++m_WatchdogOverruns[funcRef];
+    if (overruns < m_WatchdogMaxOverruns)
+        return;
+
+    ELUNA_LOG_ERROR("[Eluna]: %s handler for event %u entry %u overran the watchdog %u times", group, event, entry, overruns);
+    DisableHandler(group, event, entry, funcRef);
+}
+
+// Stops a handler from running again. A timed event is removed at once, also when it is the one running.
+// Bindings are removed on the next update, as the hook calling the handler may still be iterating them
+void Eluna::DisableHandler(const char* group, uint32 event, uint32 entry, int funcRef)
+{
+    m_WatchdogOverruns.erase(funcRef);
+    m_HandlerFailures.erase(funcRef);
+    ELUNA_LOG_ERROR("[Eluna]: Disabled the %s handler for event %u entry %u", group, event, entry);
+
+    if (m_EventMgr->GetEvent(funcRef))
+    {
+        m_EventMgr->RemoveEvent(funcRef);
+        return;
+    }
+    if (std::find(m_DisabledHandlers.begin(), m_DisabledHandlers.end(), funcRef) == m_DisabledHandlers.end())
+        m_DisabledHandlers.push_back(funcRef);
+}
+
+// Removes the bindings of the handlers disabled since the last update and frees their refs
+void Eluna::RemoveDisabledHandlers()
+{
+    if (m_DisabledHandlers.empty())
+        return;
+
+    std::vector<ElunaBind*> binds;
+    GetBindStores(binds);
+    for (std::vector<int>::const_iterator it = m_DisabledHandlers.begin(); it != m_DisabledHandlers.end(); ++it)
+    {
+        for (std::vector<ElunaBind*>::const_iterator itr = binds.begin(); itr != binds.end(); ++itr)
+            (*itr)->ClearRef(*it);
+        ReleaseRef(*it);
+    }
+    m_DisabledHandlers.clear();
+}
+
+static bool CompareHandlerTime(const ElunaHandlerStats* a, const ElunaHandlerStats* b)
+{
+    return a->totalTime > b->totalTime;
+}
+
+// Runs the commands queued by OnCommand. Run on GEluna's world update
+void Eluna::RunCommands()
+{
+    std::vector<std::string> reloads;
+    std::vector<std::pair<uint64, bool> > statsRequests;
+    {
+        std::lock_guard<std::mutex> guard(m_CommandsLock);
+        reloads.swap(m_ScriptReloads);
+        statsRequests.swap(m_StatsRequests);
+    }
+
+    for (std::vector<std::string>::const_iterator it = reloads.begin(); it != reloads.end(); ++it)
+        ReloadScriptInStates(*it);
+
+    for (std::vector<std::pair<uint64, bool> >::const_iterator it = statsRequests.begin(); it != statsRequests.end(); ++it)
+    {
+        if (it->second)
+        {
+            ResetHookStats();
+            continue;
+        }
+        Player* player = NULL;
+        if (it->first)
+        {
+            player = eObjectAccessor->FindPlayer(ObjectGuid(it->first));
+            if (!player)
+                continue;
+        }
+        ReportHookStats(player);
+    }
+}
+
+// Sends the handlers with the most measured time to the player, or logs them for the console.
+// The stats of a handler are summed over GEluna and the map states, so run on the world thread while no map is updating
+void Eluna::ReportHookStats(Player* player)
+{
+    std::vector<Eluna*> states;
+    GetStates(states);
+
+    // Handlers are told apart by what they run for and where they are defined, the refs differ between states
+    typedef std::map<std::string, ElunaHandlerStats> MergedStatsMap;
+    MergedStatsMap merged;
+    char buff[512];
+    for (std::vector<Eluna*>::const_iterator itr = states.begin(); itr != states.end(); ++itr)
+    {
+        for (HandlerStatsMap::const_iterator it = (*itr)->m_HandlerStats.begin(); it != (*itr)->m_HandlerStats.end(); ++it)
+        {
+            const ElunaHandlerStats& stats = it->second;
+            snprintf(buff, 512, "%s:%u:%u:", stats.group, stats.event, stats.entry);
+            ElunaHandlerStats& total = merged[buff + stats.source];
+            if (!total.group)
+            {
+                total.group = stats.group;
+                total.event = stats.event;
+                total.entry = stats.entry;
+                total.source = stats.source;
+            }
+            total.samples += stats.samples;
+            total.errors += stats.errors;
+            total.totalTime += stats.totalTime;
+            if (stats.maxTime > total.maxTime)
+                total.maxTime = stats.maxTime;
+        }
+    }
+
+    std::vector<const ElunaHandlerStats*> sorted;
+    for (MergedStatsMap::const_iterator it = merged.begin(); it != merged.end(); ++it)
+        sorted.push_back(&it->second);
+    std::sort(sorted.begin(), sorted.end(), CompareHandlerTime);
+    if (sorted.size() > 10)
+        sorted.resize(10);
+
+    std::vector<std::string> lines;
+    if (!m_ProfileSampleRate)
+        lines.push_back("[Eluna]: Profiling is disabled, set Eluna.ProfileSampleRate to enable it");
+    else
+    {
+        snprintf(buff, 512, "[Eluna]: %u handlers profiled in %u states, measuring 1 of %u calls", uint32(merged.size()), uint32(states.size()), m_ProfileSampleRate);
+        lines.push_back(buff);
+    }
+    for (std::vector<const ElunaHandlerStats*>::const_iterator it = sorted.begin(); it != sorted.end(); ++it)
+    {
+        const ElunaHandlerStats* stats = *it;
+        snprintf(buff, 512, "%s event %u entry %u (%s): ~%u calls, %u errors, %u us avg, %u us max",
+            stats->group, stats->event, stats->entry, stats->source.c_str(), stats->samples * m_ProfileSampleRate, stats->errors,
+            stats->samples ? uint32(stats->totalTime / stats->samples) : 0, stats->maxTime);
+        lines.push_back(buff);
+    }
+
+    for (std::vector<std::string>::const_iterator it = lines.begin(); it != lines.end(); ++it)
     {
-        lua_pop(L, 1);
-        ELUNA_LOG_ERROR("%s", msg);
-        msg = lua_tostring(L, -1);
+        if (player)
+            ChatHandler(player->GetSession()).SendSysMessage(it->c_str());
+        else
+            ELUNA_LOG_INFO("%s", it->c_str());
     }
 }
 
-void Eluna::ExecuteCall(lua_State* L, int params, int res)
+// Clears the handler stats of GEluna and the map states. Run on the world thread while no map is updating
+void Eluna::ResetHookStats()
 {
-    int top = lua_gettop(L);
-    luaL_checktype(L, top - params, LUA_TFUNCTION);
-    if (lua_pcall(L, params, res, 0))
-        report(L);
+    std::vector<Eluna*> states;
+    GetStates(states);
+    for (std::vector<Eluna*>::const_iterator it = states.begin(); it != states.end(); ++it)
+        (*it)->m_HandlerStats.clear();
+}
+
+ElunaHandlerStats& Eluna::GetHandlerStats(const char* group, uint32 event, uint32 entry, int funcRef)
+{
+    ElunaHandlerStats& stats = m_HandlerStats[funcRef];
+    // New record, or the ref was freed and reused for another handler
+    if (stats.group != group || stats.event != event || stats.entry != entry)
+    {
+        stats.group = group;
+        stats.event = event;
+        stats.entry = entry;
+        stats.calls = 0;
+        stats.samples = 0;
+        stats.errors = 0;
+        stats.totalTime = 0;
+        stats.maxTime = 0;
+
+        lua_Debug ar;
+        lua_rawgeti(L, LUA_REGISTRYINDEX, funcRef);
+        if (lua_isfunction(L, -1) && lua_getinfo(L, ">S", &ar))
+        {
+            char buff[32];
+            snprintf(buff, 32, ":%d", ar.linedefined);
+            stats.source = std::string(ar.short_src) + buff;
+        }
+        else
+        {
+            lua_pop(L, 1);
+            stats.source = "?";
+        }
+    }
+    return stats;
 }
 
 void Eluna::Push(lua_State* L)
@@ -225,15 +1726,45 @@ void Eluna::Push(lua_State* L)
 }
 void Eluna::Push(lua_State* L, const uint64 l)
 {
-    std::ostringstream ss;
-    ss << l;
-    Push(L, ss.str());
+    char buff[32];
+    snprintf(buff, 32, UI64FMTD, l);
+    lua_pushstring(L, buff);
+}
+// Pushes the key of a GUID in the intern table, see PushGUID
+static void PushGUIDKey(lua_State* L, const uint64 guid)
+{
+    if (sizeof(void*) >= sizeof(uint64))
+        lua_pushlightuserdata(L, reinterpret_cast<void*>(static_cast<uintptr_t>(guid)));
+    else
+        Eluna::Push(L, guid);
+}
+void Eluna::PushGUID(lua_State* L, const uint64 guid)
+{
+    // GUIDs are full userdata of the GUID type, see RegisterGUID.
+    // They are interned in guid_table so the same value is always the same object while it is referenced
+    lua_rawgeti(L, LUA_REGISTRYINDEX, sEluna->guid_table);
+    PushGUIDKey(L, guid);
+    lua_rawget(L, -2);
+    if (!lua_isnil(L, -1))
+    {
+        lua_remove(L, -2);
+        return;
+    }
+    lua_pop(L, 1);
+
+    uint64* value = static_cast<uint64*>(lua_newuserdata(L, sizeof(uint64)));
+    *value = guid;
+    luaL_setmetatable(L, "GUID");
+    PushGUIDKey(L, guid);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, -4);
+    lua_remove(L, -2);
 }
 void Eluna::Push(lua_State* L, const int64 l)
 {
-    std::ostringstream ss;
-    ss << l;
-    Push(L, ss.str());
+    char buff[32];
+    snprintf(buff, 32, SI64FMTD, l);
+    lua_pushstring(L, buff);
 }
 void Eluna::Push(lua_State* L, const uint32 u)
 {
@@ -448,92 +1979,348 @@ template<> std::string Eluna::CHECKVAL<std::string>(lua_State* L, int narg, std:
         return def;
     return luaL_optstring(L, narg, def.c_str());
 }
+// Reads a uint64 value from a GUID, number or string
+static bool ReadInt64(lua_State* L, int narg, uint64& out, bool isSigned)
+{
+    switch (lua_type(L, narg))
+    {
+    case LUA_TUSERDATA:
+        if (uint64* value = static_cast<uint64*>(luaL_testudata(L, narg, "GUID")))
+        {
+            out = *value;
+            return true;
+        }
+        return false;
+    case LUA_TNUMBER:
+        if (isSigned)
+            out = static_cast<uint64>(static_cast<int64>(lua_tonumber(L, narg)));
+        else
+            out = static_cast<uint64>(lua_tonumber(L, narg));
+        return true;
+    case LUA_TSTRING:
+        out = isSigned ? static_cast<uint64>(strtoll(lua_tostring(L, narg), NULL, 10)) : strtoull(lua_tostring(L, narg), NULL, 10);
+        return true;
+    default:
+        return false;
+    }
+}
 template<> uint64 Eluna::CHECKVAL<uint64>(lua_State* L, int narg)
 {
-    const char* c_str = CHECKVAL<const char*>(L, narg, NULL);
-    if (!c_str)
-        return luaL_argerror(L, narg, "uint64 (as string) expected");
     uint64 l = 0;
-    sscanf(c_str, UI64FMTD, &l);
+    if (!ReadInt64(L, narg, l, false))
+        return luaL_argerror(L, narg, "uint64 expected");
     return l;
 }
 template<> uint64 Eluna::CHECKVAL<uint64>(lua_State* L, int narg, uint64 def)
 {
-    const char* c_str = CHECKVAL<const char*>(L, narg, NULL);
-    if (!c_str)
-        return def;
     uint64 l = 0;
-    sscanf(c_str, UI64FMTD, &l);
+    if (!ReadInt64(L, narg, l, false))
+        return def;
     return l;
 }
 template<> int64 Eluna::CHECKVAL<int64>(lua_State* L, int narg)
 {
-    const char* c_str = CHECKVAL<const char*>(L, narg, NULL);
-    if (!c_str)
-        return luaL_argerror(L, narg, "int64 (as string) expected");
-    int64 l = 0;
-    sscanf(c_str, SI64FMTD, &l);
-    return l;
+    uint64 l = 0;
+    if (!ReadInt64(L, narg, l, true))
+        return luaL_argerror(L, narg, "int64 expected");
+    return static_cast<int64>(l);
 }
 template<> int64 Eluna::CHECKVAL<int64>(lua_State* L, int narg, int64 def)
 {
-    const char* c_str = CHECKVAL<const char*>(L, narg, NULL);
-    if (!c_str)
+    uint64 l = 0;
+    if (!ReadInt64(L, narg, l, true))
         return def;
-    int64 l = 0;
-    sscanf(c_str, SI64FMTD, &l);
-    return l;
+    return static_cast<int64>(l);
+}
+
+// Metamethods and methods of the GUID value type
+static int GUIDToString(lua_State* L)
+{
+    char buff[32];
+    snprintf(buff, 32, UI64FMTD, Eluna::CHECKVAL<uint64>(L, 1));
+    lua_pushstring(L, buff);
+    return 1;
+}
+static int GUIDConcat(lua_State* L)
+{
+    luaL_tolstring(L, 1, NULL);
+    luaL_tolstring(L, 2, NULL);
+    lua_concat(L, 2);
+    return 1;
+}
+static int GUIDEq(lua_State* L)
+{
+    Eluna::Push(L, Eluna::CHECKVAL<uint64>(L, 1) == Eluna::CHECKVAL<uint64>(L, 2));
+    return 1;
+}
+static int GUIDLt(lua_State* L)
+{
+    Eluna::Push(L, Eluna::CHECKVAL<uint64>(L, 1) < Eluna::CHECKVAL<uint64>(L, 2));
+    return 1;
+}
+static int GUIDLe(lua_State* L)
+{
+    Eluna::Push(L, Eluna::CHECKVAL<uint64>(L, 1) <= Eluna::CHECKVAL<uint64>(L, 2));
+    return 1;
+}
+static int GUIDToNumber(lua_State* L)
+{
+    Eluna::Push(L, static_cast<double>(Eluna::CHECKVAL<uint64>(L, 1)));
+    return 1;
+}
+// Arithmetic works on numbers like it did when GUIDs were decimal strings
+static double GUIDOperand(lua_State* L, int narg)
+{
+    if (luaL_testudata(L, narg, "GUID"))
+        return static_cast<double>(Eluna::CHECKVAL<uint64>(L, narg));
+    return luaL_checknumber(L, narg);
+}
+static int GUIDAdd(lua_State* L)
+{
+    Eluna::Push(L, GUIDOperand(L, 1) + GUIDOperand(L, 2));
+    return 1;
+}
+static int GUIDSub(lua_State* L)
+{
+    Eluna::Push(L, GUIDOperand(L, 1) - GUIDOperand(L, 2));
+    return 1;
+}
+static int GUIDMul(lua_State* L)
+{
+    Eluna::Push(L, GUIDOperand(L, 1) * GUIDOperand(L, 2));
+    return 1;
+}
+static int GUIDDiv(lua_State* L)
+{
+    Eluna::Push(L, GUIDOperand(L, 1) / GUIDOperand(L, 2));
+    return 1;
+}
+static int GUIDMod(lua_State* L)
+{
+    double a = GUIDOperand(L, 1);
+    double b = GUIDOperand(L, 2);
+    Eluna::Push(L, a - floor(a / b) * b);
+    return 1;
+}
+static int GUIDPow(lua_State* L)
+{
+    Eluna::Push(L, pow(GUIDOperand(L, 1), GUIDOperand(L, 2)));
+    return 1;
 }
-#define TEST_OBJ(T, O, E, F)\
-{\
-    if (!O || !O->F())\
-    {\
-    if (E)\
-    {\
-    std::string errmsg(ElunaTemplate<T>::tname);\
-    errmsg += " expected";\
-    luaL_argerror(L, narg, errmsg.c_str());\
-    }\
-    return NULL;\
-    }\
-    return O->F();\
+static int GUIDUnm(lua_State* L)
+{
+    Eluna::Push(L, -GUIDOperand(L, 1));
+    return 1;
+}
+static int GUIDAnd(lua_State* L)
+{
+    Eluna::PushGUID(L, Eluna::CHECKVAL<uint64>(L, 1) & Eluna::CHECKVAL<uint64>(L, 2));
+    return 1;
+}
+static int GUIDOr(lua_State* L)
+{
+    Eluna::PushGUID(L, Eluna::CHECKVAL<uint64>(L, 1) | Eluna::CHECKVAL<uint64>(L, 2));
+    return 1;
+}
+static int GUIDXor(lua_State* L)
+{
+    Eluna::PushGUID(L, Eluna::CHECKVAL<uint64>(L, 1) ^ Eluna::CHECKVAL<uint64>(L, 2));
+    return 1;
+}
+static int GUIDNot(lua_State* L)
+{
+    Eluna::PushGUID(L, ~Eluna::CHECKVAL<uint64>(L, 1));
+    return 1;
+}
+static int GUIDLShift(lua_State* L)
+{
+    uint32 bits = Eluna::CHECKVAL<uint32>(L, 2);
+    Eluna::PushGUID(L, bits < 64 ? Eluna::CHECKVAL<uint64>(L, 1) << bits : uint64(0));
+    return 1;
+}
+static int GUIDRShift(lua_State* L)
+{
+    uint32 bits = Eluna::CHECKVAL<uint32>(L, 2);
+    Eluna::PushGUID(L, bits < 64 ? Eluna::CHECKVAL<uint64>(L, 1) >> bits : uint64(0));
+    return 1;
 }
-template<> Unit* Eluna::CHECKOBJ<Unit>(lua_State* L, int narg, bool error)
+
+// Calls a string library function, upvalue 1, with a GUID argument converted to its decimal string
+static int GUIDStringMethod(lua_State* L)
 {
-    WorldObject* obj = CHECKOBJ<WorldObject>(L, narg, false);
-    TEST_OBJ(Unit, obj, error, ToUnit);
+    if (luaL_testudata(L, 1, "GUID"))
+    {
+        luaL_tolstring(L, 1, NULL);
+        lua_replace(L, 1);
+    }
+    lua_pushvalue(L, lua_upvalueindex(1));
+    lua_insert(L, 1);
+    lua_call(L, lua_gettop(L) - 1, LUA_MULTRET);
+    return lua_gettop(L);
 }
-template<> Player* Eluna::CHECKOBJ<Player>(lua_State* L, int narg, bool error)
+// Looks up GUID methods, upvalue 1, and then string methods, upvalue 2, like guid:sub(1, 3) when GUIDs were strings
+static int GUIDIndex(lua_State* L)
 {
-    WorldObject* obj = CHECKOBJ<WorldObject>(L, narg, false);
-    TEST_OBJ(Player, obj, error, ToPlayer);
+    lua_pushvalue(L, 2);
+    lua_rawget(L, lua_upvalueindex(1));
+    if (!lua_isnil(L, -1))
+        return 1;
+    lua_pop(L, 1);
+
+    lua_pushvalue(L, 2);
+    lua_rawget(L, lua_upvalueindex(2));
+    if (!lua_isfunction(L, -1))
+        return 1;
+    lua_pushcclosure(L, &GUIDStringMethod, 1);
+    return 1;
 }
-template<> Creature* Eluna::CHECKOBJ<Creature>(lua_State* L, int narg, bool error)
+
+// Registers the GUID type pushed by PushGUID.
+// GUIDs compare with == and work as table keys since equal values are the same object.
+// A GUID is never equal to a string or a number. Use GUID(value) to convert old keys or tostring(guid)
+void Eluna::RegisterGUID(lua_State* L)
 {
-    WorldObject* obj = CHECKOBJ<WorldObject>(L, narg, false);
-    TEST_OBJ(Creature, obj, error, ToCreature);
+    static const luaL_Reg metamethods[] =
+    {
+        { "__tostring", &GUIDToString },
+        { "__eq", &GUIDEq },
+        { "__concat", &GUIDConcat },
+        { "__lt", &GUIDLt },
+        { "__le", &GUIDLe },
+        { "__add", &GUIDAdd },
+        { "__sub", &GUIDSub },
+        { "__mul", &GUIDMul },
+        { "__div", &GUIDDiv },
+        { "__mod", &GUIDMod },
+        { "__pow", &GUIDPow },
+        { "__unm", &GUIDUnm },
+        { NULL, NULL }
+    };
+    static const luaL_Reg methods[] =
+    {
+        { "tostring", &GUIDToString },      // :tostring() - Returns the value as a decimal string
+        { "tonumber", &GUIDToNumber },      // :tonumber() - Returns the value as a number, precision is lost above 2^53
+        { "band", &GUIDAnd },               // :band(value) - Returns bitwise and
+        { "bor", &GUIDOr },                 // :bor(value) - Returns bitwise or
+        { "bxor", &GUIDXor },               // :bxor(value) - Returns bitwise xor
+        { "bnot", &GUIDNot },               // :bnot() - Returns bitwise not
+        { "lshift", &GUIDLShift },          // :lshift(bits) - Returns the value shifted left
+        { "rshift", &GUIDRShift },          // :rshift(bits) - Returns the value shifted right
+        { NULL, NULL }
+    };
+
+    luaL_newmetatable(L, "GUID");
+    luaL_setfuncs(L, metamethods, 0);
+    lua_newtable(L);
+    luaL_setfuncs(L, methods, 0);
+    lua_getglobal(L, "string");
+    lua_pushcclosure(L, &GUIDIndex, 2);
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
 }
-template<> GameObject* Eluna::CHECKOBJ<GameObject>(lua_State* L, int narg, bool error)
+
+// Saves the function reference ID of a catch-all packet event that only runs for the given opcode
+void Eluna::RegisterPacketFilter(uint32 evt, uint32 opcode, int functionRef)
 {
-    WorldObject* obj = CHECKOBJ<WorldObject>(L, narg, false);
-    TEST_OBJ(GameObject, obj, error, ToGameObject);
+    TagRef(functionRef);
+    if (opcode >= NUM_MSG_TYPES)
+    {
+        luaL_unref(L, LUA_REGISTRYINDEX, functionRef);
+        luaL_error(L, "Unknown opcode (%d)!", opcode);
+        return;
+    }
+
+    switch (evt)
+    {
+    case HookMgr::SERVER_EVENT_ON_PACKET_SEND:
+        PacketSendFilterBindings->Insert(opcode, functionRef);
+        PacketSendOpcodes.set(opcode);
+        return;
+    case HookMgr::SERVER_EVENT_ON_PACKET_RECEIVE:
+        PacketReceiveFilterBindings->Insert(opcode, functionRef);
+        PacketReceiveOpcodes.set(opcode);
+        return;
+    }
+    luaL_unref(L, LUA_REGISTRYINDEX, functionRef);
+    luaL_error(L, "Opcode filters are only supported for packet send and receive events, event (%d)", evt);
 }
-template<> Corpse* Eluna::CHECKOBJ<Corpse>(lua_State* L, int narg, bool error)
+
+#define EVENT_BIT(E)    (uint64(1) << (E))
+
+// Events whose hooks ignore the return values and have arguments that can be kept as GUIDs, see EVENT_DEFER
+static const uint64 DeferrablePlayerEvents =
+    EVENT_BIT(HookMgr::PLAYER_EVENT_ON_CHARACTER_DELETE) | EVENT_BIT(HookMgr::PLAYER_EVENT_ON_LOGIN) |
+    EVENT_BIT(HookMgr::PLAYER_EVENT_ON_LOGOUT) | EVENT_BIT(HookMgr::PLAYER_EVENT_ON_KILL_PLAYER) |
+    EVENT_BIT(HookMgr::PLAYER_EVENT_ON_DUEL_REQUEST) | EVENT_BIT(HookMgr::PLAYER_EVENT_ON_DUEL_START) |
+    EVENT_BIT(HookMgr::PLAYER_EVENT_ON_DUEL_END) | EVENT_BIT(HookMgr::PLAYER_EVENT_ON_LEVEL_CHANGE) |
+    EVENT_BIT(HookMgr::PLAYER_EVENT_ON_TALENTS_CHANGE) | EVENT_BIT(HookMgr::PLAYER_EVENT_ON_TALENTS_RESET) |
+    EVENT_BIT(HookMgr::PLAYER_EVENT_ON_EMOTE) | EVENT_BIT(HookMgr::PLAYER_EVENT_ON_TEXT_EMOTE) |
+    EVENT_BIT(HookMgr::PLAYER_EVENT_ON_SAVE) | EVENT_BIT(HookMgr::PLAYER_EVENT_ON_BIND_TO_INSTANCE) |
+    EVENT_BIT(HookMgr::PLAYER_EVENT_ON_UPDATE_ZONE) | EVENT_BIT(HookMgr::PLAYER_EVENT_ON_MAP_CHANGE) |
+    EVENT_BIT(HookMgr::PLAYER_EVENT_ON_EQUIP) | EVENT_BIT(HookMgr::PLAYER_EVENT_ON_FIRST_LOGIN) |
+    EVENT_BIT(HookMgr::PLAYER_EVENT_ON_LOOT_ITEM) | EVENT_BIT(HookMgr::PLAYER_EVENT_ON_LEAVE_COMBAT) |
+    EVENT_BIT(HookMgr::PLAYER_EVENT_ON_REPOP) | EVENT_BIT(HookMgr::PLAYER_EVENT_ON_RESURRECT) |
+    EVENT_BIT(HookMgr::PLAYER_EVENT_ON_LOOT_MONEY) | EVENT_BIT(HookMgr::PLAYER_EVENT_ON_QUEST_ABANDON);
+
+static const uint64 DeferrableGuildEvents =
+    EVENT_BIT(HookMgr::GUILD_EVENT_ON_ADD_MEMBER) | EVENT_BIT(HookMgr::GUILD_EVENT_ON_REMOVE_MEMBER) |
+    EVENT_BIT(HookMgr::GUILD_EVENT_ON_MOTD_CHANGE) | EVENT_BIT(HookMgr::GUILD_EVENT_ON_INFO_CHANGE) |
+    EVENT_BIT(HookMgr::GUILD_EVENT_ON_CREATE) | EVENT_BIT(HookMgr::GUILD_EVENT_ON_DISBAND) |
+    EVENT_BIT(HookMgr::GUILD_EVENT_ON_EVENT) | EVENT_BIT(HookMgr::GUILD_EVENT_ON_BANK_EVENT);
+
+static const uint64 DeferrableGroupEvents =
+    EVENT_BIT(HookMgr::GROUP_EVENT_ON_MEMBER_ADD) | EVENT_BIT(HookMgr::GROUP_EVENT_ON_MEMBER_INVITE) |
+    EVENT_BIT(HookMgr::GROUP_EVENT_ON_MEMBER_REMOVE) | EVENT_BIT(HookMgr::GROUP_EVENT_ON_LEADER_CHANGE) |
+    EVENT_BIT(HookMgr::GROUP_EVENT_ON_DISBAND) | EVENT_BIT(HookMgr::GROUP_EVENT_ON_CREATE);
+
+// Saves the function reference ID of an event that runs from the deferred queue on world update
+void Eluna::RegisterDeferred(uint8 regtype, uint32 evt, int functionRef)
 {
-    WorldObject* obj = CHECKOBJ<WorldObject>(L, narg, false);
-    TEST_OBJ(Corpse, obj, error, ToCorpse);
+    TagRef(functionRef);
+    switch (regtype)
+    {
+    case HookMgr::REGTYPE_PLAYER:
+        if (evt < HookMgr::PLAYER_EVENT_COUNT && (DeferrablePlayerEvents & EVENT_BIT(evt)))
+        {
+            PlayerEventBindings->InsertDeferred(evt, functionRef);
+            return;
+        }
+        break;
+
+    case HookMgr::REGTYPE_GUILD:
+        if (evt < HookMgr::GUILD_EVENT_COUNT && (DeferrableGuildEvents & EVENT_BIT(evt)))
+        {
+            GuildEventBindings->InsertDeferred(evt, functionRef);
+            return;
+        }
+        break;
+
+    case HookMgr::REGTYPE_GROUP:
+        if (evt < HookMgr::GROUP_EVENT_COUNT && (DeferrableGroupEvents & EVENT_BIT(evt)))
+        {
+            GroupEventBindings->InsertDeferred(evt, functionRef);
+            return;
+        }
+        break;
+    }
+    luaL_unref(L, LUA_REGISTRYINDEX, functionRef);
+    luaL_error(L, "Event (%d) of register type (%d) can not be deferred", evt, regtype);
 }
-#undef TEST_OBJ
 
 // Saves the function reference ID given to the register type's store for given entry under the given event
 void Eluna::Register(uint8 regtype, uint32 id, uint32 evt, int functionRef)
 {
+    TagRef(functionRef);
     switch (regtype)
     {
     case HookMgr::REGTYPE_SERVER:
         if (evt < HookMgr::SERVER_EVENT_COUNT)
         {
             ServerEventBindings->Insert(evt, functionRef);
+            if (evt == HookMgr::SERVER_EVENT_ON_PACKET_SEND)
+                PacketSendOpcodes.set();
+            else if (evt == HookMgr::SERVER_EVENT_ON_PACKET_RECEIVE)
+                PacketReceiveOpcodes.set();
             return;
         }
         break;
@@ -581,6 +2368,10 @@ void Eluna::Register(uint8 regtype, uint32 id, uint32 evt, int functionRef)
             }
 
             PacketEventBindings->Insert(id, evt, functionRef);
+            if (evt == HookMgr::PACKET_EVENT_ON_PACKET_SEND)
+                PacketSendOpcodes.set(id);
+            else if (evt == HookMgr::PACKET_EVENT_ON_PACKET_RECEIVE)
+                PacketReceiveOpcodes.set(id);
             return;
         }
         break;
@@ -687,37 +2478,400 @@ void Eluna::Register(uint8 regtype, uint32 id, uint32 evt, int functionRef)
     luaL_error(L, "Unknown event type (regtype %d, id %d, event %d)", regtype, id, evt);
 }
 
-EventMgr::LuaEvent::LuaEvent(Eluna& _E, EventProcessor* _events, int _funcRef, uint32 _delay, uint32 _calls, Object* _obj):
-E(_E), events(_events), funcRef(_funcRef), delay(_delay), calls(_calls), obj(_obj)
+EventMgr::EventMgr(Eluna& _E): E(_E), Running(NULL), Ticking(NULL), Coroutines(NULL),
+Batched(ConfigMgr::GetBoolDefault("Eluna.BatchedTimers", false))
+{
+}
+
+EventMgr::~EventMgr()
+{
+    RemoveEvents();
+    RemoveCoroutines();
+    for (MapWheels::const_iterator it = Maps.begin(); it != Maps.end(); ++it)
+        delete it->second;
+}
+
+bool EventMgr::CanAddEvent(const WorldObject* obj) const
+{
+    return !Eluna::perMapStates || !obj->IsInWorld() || obj->GetMap() == E.m_Map;
+}
+
+int EventMgr::AddEvent(WorldObject* obj, int funcRef, uint32 delay, uint32 calls)
+{
+    if (funcRef <= 0) // If funcRef <= 0, function reference failed
+        return 0; // on fail always return 0. funcRef can be negative.
+
+    E.TagRef(funcRef);
+    LuaEvent* luaEvent = new LuaEvent(this, funcRef, delay, calls, obj);
+    LuaEvent*& first = Objects[obj];
+    luaEvent->next = first;
+    if (first)
+        first->prev = luaEvent;
+    first = luaEvent;
+    Events[funcRef] = luaEvent;
+
+    luaEvent->wheel = (obj && obj->IsInWorld()) ? GetWheel(obj->GetMap()) : &GlobalWheel;
+    luaEvent->expires = luaEvent->wheel->GetTick() + delay;
+    luaEvent->wheel->Schedule(luaEvent);
+    return funcRef; // return the event ID
+}
+
+EventMgr::EventWheel* EventMgr::GetWheel(const Map* map)
+{
+    EventWheel*& wheel = Maps[map];
+    if (!wheel)
+        wheel = new EventWheel();
+    return wheel;
+}
+
+void EventMgr::Update(uint32 diff)
+{
+    if (Ticking)
+    {
+        GlobalWheel.Expire(Ticking);
+        while (LuaEvent* luaEvent = GlobalWheel.PopExpiring())
+        {
+            if (--luaEvent->calls)
+                EventWheel::Link(luaEvent, &Ticking);
+            else
+                Resume(luaEvent, 0);
+        }
+    }
+
+    Advance(GlobalWheel, diff);
+}
+
+void EventMgr::UpdateMap(const Map* map, uint32 diff)
+{
+    MapWheels::const_iterator it = Maps.find(map);
+    if (it != Maps.end())
+        Advance(*it->second, diff);
+}
+
+void EventMgr::RemoveMap(const Map* map)
+{
+    MapWheels::iterator it = Maps.find(map);
+    if (it == Maps.end())
+        return;
+    EventWheel* wheel = it->second;
+    Maps.erase(it);
+
+    // The objects left on the map are not in the world, their events wait in the global wheel for the next map they are added to
+    std::vector<LuaEvent*> events;
+    wheel->TakeAll(events);
+    for (std::vector<LuaEvent*>::const_iterator itr = events.begin(); itr != events.end(); ++itr)
+    {
+        LuaEvent* luaEvent = *itr;
+        luaEvent->wheel = &GlobalWheel;
+        luaEvent->expires = GlobalWheel.GetTick() + (luaEvent->expires - wheel->GetTick());
+        GlobalWheel.Schedule(luaEvent);
+    }
+    delete wheel;
+}
+
+// Runs the events of each tick of the wheel up to diff. Batched events are run once the wheel is advanced
+void EventMgr::Advance(EventWheel& wheel, uint32 diff)
+{
+    for (uint64 target = wheel.GetTick() + diff; wheel.Advance(target);)
+    {
+        // Events of the tick run as a batch, events removed by the calls are unlinked from it
+        while (LuaEvent* luaEvent = wheel.PopExpiring())
+        {
+            if (luaEvent->co)
+                Resume(luaEvent, 0);
+            else if (Batched)
+                Collect(luaEvent);
+            else
+                Run(luaEvent);
+        }
+    }
+
+    if (!Batch.empty())
+        RunBatch();
+}
+
+void EventMgr::Run(LuaEvent* luaEvent)
+{
+    // Objects out of the world skip the call until they are back or destroyed
+    if (WorldObject* obj = luaEvent->obj)
+    {
+        const Map* map = obj->IsInWorld() ? obj->GetMap() : NULL;
+        // A map state only runs the objects of its own map
+        if (!map || (Eluna::perMapStates && map != E.m_Map))
+        {
+            luaEvent->expires = luaEvent->wheel->GetTick() + luaEvent->delay;
+            luaEvent->wheel->Schedule(luaEvent);
+            return;
+        }
+
+        // The object changed maps, the event continues in the new map's update
+        EventWheel* wheel = GetWheel(map);
+        if (luaEvent->wheel != wheel)
+        {
+            luaEvent->wheel = wheel;
+            luaEvent->expires = wheel->GetTick();
+            wheel->Schedule(luaEvent);
+            return;
+        }
+    }
+
+    bool remove = (luaEvent->calls == 1);
+    lua_rawgeti(E.L, LUA_REGISTRYINDEX, luaEvent->funcRef);
+    Eluna::Push(E.L, luaEvent->funcRef);
+    Eluna::Push(E.L, luaEvent->delay);
+    Eluna::Push(E.L, luaEvent->calls);
+    if (!remove && luaEvent->calls)
+        --luaEvent->calls;
+    Eluna::Push(E.L, luaEvent->obj);
+
+    LuaEvent* running = Running;
+    Running = luaEvent;
+    ++luaEvent->running;
+    E.ExecuteHandler(4, 0, "TimedEvents", 0, 0, luaEvent->funcRef);
+    --luaEvent->running;
+    Running = running;
+
+    if (remove || luaEvent->removed)
+    {
+        luaEvent->removed = false;
+        Remove(luaEvent);
+        return;
+    }
+    luaEvent->expires = luaEvent->wheel->GetTick() + luaEvent->delay;
+    luaEvent->wheel->Schedule(luaEvent);
+}
+
+void EventMgr::AddCoroutine(lua_State* co, int threadRef, int narg)
+{
+    E.TagRef(threadRef, co, 1);
+    LuaEvent* luaEvent = new LuaEvent(this, threadRef, 0, 0, NULL);
+    luaEvent->co = co;
+    luaEvent->wheel = &GlobalWheel;
+    luaEvent->next = Coroutines;
+    if (Coroutines)
+        Coroutines->prev = luaEvent;
+    Coroutines = luaEvent;
+    Resume(luaEvent, narg);
+}
+
+// Runs the coroutine until it waits again or ends. Waiting reuses the same event,
+// so a coroutine costs one thread ref for its whole life
+void EventMgr::Resume(LuaEvent* luaEvent, int narg)
+{
+    lua_State* co = luaEvent->co;
+    LuaEvent* running = Running; // Coroutines can be started from other events
+    Running = luaEvent;
+    ++luaEvent->running;
+    bool watched = E.BeginWatchdog();
+    int status = lua_resume(co, E.L, narg);
+    E.EndWatchdog(watched);
+    --luaEvent->running;
+    Running = running;
+
+    if (status == LUA_YIELD && !luaEvent->removed)
+    {
+        lua_settop(co, 0); // Values yielded to us are ignored
+        // A plain coroutine.yield() waits for the next world update
+        if (!luaEvent->slot)
+        {
+            luaEvent->calls = 1;
+            EventWheel::Link(luaEvent, &Ticking);
+        }
+        return;
+    }
+    if (status != LUA_OK && status != LUA_YIELD)
+        E.ReportThreadError(co);
+    luaEvent->removed = false;
+    Remove(luaEvent);
+}
+
+int EventMgr::Wait(lua_State* co, uint32 delay, uint32 ticks, int ctx, lua_CFunction k)
+{
+    // The yield has to return to Resume, other resumers would not know to wait
+    if (!Running || Running->co != co)
+        return luaL_error(co, "can only wait in a coroutine started with RunCoroutine");
+
+    LuaEvent* luaEvent = Running;
+    EventWheel::Unschedule(luaEvent);
+    if (ticks)
+    {
+        luaEvent->calls = ticks;
+        EventWheel::Link(luaEvent, &Ticking);
+    }
+    else
+    {
+        luaEvent->expires = GlobalWheel.GetTick() + delay;
+        GlobalWheel.Schedule(luaEvent);
+    }
+    return lua_yieldk(co, 0, ctx, k);
+}
+
+void EventMgr::Collect(LuaEvent* luaEvent)
+{
+    luaEvent->batchIndex = int32(Batch.size());
+    Batch.push_back(luaEvent);
+}
+
+// Calls the collected events like Run does, so profiling, the watchdog and the circuit breaker apply to each.
+// Events removed after they were collected are skipped
+void EventMgr::RunBatch()
+{
+    std::vector<LuaEvent*> batch;
+    batch.swap(Batch);
+    for (std::vector<LuaEvent*>::const_iterator it = batch.begin(); it != batch.end(); ++it)
+    {
+        LuaEvent* luaEvent = *it;
+        luaEvent->batchIndex = -1;
+        if (luaEvent->removed)
+        {
+            luaEvent->removed = false;
+            Remove(luaEvent);
+            continue;
+        }
+        Run(luaEvent);
+    }
+    batch.clear();
+    Batch.swap(batch); // Keep the capacity
+}
+
+void EventMgr::Remove(LuaEvent* luaEvent)
+{
+    // Removed from its own call or from a coroutine it started, deleted once the calls return
+    if (luaEvent->running)
+    {
+        luaEvent->removed = true;
+        return;
+    }
+    // Collected for the batch being run, deleted when the batch gets to it
+    if (luaEvent->batchIndex >= 0)
+    {
+        luaEvent->removed = true;
+        return;
+    }
+
+    EventWheel::Unschedule(luaEvent);
+    if (luaEvent->co)
+    {
+        if (luaEvent->next)
+            luaEvent->next->prev = luaEvent->prev;
+        if (luaEvent->prev)
+            luaEvent->prev->next = luaEvent->next;
+        else
+            Coroutines = luaEvent->next;
+        delete luaEvent;
+        return;
+    }
+
+    Events.erase(luaEvent->funcRef);
+    if (luaEvent->next)
+        luaEvent->next->prev = luaEvent->prev;
+    if (luaEvent->prev)
+        luaEvent->prev->next = luaEvent->next;
+    else if (luaEvent->next)
+        Objects[luaEvent->obj] = luaEvent->next;
+    else
+        Objects.erase(luaEvent->obj);
+    delete luaEvent;
+}
+
+void EventMgr::RemoveEvents()
+{
+    std::vector<const Object*> objects;
+    for (ObjectMap::const_iterator it = Objects.begin(); it != Objects.end(); ++it)
+        objects.push_back(it->first);
+    for (std::vector<const Object*>::const_iterator it = objects.begin(); it != objects.end(); ++it)
+        RemoveEvents(*it);
+}
+
+void EventMgr::RemoveCoroutines()
+{
+    LuaEvent* luaEvent = Coroutines;
+    while (luaEvent)
+    {
+        LuaEvent* next = luaEvent->next;
+        Remove(luaEvent); // Running coroutines stay in the list until they yield or end
+        luaEvent = next;
+    }
+}
+
+uint32 EventMgr::RemoveScriptEvents(uint32 scriptId)
+{
+    std::vector<LuaEvent*> removed;
+    for (EventIndex::const_iterator it = Events.begin(); it != Events.end(); ++it)
+        if (E.GetRefScript(it->first) == scriptId)
+            removed.push_back(it->second);
+    for (LuaEvent* luaEvent = Coroutines; luaEvent; luaEvent = luaEvent->next)
+        if (E.GetRefScript(luaEvent->funcRef) == scriptId)
+            removed.push_back(luaEvent);
+    for (std::vector<LuaEvent*>::const_iterator it = removed.begin(); it != removed.end(); ++it)
+        Remove(*it);
+    return removed.size();
+}
+
+void EventMgr::RemoveEvents(const Object* obj)
+{
+    ObjectMap::const_iterator it = Objects.find(obj);
+    if (it == Objects.end())
+        return;
+    LuaEvent* luaEvent = it->second;
+    while (luaEvent)
+    {
+        LuaEvent* next = luaEvent->next;
+        Remove(luaEvent); // Running events stay in the list until their call returns
+        luaEvent = next;
+    }
+}
+
+EventMgr::LuaEvent::LuaEvent(EventMgr* _mgr, int _funcRef, uint32 _delay, uint32 _calls, WorldObject* _obj):
+mgr(_mgr), funcRef(_funcRef), delay(_delay), calls(_calls), obj(_obj), co(NULL), wheel(NULL), expires(0), running(0), removed(false), batchIndex(-1), prev(NULL), next(NULL),
+slot(NULL), slotPrev(NULL), slotNext(NULL)
 {
-    if (_events)
-        E.m_EventMgr->LuaEvents[_events].insert(this); // Able to access the event if we have the processor
 }
 
 EventMgr::LuaEvent::~LuaEvent()
 {
-    if (events)
+    luaL_unref(mgr->E.L, LUA_REGISTRYINDEX, funcRef); // Free lua function ref
+    if (!mgr->E.m_RefScripts.empty())
+        mgr->E.m_RefScripts.erase(funcRef);
+}
+
+// LuaEvents per slab of the free list
+#define LUAEVENT_SLAB_SIZE  256
+
+// The free list is never released, the blocks are reused across reloads.
+// Each thread has its own list, as map threads run their own states with per map states
+static thread_local void* luaEventFreeList = NULL;
+
+void* EventMgr::LuaEvent::operator new(size_t size)
+{
+    ASSERT(size == sizeof(LuaEvent));
+    // The reload builder thread exits, blocks left in its list would be lost
+    if (isBackgroundThread)
+        return ::operator new(size);
+    if (!luaEventFreeList)
     {
-        // Attempt to remove the pointer from LuaEvents
-        EventMgr::EventMap::const_iterator it = E.m_EventMgr->LuaEvents.find(events); // Get event set
-        if (it != E.m_EventMgr->LuaEvents.end())
-            E.m_EventMgr->LuaEvents[events].erase(this);// Remove pointer
+        char* slab = static_cast<char*>(::operator new(sizeof(LuaEvent) * LUAEVENT_SLAB_SIZE));
+        for (uint32 i = 0; i < LUAEVENT_SLAB_SIZE; ++i)
+        {
+            void* block = slab + i * sizeof(LuaEvent);
+            *static_cast<void**>(block) = luaEventFreeList;
+            luaEventFreeList = block;
+        }
     }
-    luaL_unref(E.L, LUA_REGISTRYINDEX, funcRef); // Free lua function ref
+    void* block = luaEventFreeList;
+    luaEventFreeList = *static_cast<void**>(block);
+    return block;
 }
 
-bool EventMgr::LuaEvent::Execute(uint64 /*time*/, uint32 /*diff*/)
+void EventMgr::LuaEvent::operator delete(void* ptr)
 {
-    bool remove = (calls == 1);
-    if (!remove)
-        events->AddEvent(this, events->CalculateTime(delay)); // Reschedule before calling incase RemoveEvents used
-    lua_rawgeti(E.L, LUA_REGISTRYINDEX, funcRef);
-    Eluna::Push(E.L, funcRef);
-    Eluna::Push(E.L, delay);
-    Eluna::Push(E.L, calls);
-    if (!remove && calls)
-        --calls;
-    Eluna::Push(E.L, obj);
-    Eluna::ExecuteCall(E.L, 4, 0);
-    return remove; // Destory (true) event if not run
+    if (!ptr)
+        return;
+    if (isBackgroundThread)
+    {
+        ::operator delete(ptr);
+        return;
+    }
+    *static_cast<void**>(ptr) = luaEventFreeList;
+    luaEventFreeList = ptr;
 }
@@ -7,6 +7,11 @@
 #ifndef __ELUNA__H
 #define __ELUNA__H
 
+// thread_local, std::thread, std::atomic and std::mutex are used. See docs/INSTALL.md
+#if defined(_MSC_VER) ? _MSC_VER < 1900 : __cplusplus < 201103L
+#error "Eluna requires a C++11 compiler (GCC 4.8, Clang 3.3 or Visual Studio 2015 or newer)"
+#endif
+
 extern "C"
 {
 #include "lua.h"
@@ -19,8 +24,15 @@ extern "C"
 #include "SharedDefines.h"
 #include <ace/Singleton.h>
 #include <ace/Atomic_Op.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <bitset>
 // enums & singletons
 #include "HookMgr.h"
+#include "ElunaAllocator.h"
+#include "ElunaTimingWheel.h"
+#include "ElunaHandleTable.h"
 #ifndef TRINITY
 #include "AccountMgr.h"
 #include "Config/Config.h"
@@ -158,188 +170,413 @@ struct ElunaRegister
 {
     const char* name;
     int(*mfunc)(lua_State*, T*);
+    lua_CFunction func; // Registered as is instead of mfunc, see ELUNA_BIND
 };
 
+// Timed lua events. Events are kept in hierarchical timing wheels with 1 ms ticks, so adding, rescheduling and
+// removing an event is O(1). Global events and coroutines are in the global wheel, which runs in Update.
+// Events of an object are in the wheel of the object's map, which runs in UpdateMap from the map's update.
+// Events of an object are also kept in a list per object and removed when the object is destroyed.
 struct EventMgr
 {
     struct LuaEvent;
 
-    typedef std::set<LuaEvent*> EventSet;
-    typedef std::map<EventProcessor*, EventSet> EventMap;
-    // typedef UNORDERED_MAP<uint64, EventProcessor> ProcessorMap;
+    typedef ElunaTimingWheel<LuaEvent> EventWheel;
+    typedef UNORDERED_MAP<int, LuaEvent*> EventIndex;
+    typedef UNORDERED_MAP<const Object*, LuaEvent*> ObjectMap;
+    typedef UNORDERED_MAP<const Map*, EventWheel*> MapWheels;
     Eluna& E;
 
-    EventMap LuaEvents; // LuaEvents[processor] = {LuaEvent, LuaEvent...}
-    // ProcessorMap Processors; // Processors[guid] = processor
-    EventProcessor GlobalEvents;
+    EventIndex Events;      // Events[eventId] = LuaEvent
+    ObjectMap Objects;      // Objects[obj] = first LuaEvent of the object's list, global events are under NULL
+    EventWheel GlobalWheel; // Global events, coroutines and events of objects that were out of the world when added
+    MapWheels Maps;         // Maps[map] = wheel of the events of objects on the map
+    LuaEvent* Running;      // Innermost event whose function is being called or coroutine is being resumed
+    LuaEvent* Ticking;      // Coroutines waiting for world updates, calls holds the updates left
+    LuaEvent* Coroutines;   // List of the coroutine events
+
+    // Batched mode collects the due events of an update and calls them once the wheel is advanced, see RunBatch
+    bool Batched;
+    std::vector<LuaEvent*> Batch;
 
-    struct LuaEvent : public BasicEvent
+    struct LuaEvent
     {
-        LuaEvent(Eluna& _E, EventProcessor* _events, int _funcRef, uint32 _delay, uint32 _calls, Object* _obj);
+        LuaEvent(EventMgr* _mgr, int _funcRef, uint32 _delay, uint32 _calls, WorldObject* _obj);
 
         ~LuaEvent();
 
-        // Should never execute on dead events
-        bool Execute(uint64 time, uint32 diff);
+        // LuaEvents come from a free list shared by all EventMgrs
+        static void* operator new(size_t size);
+        static void operator delete(void* ptr);
 
-        Eluna& E;
-        EventProcessor* events; // Pointer to events (holds the timed event)
+        EventMgr* mgr;
         int funcRef;    // Lua function reference ID, also used as event ID
         uint32 delay;   // Delay between event calls
         uint32 calls;   // Amount of calls to make, 0 for infinite
-        Object* obj;    // Object to push
+        WorldObject* obj;       // Object to push
+        lua_State* co;  // Coroutine to resume instead of calling a function, funcRef then anchors the thread
+        EventWheel* wheel;      // Wheel the event is scheduled in
+        uint64 expires; // Tick of the wheel to run at
+        uint32 running; // Calls of the event in progress, nested when its function starts coroutines
+        bool removed;   // Removed while running, deleted after the call
+        int32 batchIndex;       // Index in the batch being run, -1 if not batched
+        LuaEvent* prev; // Object's list
+        LuaEvent* next;
+        LuaEvent** slot;        // Head of the wheel slot or the expiring list holding the event
+        LuaEvent* slotPrev;
+        LuaEvent* slotNext;
     };
 
-    EventMgr(Eluna& _E): E(_E)
-    {
-    }
+    EventMgr(Eluna& _E);
+    ~EventMgr();
 
-    ~EventMgr()
-    {
-        RemoveEvents();
-    }
+    // Should be run on world tick, or map tick for map states. Runs the global events up to diff
+    void Update(uint32 diff);
 
-    // Should be run on world tick
-    void Update(uint32 diff)
-    {
-        GlobalEvents.Update(diff);
-    }
+    // Should be run on the map's tick. Runs the events of the objects on the map up to diff
+    void UpdateMap(const Map* map, uint32 diff);
 
-    // Updates processor stored for guid || remove from Update()
-    // Should be run on gameobject tick
-    /*void Update(uint64 guid, uint32 diff)
-    {
-    if (Processors.find(guid) == Processors.end())
-    return;
-    Processors[guid].Update(diff);
-    }*/
+    // Moves the events of the destroyed map's wheel to the global wheel
+    void RemoveMap(const Map* map);
 
-    // Aborts all lua events
-    void KillAllEvents(EventProcessor* events)
-    {
-        if (!events)
-            return;
-        if (LuaEvents.empty())
-            return;
-        EventMap::const_iterator it = LuaEvents.find(events); // Get event set
-        if (it == LuaEvents.end())
-            return;
-        if (it->second.empty())
-            return;
-        for (EventSet::const_iterator itr = it->second.begin(); itr != it->second.end();) // Loop events
-            (*(itr++))->to_Abort = true; // Abort event
-    }
+    EventWheel* GetWheel(const Map* map);
+    void Advance(EventWheel& wheel, uint32 diff);
+    void Run(LuaEvent* luaEvent);
+    void Collect(LuaEvent* luaEvent);
+    void RunBatch();
+    void Resume(LuaEvent* luaEvent, int narg);
+
+    // Deletes the event, or marks it to be deleted after its call if it is running
+    void Remove(LuaEvent* luaEvent);
 
     // Remove all timed events
-    void RemoveEvents()
-    {
-        if (!LuaEvents.empty())
-            for (EventMap::const_iterator it = LuaEvents.begin(); it != LuaEvents.end();) // loop processors
-                KillAllEvents((it++)->first);
-        LuaEvents.clear(); // remove pointers
-        // This is handled automatically on delete
-        // for (ProcessorMap::iterator it = Processors.begin(); it != Processors.end();)
-        //    (it++)->second.KillAllEvents(true);
-        // Processors.clear(); // remove guid saved processors
-        GlobalEvents.KillAllEvents(true);
-    }
+    void RemoveEvents();
 
-    // Remove timed events from processor
-    void RemoveEvents(EventProcessor* events)
-    {
-        if (!events)
-            return;
-        KillAllEvents(events);
-        LuaEvents.erase(events); // remove pointer set
-    }
+    // Remove timed events of the object, NULL for global events
+    void RemoveEvents(const Object* obj);
 
-    // Remove timed events from guid
-    // void RemoveEvents(uint64 guid)
-    //{
-    //    if (Processors.empty())
-    //        return;
-    //    if (Processors.find(guid) != Processors.end())
-    //        LuaEvents.erase(&Processors[guid]);
-    //    // Processors[guid].KillAllEvents(true); // remove events
-    //    Processors.erase(guid); // remove processor
-    //}
-
-    // Adds a new event to the processor and returns the eventID or 0 (Never negative)
-    int AddEvent(EventProcessor* events, int funcRef, uint32 delay, uint32 calls, Object* obj = NULL)
-    {
-        if (!events || funcRef <= 0) // If funcRef <= 0, function reference failed
-            return 0; // on fail always return 0. funcRef can be negative.
-        events->AddEvent(new LuaEvent(E, events, funcRef, delay, calls, obj), events->CalculateTime(delay));
-        return funcRef; // return the event ID
-    }
+    // Removes all coroutines, only safe when no coroutine is running
+    void RemoveCoroutines();
+
+    // Removes the timed events and coroutines owned by the script, returns the amount removed
+    uint32 RemoveScriptEvents(uint32 scriptId);
+
+    // With per map states an object's events can only be added in the state of the object's map
+    bool CanAddEvent(const WorldObject* obj) const;
 
-    // Creates a processor for the guid if needed and adds the event to it
-    // int AddEvent(uint64 guid, int funcRef, uint32 delay, uint32 calls, Object* obj = NULL)
-    //{
-    //    if (!guid) // 0 should be unused
-    //        return 0;
-    //    return AddEvent(&Processors[guid], funcRef, delay, calls, obj);
-    //}
+    // Adds a new event for the object and returns the eventID or 0 (Never negative)
+    int AddEvent(WorldObject* obj, int funcRef, uint32 delay, uint32 calls);
 
-    // Finds the event that has the ID from events
-    LuaEvent* GetEvent(EventProcessor* events, int eventId)
+    // Starts the coroutine with narg arguments on its stack. threadRef anchors the thread until it ends
+    void AddCoroutine(lua_State* co, int threadRef, int narg);
+
+    // Yields the running coroutine until delay ms or ticks world updates have passed.
+    // Must be returned from the calling C function. k is called on resume if set
+    int Wait(lua_State* co, uint32 delay, uint32 ticks, int ctx, lua_CFunction k);
+
+    // Finds the event that has the ID
+    LuaEvent* GetEvent(int eventId)
     {
-        if (!events || !eventId)
-            return NULL;
-        if (LuaEvents.empty())
+        EventIndex::const_iterator it = Events.find(eventId);
+        if (it == Events.end())
             return NULL;
-        EventMap::const_iterator it = LuaEvents.find(events); // Get event set
-        if (it == LuaEvents.end())
-            return NULL;
-        if (it->second.empty())
+        return it->second;
+    }
+
+    // Finds the event that has the ID from the object's events
+    LuaEvent* GetEvent(const Object* obj, int eventId)
+    {
+        LuaEvent* luaEvent = GetEvent(eventId);
+        if (!luaEvent || luaEvent->obj != obj)
             return NULL;
-        for (EventSet::const_iterator itr = it->second.begin(); itr != it->second.end(); ++itr) // Loop events
-            if ((*itr) && (*itr)->funcRef == eventId) // Check if the event has our ID
-                return *itr; // Return the event if found
-        return NULL;
+        return luaEvent;
     }
 
-    // Remove the event with the eventId from processor
+    // Remove the event with the eventId from the object's events
     // Returns true if event is removed
-    bool RemoveEvent(EventProcessor* events, int eventId) // eventId = funcRef
+    bool RemoveEvent(const Object* obj, int eventId) // eventId = funcRef
     {
-        if (!events || !eventId)
-            return false;
-        LuaEvent* luaEvent = GetEvent(events, eventId);
+        LuaEvent* luaEvent = GetEvent(obj, eventId);
         if (!luaEvent)
             return false;
-        luaEvent->to_Abort = true; // Set to remove on next call
-        LuaEvents[events].erase(luaEvent); // Remove pointer
+        Remove(luaEvent);
         return true;
     }
 
-    // Remove event by ID from processor stored for guid
-    /*bool RemoveEvent(uint64 guid, int eventId)
-    {
-    if (Processors.empty())
-    return false;
-    if (!guid || Processors.find(guid) == Processors.end())
-    return false;
-    return RemoveEvent(&Processors[guid], eventId);
-    }*/
-
     // Removes the eventId from all events
     void RemoveEvent(int eventId)
     {
-        if (!eventId)
-            return;
-        if (LuaEvents.empty())
-            return;
-        for (EventMap::const_iterator it = LuaEvents.begin(); it != LuaEvents.end();) // loop processors
-            if (RemoveEvent((it++)->first, eventId))
-                break; // succesfully remove the event, stop loop.
+        if (LuaEvent* luaEvent = GetEvent(eventId))
+            Remove(luaEvent);
     }
 };
 
+// Type tags stored in the userdata of each pushed object
+enum ElunaTypeTag
+{
+    ELUNA_TAG_NONE,
+    ELUNA_TAG_OBJECT,
+    ELUNA_TAG_WORLDOBJECT,
+    ELUNA_TAG_UNIT,
+    ELUNA_TAG_PLAYER,
+    ELUNA_TAG_CREATURE,
+    ELUNA_TAG_GAMEOBJECT,
+    ELUNA_TAG_CORPSE,
+    ELUNA_TAG_ITEM,
+    ELUNA_TAG_VEHICLE,
+    ELUNA_TAG_GROUP,
+    ELUNA_TAG_GUILD,
+    ELUNA_TAG_AURA,
+    ELUNA_TAG_SPELL,
+    ELUNA_TAG_QUEST,
+    ELUNA_TAG_MAP,
+    ELUNA_TAG_WEATHER,
+    ELUNA_TAG_AUCTIONHOUSE,
+    ELUNA_TAG_WORLDPACKET,
+    ELUNA_TAG_COUNT
+};
+
+#define ELUNA_TAG_BIT(tag)      (uint32(1) << (tag))
+#define ELUNA_TAGS_UNIT         (ELUNA_TAG_BIT(ELUNA_TAG_UNIT) | ELUNA_TAG_BIT(ELUNA_TAG_PLAYER) | ELUNA_TAG_BIT(ELUNA_TAG_CREATURE))
+#define ELUNA_TAGS_WORLDOBJECT  (ELUNA_TAG_BIT(ELUNA_TAG_WORLDOBJECT) | ELUNA_TAGS_UNIT | ELUNA_TAG_BIT(ELUNA_TAG_GAMEOBJECT) | ELUNA_TAG_BIT(ELUNA_TAG_CORPSE))
+#define ELUNA_TAGS_OBJECT       (ELUNA_TAG_BIT(ELUNA_TAG_OBJECT) | ELUNA_TAGS_WORLDOBJECT | ELUNA_TAG_BIT(ELUNA_TAG_ITEM))
+
+// Compile time type information for ElunaTemplate types.
+// Base is the type the object pointer is stored as, Accepts is the mask of tags that can be used as the type.
+// Object hierarchy types are stored as Object so that upcasts and downcasts are plain static casts.
+template<typename T>
+struct ElunaTypeTraits
+{
+    typedef T Base;
+    static const uint8 Tag = ELUNA_TAG_NONE;
+    static const uint32 Accepts = ELUNA_TAG_BIT(ELUNA_TAG_NONE);
+};
+
+#define ELUNA_TYPE_TRAITS(T, BASE, TAG, ACCEPTS)\
+    template<>\
+    struct ElunaTypeTraits<T>\
+    {\
+        typedef BASE Base;\
+        static const uint8 Tag = TAG;\
+        static const uint32 Accepts = ACCEPTS;\
+    };
+
+ELUNA_TYPE_TRAITS(Object, Object, ELUNA_TAG_OBJECT, ELUNA_TAGS_OBJECT)
+ELUNA_TYPE_TRAITS(WorldObject, Object, ELUNA_TAG_WORLDOBJECT, ELUNA_TAGS_WORLDOBJECT)
+ELUNA_TYPE_TRAITS(Unit, Object, ELUNA_TAG_UNIT, ELUNA_TAGS_UNIT)
+ELUNA_TYPE_TRAITS(Player, Object, ELUNA_TAG_PLAYER, ELUNA_TAG_BIT(ELUNA_TAG_PLAYER))
+ELUNA_TYPE_TRAITS(Creature, Object, ELUNA_TAG_CREATURE, ELUNA_TAG_BIT(ELUNA_TAG_CREATURE))
+ELUNA_TYPE_TRAITS(GameObject, Object, ELUNA_TAG_GAMEOBJECT, ELUNA_TAG_BIT(ELUNA_TAG_GAMEOBJECT))
+ELUNA_TYPE_TRAITS(Corpse, Object, ELUNA_TAG_CORPSE, ELUNA_TAG_BIT(ELUNA_TAG_CORPSE))
+ELUNA_TYPE_TRAITS(Item, Object, ELUNA_TAG_ITEM, ELUNA_TAG_BIT(ELUNA_TAG_ITEM))
+#ifndef CLASSIC
+#ifndef TBC
+ELUNA_TYPE_TRAITS(Vehicle, Vehicle, ELUNA_TAG_VEHICLE, ELUNA_TAG_BIT(ELUNA_TAG_VEHICLE))
+#endif
+#endif
+ELUNA_TYPE_TRAITS(Group, Group, ELUNA_TAG_GROUP, ELUNA_TAG_BIT(ELUNA_TAG_GROUP))
+ELUNA_TYPE_TRAITS(Guild, Guild, ELUNA_TAG_GUILD, ELUNA_TAG_BIT(ELUNA_TAG_GUILD))
+ELUNA_TYPE_TRAITS(Aura, Aura, ELUNA_TAG_AURA, ELUNA_TAG_BIT(ELUNA_TAG_AURA))
+ELUNA_TYPE_TRAITS(Spell, Spell, ELUNA_TAG_SPELL, ELUNA_TAG_BIT(ELUNA_TAG_SPELL))
+ELUNA_TYPE_TRAITS(Quest, Quest, ELUNA_TAG_QUEST, ELUNA_TAG_BIT(ELUNA_TAG_QUEST))
+ELUNA_TYPE_TRAITS(Map, Map, ELUNA_TAG_MAP, ELUNA_TAG_BIT(ELUNA_TAG_MAP))
+ELUNA_TYPE_TRAITS(Weather, Weather, ELUNA_TAG_WEATHER, ELUNA_TAG_BIT(ELUNA_TAG_WEATHER))
+ELUNA_TYPE_TRAITS(AuctionHouseObject, AuctionHouseObject, ELUNA_TAG_AUCTIONHOUSE, ELUNA_TAG_BIT(ELUNA_TAG_AUCTIONHOUSE))
+ELUNA_TYPE_TRAITS(WorldPacket, WorldPacket, ELUNA_TAG_WORLDPACKET, ELUNA_TAG_BIT(ELUNA_TAG_WORLDPACKET))
+#undef ELUNA_TYPE_TRAITS
+
+// Marks userdata created by ElunaTemplate, other libraries' userdata can be any size and layout
+#define ELUNA_OBJECT_MAGIC  0x454C554E
+
+// The userdata pushed to lua for all ElunaTemplate types
+struct ElunaObject
+{
+    uint32 magic;       // ELUNA_OBJECT_MAGIC
+    void* object;       // Stored as ElunaTypeTraits<T>::Base*
+    uint32 slot;        // Handle slot, unused for memory managed types
+    uint32 generation;  // Handle generation at the time of push
+    uint8 tag;          // ElunaTypeTag of the pushed type
+    bool borrowed;      // Memory managed type pointing to memory owned by the core, validated by handle
+};
+
+// Statistics of the GC stepping done in Eluna::StepGC
+struct ElunaGCStats
+{
+    uint32 steps;       // Total steps
+    uint32 cycles;      // Completed collection cycles
+    uint64 totalTime;   // Total time spent in steps, us
+    uint32 lastPause;   // Time spent in steps on the last tick, us
+    uint32 maxPause;    // Longest time spent in steps on a tick, us
+    uint32 lastSteps;   // Steps on the last tick
+};
+
+// Profiling counters of a registered handler, see Eluna::ExecuteHandler
+struct ElunaHandlerStats
+{
+    const char* group;  // Bind group name
+    uint32 event;
+    uint32 entry;       // 0 for events without entries
+    std::string source; // file:line of the handler function
+    uint32 calls;       // Calls since the last measured one
+    uint32 samples;     // Measured calls
+    uint32 errors;      // Counted on every call
+    uint64 totalTime;   // Time of measured calls, us
+    uint32 maxTime;     // us
+};
+
+// Errors raised at a location, see Eluna::ErrorHandler
+struct ElunaErrorStats
+{
+    uint32 count;       // All errors
+    uint32 suppressed;  // Errors not logged since the last report
+    uint64 lastReport;  // us
+};
+
+// Script compiled before it is run, see Eluna::CompileScript
+struct ElunaCompiledScript
+{
+    ElunaCompiledScript() : cached(false), time(0) { }
+
+    std::string chunk;  // Bytecode, empty if the script is loaded from the file
+    std::string error;  // Compile error
+    bool cached;        // The chunk came from the bytecode cache
+    uint64 time;        // us spent compiling or reading the cache
+};
+
+// Argument of a deferred hook call. Objects are kept as GUIDs and looked up again when the call runs, nil if they are gone
+struct ElunaDeferredArg
+{
+    enum ArgType
+    {
+        ARG_NIL,
+        ARG_BOOL,
+        ARG_NUMBER,
+        ARG_UINT64,
+        ARG_STRING,
+        ARG_PLAYER,
+        ARG_ITEM,
+        ARG_GUILD,
+        ARG_GROUP
+    };
+
+    uint8 type;
+    bool boolean;
+    double number;
+    uint64 guid;        // Player or item GUID, guild ID
+    uint64 owner;       // Item owner, group leader
+    std::string str;
+};
+
+// A hook call queued for deferred handlers, see ElunaDeferredQueue
+struct ElunaDeferredCall
+{
+    const char* group;
+    uint32 event;
+    const std::vector<int>* binds;
+    uint32 argCount;
+    std::vector<ElunaDeferredArg> args; // Only the first argCount are used, slots are reused
+
+    void Add(Player* player);
+    void Add(Item* item);
+    void Add(Guild* guild);
+    void Add(Group* group);
+    void Add(const std::string& str);
+    void Add(bool boolean);
+    void Add(int32 number);
+    void Add(uint32 number);
+    void Add(uint64 guid);
+
+    void AddAll() {}
+    template<typename T, typename... Args>
+    void AddAll(T arg, Args... args)
+    {
+        Add(arg);
+        AddAll(args...);
+    }
+
+private:
+    ElunaDeferredArg& Next(uint8 type);
+};
+
+// Ring buffer of hook calls for handlers registered as deferred. The calls are queued
+// by the hooks and run in one batch on world update. When the buffer is full it is drained
+// at once, or if it is already being drained the new call runs immediately.
+class ElunaDeferredQueue
+{
+public:
+    ElunaDeferredQueue(Eluna& _E, uint32 capacity);
+
+    template<typename... Args>
+    void Queue(const char* group, uint32 event, const std::vector<int>& binds, Args... args)
+    {
+        ElunaDeferredCall* call = Begin(group, event, binds);
+        call->AddAll(args...);
+        Commit(call);
+    }
+
+    // Runs the queued calls. Calls queued by the handlers run on the next drain
+    void Drain();
+    uint32 GetSize() const { return count; }
+
+private:
+    ElunaDeferredCall* Begin(const char* group, uint32 event, const std::vector<int>& binds);
+    void Commit(ElunaDeferredCall* call);
+    void Execute(ElunaDeferredCall& call);
+    static void PushArg(lua_State* L, const ElunaDeferredArg& arg);
+
+    Eluna& E;
+    std::vector<ElunaDeferredCall> calls;
+    uint32 head;
+    uint32 count;
+    bool draining;
+};
+
+// Watches the script folder with inotify and reloads changed scripts once they have not changed
+// for the delay. Only supported on Linux, see Eluna.AutoReload
+class ElunaScriptWatcher
+{
+public:
+    ElunaScriptWatcher(Eluna& _E, const std::string& path, uint32 _delay);
+    ~ElunaScriptWatcher();
+
+    // Reads the queued change events and reloads the scripts that are due. Run on world update
+    void Update();
+
+private:
+    struct Change
+    {
+        uint64 first;   // us
+        uint64 last;    // us
+    };
+
+    void Watch(const std::string& path);
+
+    Eluna& E;
+    int fd;
+    uint64 delay;   // us
+    UNORDERED_MAP<int, std::string> watches;    // watches[wd] = folder
+    std::map<std::string, Change> pending;      // pending[path]
+};
+
+// Makes sEluna the map's own state on the thread while the map updates, when Eluna.PerMapStates is enabled.
+// The core creates one at the start of Map::Update, it also runs the state's timed events and deferred calls.
+// The state is deleted in the OnDestroy(Map*) hook. World level hooks stay on the global state. See docs/MERGING.md
+class ElunaMapScope
+{
+public:
+    ElunaMapScope(Map* map, uint32 diff);
+    ~ElunaMapScope();
+
+private:
+    Eluna* previous;
+};
+
 template<typename T>
 struct EventBind;
 template<typename T>
 struct EntryBind;
+struct PacketFilterBind;
+struct ElunaBind;
 template<typename T>
 class ElunaTemplate;
 
@@ -354,12 +591,68 @@ public:
     typedef std::set<std::string> ScriptPaths;
 
     static Eluna* GEluna;
+    static thread_local Eluna* threadEluna; // Used instead of GEluna on the thread, see GetEluna
     static bool reload;
+    static std::atomic<bool> perMapStates;  // Each map has its own state, see ElunaMapScope
 
+    ElunaAllocator* m_Allocator; // Must be created before and deleted after L
     lua_State* L;
     int userdata_table;
+    int guid_table;
+    ElunaHandleTable m_Handles;
+
+    // Explicit GC stepping, automatic collection is stopped when the budget is not 0
+    uint32 m_GCBudget;      // Time for GC steps per world tick, us
+    int m_GCStepSize;       // Current step size in KB, tuned to the budget
+    uint32 m_GCBaseline;    // Lua memory in KB at the end of the last cycle
+    ElunaGCStats m_GCStats;
+
+    // Handler profiling, every Nth call of each handler is measured. 0 disables profiling
+    typedef UNORDERED_MAP<int, ElunaHandlerStats> HandlerStatsMap;
+    HandlerStatsMap m_HandlerStats; // m_HandlerStats[funcRef]
+    uint32 m_ProfileSampleRate;
+
+    // Watchdog aborting handlers that run too long, see WatchdogHook. A limit of 0 is disabled
+    uint32 m_WatchdogTimeLimit;         // us for the outermost handler call
+    uint32 m_WatchdogInstructionLimit;  // VM instructions for the outermost handler call
+    uint32 m_WatchdogMaxOverruns;       // Overruns before a handler is disabled, 0 never disables
+    uint32 m_WatchdogDepth;             // Nested handler calls
+    uint64 m_WatchdogDeadline;
+    uint32 m_WatchdogInstructions;
+    bool m_WatchdogTripped;
+    UNORDERED_MAP<int, uint32> m_WatchdogOverruns; // m_WatchdogOverruns[funcRef]
+
+    // Error reporting, see ErrorHandler
+    typedef UNORDERED_MAP<std::string, ElunaErrorStats> ErrorStatsMap;
+    ErrorStatsMap m_ErrorStats;             // m_ErrorStats["file:line"]
+    uint64 m_ErrorReportInterval;           // us between reports of a location, 0 reports every error
+    uint32 m_ErrorCircuitBreaker;           // Failures in a row before a handler is disabled, 0 never disables
+    bool m_ErrorSuppressed;                 // The last error was counted but not reported
+    UNORDERED_MAP<int, uint32> m_HandlerFailures; // m_HandlerFailures[funcRef], handlers that failed on their last call
+    std::vector<int> m_DisabledHandlers;    // Disabled handlers skipped until their bindings are removed on the next update
+
+    // Compiled chunks of the scripts are kept in m_BytecodeCache, empty disables the cache. See LoadScript
+    std::string m_BytecodeCache;
+    uint32 m_BytecodeCacheHits;
+    uint32 m_BytecodeCacheMisses;
+    uint64 m_BytecodeCacheHitTime;      // us
+    uint64 m_BytecodeCacheMissTime;     // us
+    uint32 m_CompileThreads;            // Worker threads compiling the scripts, 0 compiles on the world thread
+
+    // Function refs are owned by the script defining the function, so a script can be reloaded alone. See ReloadScript
+    typedef UNORDERED_MAP<std::string, uint32> ScriptIdMap;
+    ScriptIdMap m_ScriptIds;                    // m_ScriptIds[path] = script ID
+    UNORDERED_MAP<int, uint32> m_RefScripts;    // m_RefScripts[funcRef] = script ID
+
+    // Commands are run by GEluna on the next world update, where the map states can be reached. See OnCommand
+    std::mutex m_CommandsLock;
+    std::vector<std::string> m_ScriptReloads;               // Scripts to reload
+    std::vector<std::pair<uint64, bool> > m_StatsRequests;  // Player GUID or 0 for the console, and if the stats are reset
 
     EventMgr* m_EventMgr;
+    ElunaDeferredQueue* m_Deferred;
+    ElunaScriptWatcher* m_Watcher;
+    const Map* m_Map;   // Map of a map state, NULL for GEluna. Object events only run on it, see EventMgr::Run
 
     EventBind<HookMgr::ServerEvents>*       ServerEventBindings;
     EventBind<HookMgr::PlayerEvents>*       PlayerEventBindings;
@@ -368,6 +661,12 @@ public:
     EventBind<HookMgr::VehicleEvents>*      VehicleEventBindings;
 
     EntryBind<HookMgr::PacketEvents>*       PacketEventBindings;
+    PacketFilterBind*                       PacketSendFilterBindings;
+    PacketFilterBind*                       PacketReceiveFilterBindings;
+
+    // Opcodes that have any packet send or receive bindings, checked first in the packet hooks
+    std::bitset<NUM_MSG_TYPES> PacketSendOpcodes;
+    std::bitset<NUM_MSG_TYPES> PacketReceiveOpcodes;
     EntryBind<HookMgr::CreatureEvents>*     CreatureEventBindings;
     EntryBind<HookMgr::GossipEvents>*       CreatureGossipBindings;
     EntryBind<HookMgr::GameObjectEvents>*   GameObjectEventBindings;
@@ -376,22 +675,82 @@ public:
     EntryBind<HookMgr::GossipEvents>*       ItemGossipBindings;
     EntryBind<HookMgr::GossipEvents>*       playerGossipBindings;
 
-    Eluna();
+    Eluna(const ScriptPaths& paths, bool global);
     ~Eluna();
 
+    // The state used by the calling thread. A state built in the background is used by its builder thread
+    // and by its destructor, everything else uses the global state
+    static Eluna* GetEluna()
+    {
+        return threadEluna ? threadEluna : GEluna;
+    }
+
     static ScriptPaths scripts;
     static void Initialize();
     static void Uninitialize();
     // Use Eluna::reload = true; instead.
     // This will be called on next update
     static void ReloadEluna();
+    static void StartBackgroundReload();
+    static bool FinishBackgroundReload();
+    static void BuildInBackground();
+    void GuardGlobals(const std::set<std::string>& libGlobals);
+    void UnguardGlobals();
+    static Eluna* GetMapState(Map* map);
+    static void RemoveMapStates();
+    static void RemoveMapState(Map* map);
+    static void GetStates(std::vector<Eluna*>& states);
+    static void OnMissingMapScope();
+    void ReleasePending();
+    static std::string GetScriptPath();
+    static void FindScripts(const std::string& folderpath, ScriptPaths& paths);
+    void OnCreated(const std::string& folderpath);
     void static GetScripts(std::string path, ScriptPaths& scripts);
 
     static void report(lua_State*);
-    static void ExecuteCall(lua_State* L, int params, int res);
+    bool ExecuteCall(int params, int res);
+    bool BeginWatchdog();
+    void EndWatchdog(bool watched);
+    bool ExecuteHandler(int params, int res, const char* group, uint32 event, uint32 entry, int funcRef);
+    static void WatchdogHook(lua_State* L, lua_Debug* ar);
+    void OnWatchdogOverrun(const char* group, uint32 event, uint32 entry, int funcRef);
+    void DisableHandler(const char* group, uint32 event, uint32 entry, int funcRef);
+    void RemoveDisabledHandlers();
+    void GetBindStores(std::vector<ElunaBind*>& binds);
+    static int ErrorHandler(lua_State* L);
+    static int ReportErrorHandler(lua_State* L);
+    void TraceError(lua_State* L, lua_State* thread, int level);
+    void ReportThreadError(lua_State* co);
+    ElunaHandlerStats& GetHandlerStats(const char* group, uint32 event, uint32 entry, int funcRef);
+    void ReportHookStats(Player* player);
+    void ResetHookStats();
+    void RunCommands();
     void Register(uint8 reg, uint32 id, uint32 evt, int func);
-    void RunScripts(ScriptPaths& scripts);
+    void RegisterPacketFilter(uint32 evt, uint32 opcode, int func);
+    void RegisterDeferred(uint8 reg, uint32 evt, int func);
+    void RunScripts(const ScriptPaths& scripts);
+    bool RunScript(const std::string& path, const ElunaCompiledScript& script);
+    bool ReloadScript(const std::string& name);
+    void ReloadScriptInStates(const std::string& name);
+    uint32 GetScriptId(const std::string& path);
+    void TagRef(int funcRef);
+    void TagRef(int ref, lua_State* L, int index);
+    void ReleaseRef(int funcRef);
+
+    // Returns the ID of the script owning the function ref, 0 if none
+    uint32 GetRefScript(int funcRef) const
+    {
+        if (m_RefScripts.empty())
+            return 0;
+        UNORDERED_MAP<int, uint32>::const_iterator it = m_RefScripts.find(funcRef);
+        return it != m_RefScripts.end() ? it->second : 0;
+    }
+    static void CompileScript(lua_State* L, const std::string& path, const std::string& cacheFolder, ElunaCompiledScript& out);
+    static void CompileScripts(const std::vector<std::string>& paths, std::vector<ElunaCompiledScript>& compiled, const std::string& cacheFolder, uint32 threads);
     static void RemoveRef(const void* obj);
+    static void RegisterGUID(lua_State* L);
+    static int AtPanic(lua_State* L);
+    void StepGC(uint32 diff);
 
     // Pushes
     static void Push(lua_State*); // nil
@@ -404,6 +763,7 @@ public:
     static void Push(lua_State*, const double);
     static void Push(lua_State*, const char*);
     static void Push(lua_State*, const std::string);
+    static void PushGUID(lua_State*, const uint64);
     template<typename T> static void Push(lua_State* L, T const* ptr)
     {
         ElunaTemplate<T>::push(L, ptr);
@@ -431,6 +791,12 @@ public:
 #endif
     }
 
+    // Monotonic time in microseconds, for short measurements
+    static inline uint64 GetCurrTimeUs()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
     static inline uint32 GetTimeDiff(uint32 oldMSTime)
     {
 #ifndef TRINITY
@@ -578,10 +944,10 @@ public:
 
     /* Packet */
     bool OnPacketSend(WorldSession* session, WorldPacket& packet);
-    void OnPacketSendAny(Player* player, WorldPacket& packet, bool& result);
+    void OnPacketSendAny(Player* player, WorldPacket& packet, bool& result, const std::vector<int>& binds);
     void OnPacketSendOne(Player* player, WorldPacket& packet, bool& result);
     bool OnPacketReceive(WorldSession* session, WorldPacket& packet);
-    void OnPacketReceiveAny(Player* player, WorldPacket& packet, bool& result);
+    void OnPacketReceiveAny(Player* player, WorldPacket& packet, bool& result, const std::vector<int>& binds);
     void OnPacketReceiveOne(Player* player, WorldPacket& packet, bool& result);
 
     /* Player */
@@ -677,13 +1043,8 @@ public:
     void OnStartup();
     void OnShutdown();
 };
-template<> Unit* Eluna::CHECKOBJ<Unit>(lua_State* L, int narg, bool error);
-template<> Player* Eluna::CHECKOBJ<Player>(lua_State* L, int narg, bool error);
-template<> Creature* Eluna::CHECKOBJ<Creature>(lua_State* L, int narg, bool error);
-template<> GameObject* Eluna::CHECKOBJ<GameObject>(lua_State* L, int narg, bool error);
-template<> Corpse* Eluna::CHECKOBJ<Corpse>(lua_State* L, int narg, bool error);
 
-#define sEluna Eluna::GEluna
+#define sEluna Eluna::GetEluna()
 
 // #define ELUNA_GUARD() ACE_Guard< ACE_Recursive_Thread_Mutex > ELUNA_GUARD_OBJECT(sEluna->lock);
 
@@ -703,91 +1064,206 @@ struct ElunaBind
 
     // unregisters all registered functions and clears all registered events from the bindings
     virtual void Clear() {};
+
+    // unregisters the functions owned by the script, returns the amount removed. See Eluna::ReloadScript
+    virtual uint32 ClearScript(uint32 /*scriptId*/) { return 0; };
+
+    // removes the bindings of the function ref without freeing it, returns the amount removed. See Eluna::DisableHandler
+    virtual uint32 ClearRef(int /*funcRef*/) { return 0; };
 };
 
 template<typename T>
 struct EventBind : ElunaBind
 {
     typedef std::vector<int> ElunaBindingMap;
-    typedef std::map<int, ElunaBindingMap> ElunaEntryMap;
+    typedef std::vector<ElunaBindingMap> ElunaEntryMap;
 
-    EventBind(const char* bindGroupName, Eluna& _E): ElunaBind(bindGroupName, _E)
+    EventBind(const char* bindGroupName, Eluna& _E, uint32 eventCount): ElunaBind(bindGroupName, _E), Bindings(eventCount), EventMask(0),
+        DeferredBindings(eventCount), DeferredMask(0)
     {
+        ASSERT(eventCount <= 64); // EventMask size
     }
 
-    // unregisters all registered functions and clears all registered events from the bind std::maps (reset)
+    // unregisters all registered functions and clears all registered events from the bindings (reset)
     void Clear() override
     {
-        for (ElunaEntryMap::iterator itr = Bindings.begin(); itr != Bindings.end(); ++itr)
+        Clear(Bindings);
+        Clear(DeferredBindings);
+        EventMask = 0;
+        DeferredMask = 0;
+    }
+
+    void Clear(ElunaEntryMap& bindings)
+    {
+        for (typename ElunaEntryMap::iterator itr = bindings.begin(); itr != bindings.end(); ++itr)
         {
-            for (ElunaBindingMap::iterator it = itr->second.begin(); it != itr->second.end(); ++it)
+            for (ElunaBindingMap::iterator it = itr->begin(); it != itr->end(); ++it)
                 luaL_unref(E.L, LUA_REGISTRYINDEX, (*it));
-            itr->second.clear();
+            itr->clear();
         }
-        Bindings.clear();
+    }
+
+    uint32 ClearScript(uint32 scriptId) override
+    {
+        return ClearScript(Bindings, EventMask, scriptId) + ClearScript(DeferredBindings, DeferredMask, scriptId);
+    }
+
+    uint32 ClearScript(ElunaEntryMap& bindings, uint64& mask, uint32 scriptId)
+    {
+        uint32 count = 0;
+        for (uint32 eventId = 0; eventId < bindings.size(); ++eventId)
+        {
+            ElunaBindingMap& binds = bindings[eventId];
+            for (ElunaBindingMap::iterator it = binds.begin(); it != binds.end();)
+            {
+                if (E.GetRefScript(*it) != scriptId)
+                {
+                    ++it;
+                    continue;
+                }
+                E.ReleaseRef(*it);
+                it = binds.erase(it);
+                ++count;
+            }
+            if (binds.empty())
+                mask &= ~(uint64(1) << eventId);
+        }
+        return count;
+    }
+
+    uint32 ClearRef(int funcRef) override
+    {
+        return ClearRef(Bindings, EventMask, funcRef) + ClearRef(DeferredBindings, DeferredMask, funcRef);
+    }
+
+    uint32 ClearRef(ElunaEntryMap& bindings, uint64& mask, int funcRef)
+    {
+        uint32 count = 0;
+        for (uint32 eventId = 0; eventId < bindings.size(); ++eventId)
+        {
+            ElunaBindingMap& binds = bindings[eventId];
+            ElunaBindingMap::iterator it = std::find(binds.begin(), binds.end(), funcRef);
+            if (it == binds.end())
+                continue;
+            binds.erase(it);
+            ++count;
+            if (binds.empty())
+                mask &= ~(uint64(1) << eventId);
+        }
+        return count;
     }
 
     void Insert(int eventId, int funcRef) // Inserts a new registered event
     {
         Bindings[eventId].push_back(funcRef);
+        EventMask |= uint64(1) << eventId;
+    }
+
+    void InsertDeferred(int eventId, int funcRef) // Inserts a new event run from the deferred queue
+    {
+        DeferredBindings[eventId].push_back(funcRef);
+        DeferredMask |= uint64(1) << eventId;
     }
 
-    // Gets the binding std::map containing all registered events with the function refs for the entry
+    // Checks if there are deferred events for ID
+    bool HasDeferred(T eventId) const
+    {
+        return (DeferredMask & (uint64(1) << eventId)) != 0;
+    }
+
+    // Gets the bindings containing all registered function refs for the event
     ElunaBindingMap* GetBindMap(T eventId)
     {
-        if (Bindings.empty())
+        if (!HasEvents(eventId))
             return NULL;
-        ElunaEntryMap::iterator itr = Bindings.find(eventId);
-        if (itr == Bindings.end())
-            return NULL;
-
-        return &itr->second;
+        return &Bindings[eventId];
     }
 
     // Checks if there are events for ID
     bool HasEvents(T eventId) const
     {
-        if (Bindings.empty())
-            return false;
-        if (Bindings.find(eventId) == Bindings.end())
-            return false;
-        return true;
+        return (EventMask & (uint64(1) << eventId)) != 0;
     }
 
     ElunaEntryMap Bindings; // Binding store Bindings[eventId] = {funcRef};
+    uint64 EventMask;       // Bit for each eventId with bindings
+    ElunaEntryMap DeferredBindings;
+    uint64 DeferredMask;
 };
 
 template<typename T>
 struct EntryBind : ElunaBind
 {
-    typedef std::map<int, int> ElunaBindingMap;
+    typedef std::vector<int> ElunaBindingMap; // ElunaBindingMap[eventId] = funcRef, sized to the event count
     typedef UNORDERED_MAP<uint32, ElunaBindingMap> ElunaEntryMap;
 
-    EntryBind(const char* bindGroupName, Eluna& _E): ElunaBind(bindGroupName, _E)
+    EntryBind(const char* bindGroupName, Eluna& _E, uint32 eventCount): ElunaBind(bindGroupName, _E), EventCount(eventCount), Generation(++LastGeneration)
     {
     }
 
     // unregisters all registered functions and clears all registered events from the bindmap
     void Clear() override
     {
-        for (ElunaEntryMap::iterator itr = Bindings.begin(); itr != Bindings.end(); ++itr)
+        for (typename ElunaEntryMap::iterator itr = Bindings.begin(); itr != Bindings.end(); ++itr)
         {
             for (ElunaBindingMap::const_iterator it = itr->second.begin(); it != itr->second.end(); ++it)
-                luaL_unref(E.L, LUA_REGISTRYINDEX, it->second);
+                if (*it)
+                    luaL_unref(E.L, LUA_REGISTRYINDEX, *it);
             itr->second.clear();
         }
         Bindings.clear();
+        Generation = ++LastGeneration;
+    }
+
+    // The entries are zeroed so pointers from GetBindMap stay valid
+    uint32 ClearScript(uint32 scriptId) override
+    {
+        uint32 count = 0;
+        for (typename ElunaEntryMap::iterator itr = Bindings.begin(); itr != Bindings.end(); ++itr)
+        {
+            for (ElunaBindingMap::iterator it = itr->second.begin(); it != itr->second.end(); ++it)
+            {
+                if (*it && E.GetRefScript(*it) == scriptId)
+                {
+                    E.ReleaseRef(*it);
+                    *it = 0;
+                    ++count;
+                }
+            }
+        }
+        return count;
+    }
+
+    uint32 ClearRef(int funcRef) override
+    {
+        uint32 count = 0;
+        for (typename ElunaEntryMap::iterator itr = Bindings.begin(); itr != Bindings.end(); ++itr)
+        {
+            for (ElunaBindingMap::iterator it = itr->second.begin(); it != itr->second.end(); ++it)
+            {
+                if (*it == funcRef)
+                {
+                    *it = 0;
+                    ++count;
+                }
+            }
+        }
+        return count;
     }
 
     void Insert(uint32 entryId, int eventId, int funcRef) // Inserts a new registered event
     {
-        if (Bindings[entryId][eventId])
+        ElunaBindingMap& binds = Bindings[entryId];
+        if (binds.empty())
+            binds.resize(EventCount, 0);
+
+        if (binds[eventId])
         {
             luaL_unref(E.L, LUA_REGISTRYINDEX, funcRef); // free the unused ref
             luaL_error(E.L, "A function is already registered for entry (%d) event (%d)", entryId, eventId);
         }
         else
-            Bindings[entryId][eventId] = funcRef;
+            binds[eventId] = funcRef;
     }
 
     // Gets the function ref of an entry for an event
@@ -795,21 +1271,19 @@ struct EntryBind : ElunaBind
     {
         if (Bindings.empty())
             return 0;
-        ElunaEntryMap::const_iterator itr = Bindings.find(entryId);
-        if (itr == Bindings.end() || itr->second.empty())
-            return 0;
-        ElunaBindingMap::const_iterator itr2 = itr->second.find(eventId);
-        if (itr2 == itr->second.end())
+        typename ElunaEntryMap::const_iterator itr = Bindings.find(entryId);
+        if (itr == Bindings.end())
             return 0;
-        return itr2->second;
+        return itr->second[eventId];
     }
 
-    // Gets the binding std::map containing all registered events with the function refs for the entry
+    // Gets the bindings of the entry, indexed by eventId.
+    // The returned pointer stays valid until the Generation changes, binds registered later are added to it
     const ElunaBindingMap* GetBindMap(uint32 entryId) const
     {
         if (Bindings.empty())
             return NULL;
-        ElunaEntryMap::const_iterator itr = Bindings.find(entryId);
+        typename ElunaEntryMap::const_iterator itr = Bindings.find(entryId);
         if (itr == Bindings.end())
             return NULL;
 
@@ -825,6 +1299,88 @@ struct EntryBind : ElunaBind
     }
 
     ElunaEntryMap Bindings; // Binding store Bindings[entryId][eventId] = funcRef;
+    uint32 EventCount;
+    uint32 Generation;      // Changes when pointers from GetBindMap are invalidated, unique across stores
+
+    static std::atomic<uint32> LastGeneration; // Stores are created on several threads with per map states
+};
+
+template<typename T>
+std::atomic<uint32> EntryBind<T>::LastGeneration(0);
+
+// Catch-all packet event bindings that only run for some opcodes
+struct PacketFilterBind : ElunaBind
+{
+    typedef std::vector<int> ElunaBindingMap;
+    typedef UNORDERED_MAP<uint32, ElunaBindingMap> ElunaEntryMap;
+
+    PacketFilterBind(const char* bindGroupName, Eluna& _E): ElunaBind(bindGroupName, _E)
+    {
+    }
+
+    // unregisters all registered functions and clears all registered events from the bindmap
+    void Clear() override
+    {
+        for (ElunaEntryMap::iterator itr = Bindings.begin(); itr != Bindings.end(); ++itr)
+        {
+            for (ElunaBindingMap::const_iterator it = itr->second.begin(); it != itr->second.end(); ++it)
+                luaL_unref(E.L, LUA_REGISTRYINDEX, *it);
+            itr->second.clear();
+        }
+        Bindings.clear();
+    }
+
+    uint32 ClearScript(uint32 scriptId) override
+    {
+        uint32 count = 0;
+        for (ElunaEntryMap::iterator itr = Bindings.begin(); itr != Bindings.end(); ++itr)
+        {
+            for (ElunaBindingMap::iterator it = itr->second.begin(); it != itr->second.end();)
+            {
+                if (E.GetRefScript(*it) != scriptId)
+                {
+                    ++it;
+                    continue;
+                }
+                E.ReleaseRef(*it);
+                it = itr->second.erase(it);
+                ++count;
+            }
+        }
+        return count;
+    }
+
+    uint32 ClearRef(int funcRef) override
+    {
+        uint32 count = 0;
+        for (ElunaEntryMap::iterator itr = Bindings.begin(); itr != Bindings.end(); ++itr)
+        {
+            ElunaBindingMap::iterator it = std::find(itr->second.begin(), itr->second.end(), funcRef);
+            if (it == itr->second.end())
+                continue;
+            itr->second.erase(it);
+            ++count;
+        }
+        return count;
+    }
+
+    void Insert(uint32 opcode, int funcRef) // Inserts a new registered event
+    {
+        Bindings[opcode].push_back(funcRef);
+    }
+
+    // Gets the function refs registered for the opcode
+    const ElunaBindingMap* GetBindMap(uint32 opcode) const
+    {
+        if (Bindings.empty())
+            return NULL;
+        ElunaEntryMap::const_iterator itr = Bindings.find(opcode);
+        if (itr == Bindings.end())
+            return NULL;
+        return &itr->second;
+    }
+
+    ElunaEntryMap Bindings; // Binding store Bindings[opcode] = {funcRef};
 };
 
 template<typename T>
@@ -833,6 +1389,13 @@ class ElunaTemplate
 public:
     static const char* tname;
     static bool manageMemory;
+    static std::once_flag registered;
+
+    static void SetType(const char* name, bool gc)
+    {
+        tname = name;
+        manageMemory = gc;
+    }
 
     static int typeT(lua_State* L)
     {
@@ -846,8 +1409,8 @@ public:
     // that will only be needed on lua side and will not be managed by TC/mangos/<core>
     static void Register(lua_State* L, const char* name, bool gc = false)
     {
-        tname = name;
-        manageMemory = gc;
+        // Every state registers the types and states can be created on map threads, only the first sets the statics
+        std::call_once(registered, &SetType, name, gc);
 
         lua_newtable(L);
         int methods = lua_gettop(L);
@@ -907,11 +1470,16 @@ public:
             return;
         }
 
-        for (; methodTable && methodTable->name && methodTable->mfunc; ++methodTable)
+        for (; methodTable && methodTable->name && (methodTable->mfunc || methodTable->func); ++methodTable)
         {
             lua_pushstring(L, methodTable->name);
-            lua_pushlightuserdata(L, (void*)methodTable);
-            lua_pushcclosure(L, thunk, 1);
+            if (methodTable->func)
+                lua_pushcfunction(L, methodTable->func);
+            else
+            {
+                lua_pushlightuserdata(L, (void*)methodTable);
+                lua_pushcclosure(L, thunk, 1);
+            }
             lua_settable(L, -3);
         }
 
@@ -925,9 +1493,9 @@ public:
             return 0;
 
         // Get object pointer (and check type, no error)
-        T** ptrHold = static_cast<T**>(luaL_testudata(L, -1, tname));
-        if (ptrHold)
-            delete *ptrHold;
+        ElunaObject* elunaObj = static_cast<ElunaObject*>(luaL_testudata(L, -1, tname));
+        if (elunaObj && !elunaObj->borrowed)
+            delete static_cast<T*>(static_cast<typename ElunaTypeTraits<T>::Base*>(elunaObj->object));
         return 0;
     }
 
@@ -939,30 +1507,48 @@ public:
             return 1;
         }
 
+        // Objects are cached and validated by their base pointer
+        typename ElunaTypeTraits<T>::Base const* base = obj;
+
         if (!manageMemory)
         {
             lua_rawgeti(L, LUA_REGISTRYINDEX, sEluna->userdata_table);
-            lua_pushfstring(L, "%p", obj);
-            lua_gettable(L, -2);
+            lua_pushlightuserdata(L, (void*)base);
+            lua_rawget(L, -2);
             if (!lua_isnoneornil(L, -1) && luaL_checkudata(L, -1, tname))
             {
-                lua_remove(L, -2);
-                return 1;
+                // The cached userdata can belong to a removed object that had the same address
+                ElunaObject* cached = static_cast<ElunaObject*>(lua_touserdata(L, -1));
+                if (sEluna->m_Handles.IsValid(cached->slot, cached->generation))
+                {
+                    lua_remove(L, -2);
+                    return 1;
+                }
             }
             lua_remove(L, -1);
             // left userdata_table in stack
         }
 
         // Create new userdata
-        T const** ptrHold = static_cast<T const**>(lua_newuserdata(L, sizeof(T const*)));
-        if (!ptrHold)
+        ElunaObject* elunaObj = static_cast<ElunaObject*>(lua_newuserdata(L, sizeof(ElunaObject)));
+        if (!elunaObj)
         {
             ELUNA_LOG_ERROR("%s could not create new userdata", tname);
             lua_pop(L, manageMemory ? 1 : 2);
             lua_pushnil(L);
             return 1;
         }
-        *ptrHold = obj;
+        elunaObj->magic = ELUNA_OBJECT_MAGIC;
+        elunaObj->object = const_cast<typename ElunaTypeTraits<T>::Base*>(base);
+        elunaObj->slot = 0;
+        elunaObj->generation = 0;
+        elunaObj->tag = ElunaTypeTraits<T>::Tag;
+        elunaObj->borrowed = false;
+        if (!manageMemory)
+        {
+            elunaObj->slot = sEluna->m_Handles.Acquire(base);
+            elunaObj->generation = sEluna->m_Handles.GetGeneration(elunaObj->slot);
+        }
 
         // Set metatable for it
         luaL_getmetatable(L, tname);
@@ -977,18 +1563,66 @@ public:
 
         if (!manageMemory)
         {
-            lua_pushfstring(L, "%p", obj);
+            lua_pushlightuserdata(L, (void*)base);
             lua_pushvalue(L, -2);
-            lua_settable(L, -4);
+            lua_rawset(L, -4);
             lua_remove(L, -2);
         }
         return 1;
     }
 
+    // Pushes a memory managed type without copying it. The object stays owned by the caller
+    // and must be released from m_Handles of the state before it is destroyed. See own
+    static int pushBorrowed(lua_State* L, T* obj)
+    {
+        typename ElunaTypeTraits<T>::Base* base = obj;
+
+        ElunaObject* elunaObj = static_cast<ElunaObject*>(lua_newuserdata(L, sizeof(ElunaObject)));
+        elunaObj->magic = ELUNA_OBJECT_MAGIC;
+        elunaObj->object = base;
+        elunaObj->slot = sEluna->m_Handles.Acquire(base, false);
+        elunaObj->generation = sEluna->m_Handles.GetGeneration(elunaObj->slot);
+        elunaObj->tag = ElunaTypeTraits<T>::Tag;
+        elunaObj->borrowed = true;
+
+        luaL_getmetatable(L, tname);
+        if (!lua_istable(L, -1))
+        {
+            ELUNA_LOG_ERROR("%s missing metatable", tname);
+            lua_pop(L, 2);
+            lua_pushnil(L);
+            return 1;
+        }
+        lua_setmetatable(L, -2);
+        return 1;
+    }
+
+    // Replaces a borrowed object at narg with a copy owned by lua, so it can be changed.
+    // Returns the object to use, obj itself if it was not borrowed
+    static T* own(lua_State* L, int narg, T* obj)
+    {
+        ElunaObject* elunaObj = static_cast<ElunaObject*>(lua_touserdata(L, narg));
+        if (!elunaObj || !elunaObj->borrowed)
+            return obj;
+
+        T* copy = new T(*obj);
+        elunaObj->object = static_cast<typename ElunaTypeTraits<T>::Base*>(copy);
+        elunaObj->borrowed = false;
+        return copy;
+    }
+
     static T* check(lua_State* L, int narg, bool error = true)
     {
-        T** ptrHold = static_cast<T**>(lua_touserdata(L, narg));
-        if (!ptrHold)
+        ElunaObject* elunaObj = NULL;
+        if (lua_type(L, narg) == LUA_TUSERDATA && lua_rawlen(L, narg) == sizeof(ElunaObject))
+        {
+            elunaObj = static_cast<ElunaObject*>(lua_touserdata(L, narg));
+            if (elunaObj->magic != ELUNA_OBJECT_MAGIC)
+                elunaObj = NULL;
+        }
+
+        // Type check, allowed upcasts are resolved at compile time
+        if (!elunaObj || !(ElunaTypeTraits<T>::Accepts & ELUNA_TAG_BIT(elunaObj->tag)))
         {
             if (error)
             {
@@ -999,31 +1633,18 @@ public:
             return NULL;
         }
 
-        if (!manageMemory)
+        // Check pointer validity, a stale handle means the object was removed
+        if ((!manageMemory || elunaObj->borrowed) && !sEluna->m_Handles.IsValid(elunaObj->slot, elunaObj->generation))
         {
-            // Check pointer validity
-            lua_rawgeti(L, LUA_REGISTRYINDEX, sEluna->userdata_table);
-            lua_pushfstring(L, "%p", *ptrHold);
-            lua_gettable(L, -2);
-            lua_remove(L, -2);
-            bool valid = lua_isuserdata(L, -1);
-            lua_remove(L, -1);
-            if (!valid)
+            if (error)
             {
                 char buff[256];
-                snprintf(buff, 256, "%s expected, got pointer to nonexisting object (%s). This should never happen", tname, luaL_typename(L, narg));
-                if (error)
-                {
-                    luaL_argerror(L, narg, buff);
-                }
-                else
-                {
-                    ELUNA_LOG_ERROR("%s", buff);
-                }
-                return NULL;
+                snprintf(buff, 256, "%s expected, got pointer to nonexisting object (%s)", tname, luaL_typename(L, narg));
+                luaL_argerror(L, narg, buff);
             }
+            return NULL;
         }
-        return *ptrHold;
+        return static_cast<T*>(static_cast<typename ElunaTypeTraits<T>::Base*>(elunaObj->object));
     }
 
     static int thunk(lua_State* L)
@@ -1059,4 +1680,100 @@ public:
     }
 };
 
+// Compile time generated method binders.
+// ELUNA_BIND(T, &Class::Method) creates a lua_CFunction that checks self as T, reads the arguments
+// with CHECKVAL/CHECKOBJ and pushes the return value, so there is no stack bookkeeping like in thunk.
+// Use it in ElunaRegister tables: { "GetEntry", NULL, ELUNA_BIND(Object, &Object::GetEntry) }
+template<int... I>
+struct ElunaIndices { };
+
+template<int N, int... I>
+struct ElunaMakeIndices : ElunaMakeIndices<N - 1, N - 1, I...> { };
+
+template<int... I>
+struct ElunaMakeIndices<0, I...>
+{
+    typedef ElunaIndices<I...> type;
+};
+
+template<typename A>
+struct ElunaArg
+{
+    static A Get(lua_State* L, int narg) { return Eluna::CHECKVAL<A>(L, narg); }
+};
+template<typename A>
+struct ElunaArg<A const> : ElunaArg<A> { };
+template<typename A>
+struct ElunaArg<A const&> : ElunaArg<A> { };
+template<typename A>
+struct ElunaArg<A*>
+{
+    static A* Get(lua_State* L, int narg) { return Eluna::CHECKOBJ<A>(L, narg); }
+};
+template<typename A>
+struct ElunaArg<A const*> : ElunaArg<A*> { };
+
+template<typename R>
+struct ElunaReturn
+{
+    template<typename T, typename M, typename... A>
+    static int Call(lua_State* L, T* obj, M method, A... args)
+    {
+        Eluna::Push(L, (obj->*method)(args...));
+        return 1;
+    }
+};
+
+template<>
+struct ElunaReturn<void>
+{
+    template<typename T, typename M, typename... A>
+    static int Call(lua_State* /*L*/, T* obj, M method, A... args)
+    {
+        (obj->*method)(args...);
+        return 0;
+    }
+};
+
+template<typename T, typename M, M method>
+struct ElunaBinder;
+
+template<typename T, typename C, typename R, typename... Args, R(C::*method)(Args...)>
+struct ElunaBinder<T, R(C::*)(Args...), method>
+{
+    static int Call(lua_State* L)
+    {
+        T* obj = Eluna::CHECKOBJ<T>(L, 1); // get self
+        if (!obj)
+            return 0;
+        return Invoke(L, obj, typename ElunaMakeIndices<sizeof...(Args)>::type());
+    }
+
+    template<int... I>
+    static int Invoke(lua_State* L, T* obj, ElunaIndices<I...>)
+    {
+        return ElunaReturn<R>::Call(L, obj, method, ElunaArg<Args>::Get(L, I + 2)...);
+    }
+};
+
+template<typename T, typename C, typename R, typename... Args, R(C::*method)(Args...) const>
+struct ElunaBinder<T, R(C::*)(Args...) const, method>
+{
+    static int Call(lua_State* L)
+    {
+        T* obj = Eluna::CHECKOBJ<T>(L, 1); // get self
+        if (!obj)
+            return 0;
+        return Invoke(L, obj, typename ElunaMakeIndices<sizeof...(Args)>::type());
+    }
+
+    template<int... I>
+    static int Invoke(lua_State* L, T* obj, ElunaIndices<I...>)
+    {
+        return ElunaReturn<R>::Call(L, static_cast<T const*>(obj), method, ElunaArg<Args>::Get(L, I + 2)...);
+    }
+};
+
+#define ELUNA_BIND(T, M)    &ElunaBinder<T, decltype(M), M>::Call
+
 #endif
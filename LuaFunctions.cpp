@@ -33,10 +33,10 @@ void RegisterGlobals(lua_State* L)
 {
     // Hooks
     lua_register(L, "RegisterPacketEvent", &LuaGlobalFunctions::RegisterPacketEvent);                       // RegisterPacketEvent(opcodeID, event, function)
-    lua_register(L, "RegisterServerEvent", &LuaGlobalFunctions::RegisterServerEvent);                       // RegisterServerEvent(event, function)
-    lua_register(L, "RegisterPlayerEvent", &LuaGlobalFunctions::RegisterPlayerEvent);                       // RegisterPlayerEvent(event, function)
-    lua_register(L, "RegisterGuildEvent", &LuaGlobalFunctions::RegisterGuildEvent);                         // RegisterGuildEvent(event, function)
-    lua_register(L, "RegisterGroupEvent", &LuaGlobalFunctions::RegisterGroupEvent);                         // RegisterGroupEvent(event, function)
+    lua_register(L, "RegisterServerEvent", &LuaGlobalFunctions::RegisterServerEvent);                       // RegisterServerEvent(event, function[, opcode or {opcodes}]) - Opcodes limit packet send and receive events to the given opcodes
+    lua_register(L, "RegisterPlayerEvent", &LuaGlobalFunctions::RegisterPlayerEvent);                       // RegisterPlayerEvent(event, function[, deferred]) - deferred handlers of observe-only events run in a batch on world update, objects gone by then are passed as nil
+    lua_register(L, "RegisterGuildEvent", &LuaGlobalFunctions::RegisterGuildEvent);                         // RegisterGuildEvent(event, function[, deferred]) - deferred handlers of observe-only events run in a batch on world update, objects gone by then are passed as nil
+    lua_register(L, "RegisterGroupEvent", &LuaGlobalFunctions::RegisterGroupEvent);                         // RegisterGroupEvent(event, function[, deferred]) - deferred handlers of observe-only events run in a batch on world update, objects gone by then are passed as nil
     lua_register(L, "RegisterCreatureEvent", &LuaGlobalFunctions::RegisterCreatureEvent);                   // RegisterCreatureEvent(entry, event, function)
     lua_register(L, "RegisterCreatureGossipEvent", &LuaGlobalFunctions::RegisterCreatureGossipEvent);       // RegisterCreatureGossipEvent(entry, event, function)
     lua_register(L, "RegisterGameObjectEvent", &LuaGlobalFunctions::RegisterGameObjectEvent);               // RegisterGameObjectEvent(entry, event, function)
@@ -59,13 +59,14 @@ void RegisterGlobals(lua_State* L)
     lua_register(L, "GetGuildByName", &LuaGlobalFunctions::GetGuildByName);                                 // GetGuildByName(name) - Returns guild object by the guild name
     lua_register(L, "GetGuildByLeaderGUID", &LuaGlobalFunctions::GetGuildByLeaderGUID);                     // GetGuildByLeaderGUID(guid) - Returns guild by it's leader's guid
     lua_register(L, "GetPlayerCount", &LuaGlobalFunctions::GetPlayerCount);                                 // GetPlayerCount() - Returns the server's player count
-    lua_register(L, "GetPlayerGUID", &LuaGlobalFunctions::GetPlayerGUID);                                   // GetPlayerGUID(lowguid) - Generates GUID (uint64) string from player lowguid UNDOCUMENTED
-    lua_register(L, "GetItemGUID", &LuaGlobalFunctions::GetItemGUID);                                       // GetItemGUID(lowguid) - Generates GUID (uint64) string from item lowguid UNDOCUMENTED
-    lua_register(L, "GetObjectGUID", &LuaGlobalFunctions::GetObjectGUID);                                   // GetObjectGUID(lowguid, entry) - Generates GUID (uint64) string from gameobject lowguid and entry UNDOCUMENTED
-    lua_register(L, "GetUnitGUID", &LuaGlobalFunctions::GetUnitGUID);                                       // GetUnitGUID(lowguid, entry) - Generates GUID (uint64) string from unit (creature) lowguid and entry UNDOCUMENTED
-    lua_register(L, "GetGUIDLow", &LuaGlobalFunctions::GetGUIDLow);                                         // GetGUIDLow(guid) - Returns GUIDLow (uint32) from guid (uint64 as string) UNDOCUMENTED
-    lua_register(L, "GetGUIDType", &LuaGlobalFunctions::GetGUIDType);                                       // GetGUIDType(guid) - Returns Type (uint32) from guid (uint64 as string) UNDOCUMENTED
-    lua_register(L, "GetGUIDEntry", &LuaGlobalFunctions::GetGUIDEntry);                                     // GetGUIDEntry(guid) - Returns Entry (uint32) from guid (uint64 as string), may be always 0 UNDOCUMENTED
+    lua_register(L, "GetPlayerGUID", &LuaGlobalFunctions::GetPlayerGUID);                                   // GetPlayerGUID(lowguid) - Generates GUID (uint64) from player lowguid UNDOCUMENTED
+    lua_register(L, "GetItemGUID", &LuaGlobalFunctions::GetItemGUID);                                       // GetItemGUID(lowguid) - Generates GUID (uint64) from item lowguid UNDOCUMENTED
+    lua_register(L, "GetObjectGUID", &LuaGlobalFunctions::GetObjectGUID);                                   // GetObjectGUID(lowguid, entry) - Generates GUID (uint64) from gameobject lowguid and entry UNDOCUMENTED
+    lua_register(L, "GetUnitGUID", &LuaGlobalFunctions::GetUnitGUID);                                       // GetUnitGUID(lowguid, entry) - Generates GUID (uint64) from unit (creature) lowguid and entry UNDOCUMENTED
+    lua_register(L, "GUID", &LuaGlobalFunctions::ToGUID);                                                   // GUID(value) - Returns the GUID (uint64) of a decimal string, number or GUID. Use to compare GUIDs with ones saved as strings UNDOCUMENTED
+    lua_register(L, "GetGUIDLow", &LuaGlobalFunctions::GetGUIDLow);                                         // GetGUIDLow(guid) - Returns GUIDLow (uint32) from guid (uint64) UNDOCUMENTED
+    lua_register(L, "GetGUIDType", &LuaGlobalFunctions::GetGUIDType);                                       // GetGUIDType(guid) - Returns Type (uint32) from guid (uint64) UNDOCUMENTED
+    lua_register(L, "GetGUIDEntry", &LuaGlobalFunctions::GetGUIDEntry);                                     // GetGUIDEntry(guid) - Returns Entry (uint32) from guid (uint64), may be always 0 UNDOCUMENTED
     lua_register(L, "GetAreaName", &LuaGlobalFunctions::GetAreaName);                                       // GetAreaName(area or zone ID[, locale]) - Returns area or zone (string) name by area or zone ID. Locale is optional (Default = 0 (enUS))
     lua_register(L, "bit_not", &LuaGlobalFunctions::bit_not);                                               // bit_not(a) - Returns ~a UNDOCUMENTED
     lua_register(L, "bit_xor", &LuaGlobalFunctions::bit_xor);                                               // bit_xor(a, b) - Returns a ^ b UNDOCUMENTED
@@ -75,6 +76,10 @@ void RegisterGlobals(lua_State* L)
     lua_register(L, "bit_and", &LuaGlobalFunctions::bit_and);                                               // bit_and(a, b) - Returns a & b UNDOCUMENTED
     lua_register(L, "GetItemLink", &LuaGlobalFunctions::GetItemLink);                                       // GetItemLink(entry[, localeIndex]) - Returns the shift clickable link of the item. Item name translated if translate available for provided locale index UNDOCUMENTED
     lua_register(L, "GetMapById", &LuaGlobalFunctions::GetMapById);                                         // GetMapById(mapId, instance) - Returns map object of id specified. UNDOCUMENTED
+    lua_register(L, "GetMemoryStats", &LuaGlobalFunctions::GetMemoryStats);                                 // GetMemoryStats() - Returns a table of lua allocator stats: pooled, live, peak, arenas, system and classes[blockSize] = {live, free} UNDOCUMENTED
+    lua_register(L, "GetGCStats", &LuaGlobalFunctions::GetGCStats);                                         // GetGCStats() - Returns a table of GC stepping stats: budget, stepSize, steps, cycles, totalTime, lastPause, maxPause, lastSteps (times in us) and memory (KB) UNDOCUMENTED
+    lua_register(L, "GetHookStats", &LuaGlobalFunctions::GetHookStats);                                     // GetHookStats() - Returns a table of profiled handlers: {group, event, entry, source, calls, samples, errors, totalTime, maxTime} (times in us). Calls is estimated from the samples, see Eluna.ProfileSampleRate UNDOCUMENTED
+    lua_register(L, "GetErrorStats", &LuaGlobalFunctions::GetErrorStats);                                   // GetErrorStats() - Returns a table of error counts keyed by the "file:line" the errors were raised at UNDOCUMENTED
 
     // Other
     lua_register(L, "ReloadEluna", &LuaGlobalFunctions::ReloadEluna);                                       // ReloadEluna() - Reload's Eluna engine. Warning! Reloading should be used only for testing.
@@ -88,6 +93,10 @@ void RegisterGlobals(lua_State* L)
     lua_register(L, "CreateLuaEvent", &LuaGlobalFunctions::CreateLuaEvent);                                 // CreateLuaEvent(function, delay, calls) - Creates a global timed event. Returns Event ID. Calls set to 0 calls infinitely.
     lua_register(L, "RemoveEventById", &LuaGlobalFunctions::RemoveEventById);                               // RemoveEventById(eventId, [all_events]) - Removes a global timed event by it's ID. If all_events is true, can remove any timed event by ID (unit, gameobject, global..)
     lua_register(L, "RemoveEvents", &LuaGlobalFunctions::RemoveEvents);                                     // RemoveEvents([all_events]) - Removes all global timed events. Removes all timed events (unit, gameobject, global) if all_events is true
+    lua_register(L, "RunCoroutine", &LuaGlobalFunctions::RunCoroutine);                                     // RunCoroutine(function, ...) - Runs the function as a coroutine that can use Sleep, WaitForTicks and WaitUntil UNDOCUMENTED
+    lua_register(L, "Sleep", &LuaGlobalFunctions::Sleep);                                                   // Sleep(delay) - Suspends the coroutine for delay ms UNDOCUMENTED
+    lua_register(L, "WaitForTicks", &LuaGlobalFunctions::WaitForTicks);                                     // WaitForTicks([ticks]) - Suspends the coroutine for ticks world updates, 1 by default UNDOCUMENTED
+    lua_register(L, "WaitUntil", &LuaGlobalFunctions::WaitUntil);                                           // WaitUntil(predicate[, interval]) - Suspends the coroutine until predicate() returns true, checked every interval ms or each tick if 0 UNDOCUMENTED
     lua_register(L, "PerformIngameSpawn", &LuaGlobalFunctions::PerformIngameSpawn);                         // PerformIngameSpawn(spawntype, entry, mapid, instanceid, x, y, z, o[, save, DurOrResptime, phase]) - spawntype: 1 Creature, 2 Object. DurOrResptime is respawntime for gameobjects and despawntime for creatures if creature is not saved. Returns spawned creature/gameobject
     lua_register(L, "CreatePacket", &LuaGlobalFunctions::CreatePacket);                                     // CreatePacket(opcode, size) - Creates a new packet object
     lua_register(L, "AddVendorItem", &LuaGlobalFunctions::AddVendorItem);                                   // AddVendorItem(entry, itemId, maxcount, incrtime, extendedcost) - Adds an item to vendor entry.
@@ -111,8 +120,8 @@ void RegisterGlobals(lua_State* L)
 ElunaRegister<Object> ObjectMethods[] =
 {
     // Getters
-    { "GetEntry", &LuaObject::GetEntry },                     // :GetEntry() - Returns the object's entryId
-    { "GetGUID", &LuaObject::GetGUID },                       // :GetGUID() - Returns uint64 guid as hex string
+    { "GetEntry", NULL, ELUNA_BIND(Object, &Object::GetEntry) }, // :GetEntry() - Returns the object's entryId
+    { "GetGUID", &LuaObject::GetGUID },                       // :GetGUID() - Returns uint64 guid
     { "GetGUIDLow", &LuaObject::GetGUIDLow },                 // :GetGUIDLow() - Returns uint32 guid (low guid) that is used in database.
     { "GetInt32Value", &LuaObject::GetInt32Value },           // :GetInt32Value(index) - returns an int value from object fields
     { "GetUInt32Value", &LuaObject::GetUInt32Value },         // :GetUInt32Value(index) - returns an uint value from object fields
@@ -162,7 +171,7 @@ ElunaRegister<WorldObject> WorldObjectMethods[] =
     { "GetAreaId", &LuaWorldObject::GetAreaId },                          // :GetAreaId()
     { "GetZoneId", &LuaWorldObject::GetZoneId },                          // :GetZoneId()
     { "GetMapId", &LuaWorldObject::GetMapId },                            // :GetMapId() - Returns the WorldObject's current map ID
-    { "GetX", &LuaWorldObject::GetX },                                    // :GetX()
+    { "GetX", NULL, ELUNA_BIND(WorldObject, &WorldObject::GetPositionX) }, // :GetX()
     { "GetY", &LuaWorldObject::GetY },                                    // :GetY()
     { "GetZ", &LuaWorldObject::GetZ },                                    // :GetZ()
     { "GetO", &LuaWorldObject::GetO },                                    // :GetO()
@@ -191,7 +200,7 @@ ElunaRegister<Unit> UnitMethods[] =
 {
     // Getters
     { "GetLevel", &LuaUnit::GetLevel },                                   // :GetLevel()
-    { "GetHealth", &LuaUnit::GetHealth },                                 // :GetHealth()
+    { "GetHealth", NULL, ELUNA_BIND(Unit, &Unit::GetHealth) },            // :GetHealth()
     { "GetDisplayId", &LuaUnit::GetDisplayId },                           // :GetDisplayId()
     { "GetNativeDisplayId", &LuaUnit::GetNativeDisplayId },               // :GetNativeDisplayId()
     { "GetPower", &LuaUnit::GetPower },                                   // :GetPower(index) - returns power at index. Index can be omitted
@@ -1185,6 +1194,7 @@ ElunaRegister<AuctionHouseObject> AuctionMethods[] =
 
 template<typename T> const char* ElunaTemplate<T>::tname = NULL;
 template<typename T> bool ElunaTemplate<T>::manageMemory = false;
+template<typename T> std::once_flag ElunaTemplate<T>::registered;
 #if (!defined(TBC) && !defined(CLASSIC))
 // fix compile error about accessing vehicle destructor
 template<> int ElunaTemplate<Vehicle>::gcT(lua_State* /*L*/)
@@ -1201,6 +1211,7 @@ void RegisterFunctions(lua_State* L)
 
     // You should add Eluna::RemoveRef(this); to all destructors for objects that are NOT mem managed (gc) by lua.
     // Exceptions being Quest type static data structs that will never be destructed (during runtime), though they can have it as well.
+    // Object hierarchy types are referenced by their Object pointer, so for them it is enough to add it to Object's destructor.
 
     ElunaTemplate<Object>::Register(L, "Object");
     ElunaTemplate<Object>::SetMethods(L, ObjectMethods);
@@ -69,15 +69,9 @@ namespace LuaObject
         return 1;
     }
 
-    int GetEntry(lua_State* L, Object* obj)
-    {
-        Eluna::Push(L, obj->GetEntry());
-        return 1;
-    }
-
     int GetGUID(lua_State* L, Object* obj)
     {
-        Eluna::Push(L, obj->GET_GUID());
+        Eluna::PushGUID(L, obj->GET_GUID());
         return 1;
     }
 
@@ -395,9 +395,9 @@ namespace LuaUnit
     int GetOwnerGUID(lua_State* L, Unit* unit)
     {
 #ifndef TRINITY
-        Eluna::Push(L, unit->GetOwnerGuid());
+        Eluna::PushGUID(L, unit->GetOwnerGuid());
 #else
-        Eluna::Push(L, unit->GetOwnerGUID());
+        Eluna::PushGUID(L, unit->GetOwnerGUID());
 #endif
         return 1;
     }
@@ -411,9 +411,9 @@ namespace LuaUnit
     int GetCreatorGUID(lua_State* L, Unit* unit)
     {
 #ifndef TRINITY
-        Eluna::Push(L, unit->GetCreatorGuid());
+        Eluna::PushGUID(L, unit->GetCreatorGuid());
 #else
-        Eluna::Push(L, unit->GetCreatorGUID());
+        Eluna::PushGUID(L, unit->GetCreatorGUID());
 #endif
         return 1;
     }
@@ -421,9 +421,9 @@ namespace LuaUnit
     int GetMinionGUID(lua_State* L, Unit* unit)
     {
 #ifndef TRINITY
-        Eluna::Push(L, unit->GetPetGuid());
+        Eluna::PushGUID(L, unit->GetPetGuid());
 #else
-        Eluna::Push(L, unit->GetPetGUID());
+        Eluna::PushGUID(L, unit->GetPetGUID());
 #endif
         return 1;
     }
@@ -431,9 +431,9 @@ namespace LuaUnit
     int GetCharmerGUID(lua_State* L, Unit* unit)
     {
 #ifndef TRINITY
-        Eluna::Push(L, unit->GetCharmerGuid());
+        Eluna::PushGUID(L, unit->GetCharmerGuid());
 #else
-        Eluna::Push(L, unit->GetCharmerGUID());
+        Eluna::PushGUID(L, unit->GetCharmerGUID());
 #endif
         return 1;
     }
@@ -441,9 +441,9 @@ namespace LuaUnit
     int GetCharmGUID(lua_State* L, Unit* unit)
     {
 #ifndef TRINITY
-        Eluna::Push(L, unit->GetCharmGuid());
+        Eluna::PushGUID(L, unit->GetCharmGuid());
 #else
-        Eluna::Push(L, unit->GetCharmGUID());
+        Eluna::PushGUID(L, unit->GetCharmGUID());
 #endif
         return 1;
     }
@@ -451,9 +451,9 @@ namespace LuaUnit
     int GetPetGUID(lua_State* L, Unit* unit)
     {
 #ifndef TRINITY
-        Eluna::Push(L, unit->GetPetGuid());
+        Eluna::PushGUID(L, unit->GetPetGuid());
 #else
-        Eluna::Push(L, unit->GetPetGUID());
+        Eluna::PushGUID(L, unit->GetPetGUID());
 #endif
         return 1;
     }
@@ -461,9 +461,9 @@ namespace LuaUnit
     int GetControllerGUID(lua_State* L, Unit* unit)
     {
 #ifndef TRINITY
-        Eluna::Push(L, unit->GetCharmerOrOwnerGuid());
+        Eluna::PushGUID(L, unit->GetCharmerOrOwnerGuid());
 #else
-        Eluna::Push(L, unit->GetCharmerOrOwnerGUID());
+        Eluna::PushGUID(L, unit->GetCharmerOrOwnerGUID());
 #endif
         return 1;
     }
@@ -471,9 +471,9 @@ namespace LuaUnit
     int GetControllerGUIDS(lua_State* L, Unit* unit)
     {
 #ifndef TRINITY
-        Eluna::Push(L, unit->GetCharmerOrOwnerOrOwnGuid());
+        Eluna::PushGUID(L, unit->GetCharmerOrOwnerOrOwnGuid());
 #else
-        Eluna::Push(L, unit->GetCharmerOrOwnerOrOwnGUID());
+        Eluna::PushGUID(L, unit->GetCharmerOrOwnerOrOwnGUID());
 #endif
         return 1;
     }
@@ -543,12 +543,6 @@ namespace LuaUnit
         return 1;
     }
 
-    int GetHealth(lua_State* L, Unit* unit)
-    {
-        Eluna::Push(L, unit->GetHealth());
-        return 1;
-    }
-
     int GetPower(lua_State* L, Unit* unit)
     {
         int type = Eluna::CHECKVAL<int>(L, 2, -1);
@@ -844,9 +838,9 @@ namespace LuaUnit
     int GetCritterGUID(lua_State* L, Unit* unit)
     {
 #ifndef TRINITY
-        Eluna::Push(L, unit->GetCritterGuid());
+        Eluna::PushGUID(L, unit->GetCritterGuid());
 #else
-        Eluna::Push(L, unit->GetCritterGUID());
+        Eluna::PushGUID(L, unit->GetCritterGUID());
 #endif
         return 1;
     }
@@ -1557,10 +1551,12 @@ namespace LuaUnit
         luaL_checktype(L, 2, LUA_TFUNCTION);
         uint32 delay = Eluna::CHECKVAL<uint32>(L, 3);
         uint32 repeats = Eluna::CHECKVAL<uint32>(L, 4);
+        if (!sEluna->m_EventMgr->CanAddEvent(unit))
+            return luaL_error(L, "events of an object can only be registered on the object's map with per map states");
 
         lua_pushvalue(L, 2);
         int functionRef = luaL_ref(L, LUA_REGISTRYINDEX);
-        functionRef = sEluna->m_EventMgr->AddEvent(&unit->m_Events, functionRef, delay, repeats, unit);
+        functionRef = sEluna->m_EventMgr->AddEvent(unit, functionRef, delay, repeats);
         if (functionRef)
             Eluna::Push(L, functionRef);
         return 1;
@@ -1569,13 +1565,13 @@ namespace LuaUnit
     int RemoveEventById(lua_State* L, Unit* unit)
     {
         int eventId = Eluna::CHECKVAL<int>(L, 2);
-        sEluna->m_EventMgr->RemoveEvent(&unit->m_Events, eventId);
+        sEluna->m_EventMgr->RemoveEvent(unit, eventId);
         return 0;
     }
 
     int RemoveEvents(lua_State* /*L*/, Unit* unit)
     {
-        sEluna->m_EventMgr->RemoveEvents(&unit->m_Events);
+        sEluna->m_EventMgr->RemoveEvents(unit);
         return 0;
     }
 
@@ -54,12 +54,6 @@ namespace LuaWorldObject
         return 1;
     }
 
-    int GetX(lua_State* L, WorldObject* obj)
-    {
-        Eluna::Push(L, obj->GetPositionX());
-        return 1;
-    }
-
     int GetY(lua_State* L, WorldObject* obj)
     {
         Eluna::Push(L, obj->GetPositionY());
@@ -9,6 +9,12 @@
 
 namespace LuaPacket
 {
+    // Packets pushed in packet hooks are borrowed from the core and copied when they are first changed
+    WorldPacket* Writable(lua_State* L, WorldPacket* packet)
+    {
+        return ElunaTemplate<WorldPacket>::own(L, 1, packet);
+    }
+
     // GetOpcode()
     int GetOpcode(lua_State* L, WorldPacket* packet)
     {
@@ -29,7 +35,7 @@ namespace LuaPacket
         uint32 opcode = Eluna::CHECKVAL<uint32>(L, 2);
         if (opcode >= NUM_MSG_TYPES)
             return luaL_argerror(L, 2, "valid opcode expected");
-        packet->SetOpcode((OpcodesList)opcode);
+        Writable(L, packet)->SetOpcode((OpcodesList)opcode);
         return 0;
     }
 
@@ -110,7 +116,7 @@ namespace LuaPacket
     {
         uint64 guid;
         (*packet) >> guid;
-        Eluna::Push(L, guid);
+        Eluna::PushGUID(L, guid);
         return 1;
     }
 
@@ -127,7 +133,7 @@ namespace LuaPacket
     int WriteGUID(lua_State* L, WorldPacket* packet)
     {
         uint64 guid = Eluna::CHECKVAL<uint64>(L, 2);
-        (*packet) << guid;
+        (*Writable(L, packet)) << guid;
         return 0;
     }
 
@@ -135,7 +141,7 @@ namespace LuaPacket
     int WriteString(lua_State* L, WorldPacket* packet)
     {
         std::string _val = Eluna::CHECKVAL<std::string>(L, 2);
-        (*packet) << _val;
+        (*Writable(L, packet)) << _val;
         return 0;
     }
 
@@ -143,7 +149,7 @@ namespace LuaPacket
     int WriteByte(lua_State* L, WorldPacket* packet)
     {
         int8 byte = Eluna::CHECKVAL<int8>(L, 2);
-        (*packet) << byte;
+        (*Writable(L, packet)) << byte;
         return 0;
     }
 
@@ -151,7 +157,7 @@ namespace LuaPacket
     int WriteUByte(lua_State* L, WorldPacket* packet)
     {
         uint8 byte = Eluna::CHECKVAL<uint8>(L, 2);
-        (*packet) << byte;
+        (*Writable(L, packet)) << byte;
         return 0;
     }
 
@@ -159,7 +165,7 @@ namespace LuaPacket
     int WriteUShort(lua_State* L, WorldPacket* packet)
     {
         uint16 _ushort = Eluna::CHECKVAL<uint16>(L, 2);
-        (*packet) << _ushort;
+        (*Writable(L, packet)) << _ushort;
         return 0;
     }
 
@@ -167,7 +173,7 @@ namespace LuaPacket
     int WriteShort(lua_State* L, WorldPacket* packet)
     {
         int16 _short = Eluna::CHECKVAL<int16>(L, 2);
-        (*packet) << _short;
+        (*Writable(L, packet)) << _short;
         return 0;
     }
 
@@ -175,7 +181,7 @@ namespace LuaPacket
     int WriteLong(lua_State* L, WorldPacket* packet)
     {
         int32 _long = Eluna::CHECKVAL<int32>(L, 2);
-        (*packet) << _long;
+        (*Writable(L, packet)) << _long;
         return 0;
     }
 
@@ -183,7 +189,7 @@ namespace LuaPacket
     int WriteULong(lua_State* L, WorldPacket* packet)
     {
         uint32 _ulong = Eluna::CHECKVAL<uint32>(L, 2);
-        (*packet) << _ulong;
+        (*Writable(L, packet)) << _ulong;
         return 0;
     }
 
@@ -191,7 +197,7 @@ namespace LuaPacket
     int WriteFloat(lua_State* L, WorldPacket* packet)
     {
         float _val = Eluna::CHECKVAL<float>(L, 2);
-        (*packet) << _val;
+        (*Writable(L, packet)) << _val;
         return 0;
     }
 
@@ -199,7 +205,7 @@ namespace LuaPacket
     int WriteDouble(lua_State* L, WorldPacket* packet)
     {
         double _val = Eluna::CHECKVAL<double>(L, 2);
-        (*packet) << _val;
+        (*Writable(L, packet)) << _val;
         return 0;
     }
 };
@@ -0,0 +1,160 @@
+/*
+* Copyright (C) 2010 - 2014 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+// [user-004] ElunaRegister methods called through ElunaTemplate<T>::thunk against ELUNA_BIND binders
+// on hot getters. Both check self the same way, the difference is the thunk's stack bookkeeping and
+// the call through the method table.
+
+#include "ElunaBenchmark.h"
+
+class FakeUnit
+{
+public:
+    FakeUnit(): x(1.5f), health(100), entry(1234) { }
+
+    float GetPositionX() const { return x; }
+    uint32 GetHealth() const { return health; }
+    uint32 GetEntry() const { return entry; }
+
+private:
+    float x;
+    uint32 health;
+    uint32 entry;
+};
+
+struct FakeRegister
+{
+    const char* name;
+    int(*mfunc)(lua_State*, FakeUnit*);
+};
+
+static FakeUnit unit;
+
+static void Push(lua_State* L, const uint32 u) { lua_pushunsigned(L, u); }
+static void Push(lua_State* L, const float f) { lua_pushnumber(L, f); }
+
+// Stands in for ElunaTemplate<T>::check, self is a full userdata holding the pointer
+static FakeUnit* Check(lua_State* L, int narg)
+{
+    if (lua_type(L, narg) != LUA_TUSERDATA || lua_rawlen(L, narg) != sizeof(FakeUnit*))
+        return NULL;
+    return *static_cast<FakeUnit**>(lua_touserdata(L, narg));
+}
+
+// *Methods.h style methods
+namespace LuaUnit
+{
+    int GetX(lua_State* L, FakeUnit* unit)
+    {
+        Push(L, unit->GetPositionX());
+        return 1;
+    }
+
+    int GetHealth(lua_State* L, FakeUnit* unit)
+    {
+        Push(L, unit->GetHealth());
+        return 1;
+    }
+
+    int GetEntry(lua_State* L, FakeUnit* unit)
+    {
+        Push(L, unit->GetEntry());
+        return 1;
+    }
+};
+
+// ElunaTemplate<T>::thunk
+static int Thunk(lua_State* L)
+{
+    FakeUnit* obj = Check(L, 1);
+    if (!obj)
+        return 0;
+    FakeRegister* l = static_cast<FakeRegister*>(lua_touserdata(L, lua_upvalueindex(1)));
+    int args = lua_gettop(L);
+    int expected = l->mfunc(L, obj);
+    args = lua_gettop(L) - args;
+    if (args < 0 || args > expected)
+        printf("[Eluna]: %s returned unexpected amount of arguments %i out of %i. Report to devs\n", l->name, args, expected);
+    for (; args < expected; ++args)
+        lua_pushnil(L);
+    return expected;
+}
+
+// ElunaBinder for const getters without arguments
+template<typename R, R(FakeUnit::*method)() const>
+static int Bind(lua_State* L)
+{
+    FakeUnit* obj = Check(L, 1);
+    if (!obj)
+        return 0;
+    Push(L, (obj->*method)());
+    return 1;
+}
+
+static FakeRegister methods[] =
+{
+    { "GetX", &LuaUnit::GetX },
+    { "GetHealth", &LuaUnit::GetHealth },
+    { "GetEntry", &LuaUnit::GetEntry }
+};
+
+int main()
+{
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+
+    // Thunked methods are closures over their table row like in ElunaTemplate<T>::SetMethods
+    lua_newtable(L);
+    for (uint32 i = 0; i < sizeof(methods) / sizeof(*methods); ++i)
+    {
+        lua_pushlightuserdata(L, &methods[i]);
+        lua_pushcclosure(L, &Thunk, 1);
+        lua_setfield(L, -2, methods[i].name);
+    }
+    lua_pushcfunction(L, (&Bind<float, &FakeUnit::GetPositionX>));
+    lua_setfield(L, -2, "BoundGetX");
+    lua_pushcfunction(L, (&Bind<uint32, &FakeUnit::GetHealth>));
+    lua_setfield(L, -2, "BoundGetHealth");
+    lua_pushcfunction(L, (&Bind<uint32, &FakeUnit::GetEntry>));
+    lua_setfield(L, -2, "BoundGetEntry");
+    luaL_newmetatable(L, "Unit");
+    lua_insert(L, -2);
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
+
+    FakeUnit** ptrHold = static_cast<FakeUnit**>(lua_newuserdata(L, sizeof(FakeUnit*)));
+    *ptrHold = &unit;
+    luaL_setmetatable(L, "Unit");
+    lua_setglobal(L, "unit");
+
+    RunChunk(L, "return function(n) for i = 1, n do end end", 1);
+    double loop = Measure(1000000, [L](uint32 iterations) { CallLua(L, iterations); });
+    lua_pop(L, 1);
+
+    const char* names[] = { "GetX", "GetHealth", "GetEntry" };
+    for (uint32 i = 0; i < 3; ++i)
+    {
+        char chunk[256];
+        snprintf(chunk, sizeof(chunk),
+            "local unit = unit\n"
+            "return function(n) for i = 1, n do unit:%s() end end,\n"
+            "       function(n) for i = 1, n do unit:Bound%s() end end\n", names[i], names[i]);
+        RunChunk(L, chunk, 2);
+        double bound = Measure(1000000, [L](uint32 iterations) { CallLua(L, iterations); });
+        lua_pop(L, 1);
+        double thunk = Measure(1000000, [L](uint32 iterations) { CallLua(L, iterations); });
+        lua_pop(L, 1);
+
+        char name[64];
+        snprintf(name, sizeof(name), "unit:%s(), thunk", names[i]);
+        Report(name, thunk - loop);
+        snprintf(name, sizeof(name), "unit:%s(), ELUNA_BIND", names[i]);
+        Report(name, bound - loop, thunk - loop);
+    }
+
+    lua_close(L);
+    return 0;
+}
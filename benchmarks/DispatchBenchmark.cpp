@@ -0,0 +1,139 @@
+/*
+* Copyright (C) 2010 - 2014 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+// [user-009] EVENT_BEGIN with the bindings in a std::map, as before, against the array indexed
+// bindings with a presence bitmask used by EventBind now. The handlers are fetched to the stack like
+// EVENT_BEGIN does and popped, the calls themselves cost the same in both.
+
+#include "ElunaBenchmark.h"
+#include <map>
+#include <vector>
+
+#define EVENT_COUNT     32
+
+// EventBind before
+struct OldEventBind
+{
+    typedef std::vector<int> ElunaBindingMap;
+    typedef std::map<int, ElunaBindingMap> ElunaEntryMap;
+
+    bool HasEvents(int eventId) const
+    {
+        if (Bindings.empty())
+            return false;
+        if (Bindings.find(eventId) == Bindings.end())
+            return false;
+        return true;
+    }
+
+    ElunaEntryMap Bindings;
+};
+
+// EventBind now
+struct NewEventBind
+{
+    typedef std::vector<int> ElunaBindingMap;
+    typedef std::vector<ElunaBindingMap> ElunaEntryMap;
+
+    NewEventBind(): Bindings(EVENT_COUNT), EventMask(0) { }
+
+    void Insert(int eventId, int funcRef)
+    {
+        Bindings[eventId].push_back(funcRef);
+        EventMask |= uint64(1) << eventId;
+    }
+
+    bool HasEvents(int eventId) const
+    {
+        return (EventMask & (uint64(1) << eventId)) != 0;
+    }
+
+    ElunaEntryMap Bindings;
+    uint64 EventMask;
+};
+
+static OldEventBind* oldBind;
+static NewEventBind* newBind;
+
+// EVENT_BEGIN before, the bindings are looked up twice per handler
+static void OldDispatch(lua_State* L, int eventId)
+{
+    if (!oldBind->HasEvents(eventId))
+        return;
+    int top = lua_gettop(L);
+    for (size_t i = 0; i < oldBind->Bindings[eventId].size(); ++i)
+        lua_rawgeti(L, LUA_REGISTRYINDEX, (oldBind->Bindings[eventId][i]));
+    lua_settop(L, top);
+}
+
+// EVENT_BEGIN now
+static void NewDispatch(lua_State* L, int eventId)
+{
+    if (!newBind->HasEvents(eventId))
+        return;
+    int top = lua_gettop(L);
+    const std::vector<int>& binds = newBind->Bindings[eventId];
+    for (size_t i = 0; i < binds.size(); ++i)
+        lua_rawgeti(L, LUA_REGISTRYINDEX, binds[i]);
+    lua_settop(L, top);
+}
+
+static void Bind(lua_State* L, int eventId, uint32 count)
+{
+    for (uint32 i = 0; i < count; ++i)
+    {
+        RunChunk(L, "return function() end", 1);
+        int funcRef = luaL_ref(L, LUA_REGISTRYINDEX);
+        oldBind->Bindings[eventId].push_back(funcRef);
+        newBind->Insert(eventId, funcRef);
+    }
+}
+
+static void Compare(lua_State* L, const char* name, volatile int eventId)
+{
+    double oldTime = Measure(10000000, [L, &eventId](uint32 iterations)
+    {
+        for (uint32 i = 0; i < iterations; ++i)
+            OldDispatch(L, eventId);
+    });
+    double newTime = Measure(10000000, [L, &eventId](uint32 iterations)
+    {
+        for (uint32 i = 0; i < iterations; ++i)
+            NewDispatch(L, eventId);
+    });
+    char buff[128];
+    snprintf(buff, sizeof(buff), "%s, std::map", name);
+    Report(buff, oldTime);
+    snprintf(buff, sizeof(buff), "%s, array and bitmask", name);
+    Report(buff, newTime, oldTime);
+}
+
+int main()
+{
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+    oldBind = new OldEventBind();
+    newBind = new NewEventBind();
+
+    Compare(L, "no bindings in the store", 5);
+
+    // Some other events of the store are bound, like a script using a few player events
+    Bind(L, 1, 1);
+    Bind(L, 3, 2);
+    Bind(L, 8, 1);
+    Bind(L, 20, 1);
+    Bind(L, 27, 1);
+    Compare(L, "event not bound, 5 others are", 5);
+    Compare(L, "1 handler", 1);
+    Compare(L, "2 handlers", 3);
+    Bind(L, 12, 8);
+    Compare(L, "8 handlers", 12);
+
+    delete oldBind;
+    delete newBind;
+    lua_close(L);
+    return 0;
+}
@@ -0,0 +1,72 @@
+/*
+* Copyright (C) 2010 - 2014 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+#ifndef ELUNA_BENCHMARKS_ELUNABENCHMARK_H
+#define ELUNA_BENCHMARKS_ELUNABENCHMARK_H
+
+extern "C"
+{
+#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+};
+
+#include "Common.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#define BENCHMARK_RUNS  5
+
+// Runs run(iterations) BENCHMARK_RUNS times and returns the best time per iteration in ns
+template<typename F>
+double Measure(uint32 iterations, F run)
+{
+    double best = 0;
+    for (uint32 i = 0; i < BENCHMARK_RUNS; ++i)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        run(iterations);
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+        if (!i || ns < best)
+            best = ns;
+    }
+    return best;
+}
+
+inline void Report(const char* name, double ns)
+{
+    printf("%-56s %10.1f ns\n", name, ns);
+}
+
+inline void Report(const char* name, double ns, double baseline)
+{
+    printf("%-56s %10.1f ns %+7.1f%%\n", name, ns, (ns - baseline) * 100 / baseline);
+}
+
+// Loads and runs the chunk, errors end the benchmark
+inline void RunChunk(lua_State* L, const char* chunk, int results)
+{
+    if (luaL_loadstring(L, chunk) || lua_pcall(L, 0, results, 0))
+    {
+        printf("lua error: %s\n", lua_tostring(L, -1));
+        exit(1);
+    }
+}
+
+// Calls the lua function at the top of the stack with iterations as argument, it is left on the stack
+inline void CallLua(lua_State* L, uint32 iterations)
+{
+    lua_pushvalue(L, -1);
+    lua_pushunsigned(L, iterations);
+    if (lua_pcall(L, 1, 0, 0))
+    {
+        printf("lua error: %s\n", lua_tostring(L, -1));
+        exit(1);
+    }
+}
+
+#endif
@@ -0,0 +1,169 @@
+/*
+* Copyright (C) 2010 - 2014 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+// [user-012] Cost of the handler profiling in Eluna::ExecuteHandler at several Eluna.ProfileSampleRate
+// values, against profiling turned off. Measured on an empty handler, where the overhead is the
+// largest part of the call, and on a handler doing a little work.
+
+#include "ElunaBenchmark.h"
+#include <string>
+
+struct HandlerStats
+{
+    const char* group;
+    uint32 event;
+    uint32 entry;
+    std::string source;
+    uint32 calls;
+    uint32 samples;
+    uint32 errors;
+    uint64 totalTime;
+    uint32 maxTime;
+};
+
+#define PROFILING_ROUNDS    20
+
+static UNORDERED_MAP<int, HandlerStats> handlerStats;
+static uint32 sampleRate;
+
+static uint64 GetCurrTimeUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int ErrorHandler(lua_State* /*L*/)
+{
+    return 1;
+}
+
+// Eluna::ExecuteCall without the watchdog, which is off by default
+static bool ExecuteCall(lua_State* L, int params, int res)
+{
+    int base = lua_gettop(L) - params;
+    lua_pushcfunction(L, &ErrorHandler);
+    lua_insert(L, base);
+    int err = lua_pcall(L, params, res, base);
+    lua_remove(L, base);
+    if (err)
+    {
+        lua_pop(L, 1);
+        return false;
+    }
+    return true;
+}
+
+// Eluna::GetHandlerStats for a record that exists
+static HandlerStats& GetHandlerStats(const char* group, uint32 event, uint32 entry, int funcRef)
+{
+    HandlerStats& stats = handlerStats[funcRef];
+    if (stats.group != group || stats.event != event || stats.entry != entry)
+    {
+        stats.group = group;
+        stats.event = event;
+        stats.entry = entry;
+        stats.calls = 0;
+        stats.samples = 0;
+        stats.errors = 0;
+        stats.totalTime = 0;
+        stats.maxTime = 0;
+        stats.source = "benchmark:1";
+    }
+    return stats;
+}
+
+// The profiling part of Eluna::ExecuteHandler
+static bool ExecuteHandler(lua_State* L, int params, int res, const char* group, uint32 event, uint32 entry, int funcRef)
+{
+    bool success;
+    if (!sampleRate)
+        success = ExecuteCall(L, params, res);
+    else
+    {
+        uint32& calls = GetHandlerStats(group, event, entry, funcRef).calls;
+        if (++calls < sampleRate)
+        {
+            success = ExecuteCall(L, params, res);
+            if (!success)
+                ++GetHandlerStats(group, event, entry, funcRef).errors;
+        }
+        else
+        {
+            calls = 0;
+
+            uint64 start = GetCurrTimeUs();
+            success = ExecuteCall(L, params, res);
+            uint32 time = uint32(GetCurrTimeUs() - start);
+
+            HandlerStats& stats = GetHandlerStats(group, event, entry, funcRef);
+            ++stats.samples;
+            stats.totalTime += time;
+            if (time > stats.maxTime)
+                stats.maxTime = time;
+            if (!success)
+                ++stats.errors;
+        }
+    }
+    return success;
+}
+
+static void Compare(lua_State* L, const char* name, const char* handler)
+{
+    RunChunk(L, handler, 1);
+    int funcRef = luaL_ref(L, LUA_REGISTRYINDEX);
+    // Other handlers are profiled too
+    for (int i = 1; i <= 200; ++i)
+        GetHandlerStats("PlayerEvents", i, 0, funcRef + i);
+
+    // The rates are measured in turns and the best round of each is kept, so drifts of the machine hit all of them
+    printf("%s\n", name);
+    uint32 rates[] = { 0, 1000, 100, 10, 1 };
+    const uint32 rateCount = sizeof(rates) / sizeof(*rates);
+    double best[rateCount];
+    for (uint32 round = 0; round < PROFILING_ROUNDS; ++round)
+    {
+        for (uint32 i = 0; i < rateCount; ++i)
+        {
+            sampleRate = rates[i];
+            double time = Measure(200000, [L, funcRef](uint32 iterations)
+            {
+                for (uint32 j = 0; j < iterations; ++j)
+                {
+                    lua_rawgeti(L, LUA_REGISTRYINDEX, funcRef);
+                    lua_pushunsigned(L, 27);
+                    lua_pushunsigned(L, j);
+                    ExecuteHandler(L, 2, 0, "PlayerEvents", 27, 0, funcRef);
+                }
+            });
+            if (!round || time < best[i])
+                best[i] = time;
+        }
+    }
+
+    Report("  profiling off", best[0]);
+    for (uint32 i = 1; i < rateCount; ++i)
+    {
+        char buff[64];
+        snprintf(buff, sizeof(buff), "  Eluna.ProfileSampleRate = %u", rates[i]);
+        Report(buff, best[i], best[0]);
+    }
+}
+
+int main()
+{
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+
+    Compare(L, "Empty handler", "return function(event, value) end");
+    Compare(L, "Handler doing some work",
+        "local t = {}\n"
+        "return function(event, value)\n"
+        "    for i = 1, 20 do t[i] = value + i end\n"
+        "    return t[20]\n"
+        "end");
+
+    lua_close(L);
+    return 0;
+}
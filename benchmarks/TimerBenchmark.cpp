@@ -0,0 +1,146 @@
+/*
+* Copyright (C) 2010 - 2014 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+// [user-018] Calling the timers due in an update one by one from C, as EventMgr::Run does in both
+// timer modes, against handing them to a lua dispatcher in one call, as the first batched mode did.
+// The dispatcher was removed so every timer goes through ExecuteHandler; this shows what it saved.
+
+#include "ElunaBenchmark.h"
+#include <vector>
+
+#define TIMER_ROUNDS    10
+
+static const char* BATCH_DISPATCHER =
+    "local xpcall = xpcall\n"
+    "return function(batch, count, handler)\n"
+    "    for i = 1, count * 5, 5 do\n"
+    "        local func = batch[i]\n"
+    "        if func then\n"
+    "            xpcall(func, handler, batch[i + 1], batch[i + 2], batch[i + 3], batch[i + 4])\n"
+    "        end\n"
+    "    end\n"
+    "end\n";
+
+struct FakeEvent
+{
+    int funcRef;
+    uint32 delay;
+    uint32 calls;
+};
+
+static int ErrorHandler(lua_State* /*L*/)
+{
+    return 1;
+}
+
+// Eluna::ExecuteCall without the watchdog
+static bool ExecuteCall(lua_State* L, int params, int res)
+{
+    int base = lua_gettop(L) - params;
+    lua_pushcfunction(L, &ErrorHandler);
+    lua_insert(L, base);
+    int err = lua_pcall(L, params, res, base);
+    lua_remove(L, base);
+    if (err)
+    {
+        lua_pop(L, 1);
+        return false;
+    }
+    return true;
+}
+
+// EventMgr::Run for each due event
+static void RunEach(lua_State* L, const std::vector<FakeEvent>& events, int objRef)
+{
+    for (std::vector<FakeEvent>::const_iterator it = events.begin(); it != events.end(); ++it)
+    {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, it->funcRef);
+        lua_pushinteger(L, it->funcRef);
+        lua_pushunsigned(L, it->delay);
+        lua_pushunsigned(L, it->calls);
+        lua_rawgeti(L, LUA_REGISTRYINDEX, objRef);
+        ExecuteCall(L, 4, 0);
+    }
+}
+
+// The removed EventMgr::RunBatch, the events are put in a table and called from the dispatcher
+static void RunDispatcher(lua_State* L, const std::vector<FakeEvent>& events, int objRef, int dispatcherRef, int tableRef)
+{
+    lua_rawgeti(L, LUA_REGISTRYINDEX, dispatcherRef);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, tableRef);
+    int tbl = lua_gettop(L);
+    for (uint32 i = 0; i < events.size(); ++i)
+    {
+        const FakeEvent& luaEvent = events[i];
+        int index = i * 5;
+        lua_rawgeti(L, LUA_REGISTRYINDEX, luaEvent.funcRef);
+        lua_rawseti(L, tbl, index + 1);
+        lua_pushinteger(L, luaEvent.funcRef);
+        lua_rawseti(L, tbl, index + 2);
+        lua_pushunsigned(L, luaEvent.delay);
+        lua_rawseti(L, tbl, index + 3);
+        lua_pushunsigned(L, luaEvent.calls);
+        lua_rawseti(L, tbl, index + 4);
+        lua_rawgeti(L, LUA_REGISTRYINDEX, objRef);
+        lua_rawseti(L, tbl, index + 5);
+    }
+    lua_pushunsigned(L, events.size());
+    lua_pushcfunction(L, &ErrorHandler);
+    ExecuteCall(L, 3, 0);
+}
+
+int main()
+{
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+
+    RunChunk(L, BATCH_DISPATCHER, 1);
+    int dispatcherRef = luaL_ref(L, LUA_REGISTRYINDEX);
+    lua_newtable(L);
+    int tableRef = luaL_ref(L, LUA_REGISTRYINDEX);
+    lua_newuserdata(L, sizeof(void*)); // The unit the timers are registered on
+    int objRef = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    uint32 counts[] = { 1000, 10000, 100000 };
+    for (uint32 c = 0; c < sizeof(counts) / sizeof(*counts); ++c)
+    {
+        // Each timer has its own function, like timers registered from different places
+        std::vector<FakeEvent> events(counts[c]);
+        for (uint32 i = 0; i < counts[c]; ++i)
+        {
+            RunChunk(L, "local n = 0 return function(id, delay, calls, obj) n = n + 1 end", 1);
+            events[i].funcRef = luaL_ref(L, LUA_REGISTRYINDEX);
+            events[i].delay = 1000;
+            events[i].calls = 0;
+        }
+
+        double each = 0;
+        double dispatcher = 0;
+        for (uint32 round = 0; round < TIMER_ROUNDS; ++round)
+        {
+            double time = Measure(1, [L, &events, objRef](uint32) { RunEach(L, events, objRef); }) / counts[c];
+            if (!round || time < each)
+                each = time;
+            time = Measure(1, [L, &events, objRef, dispatcherRef, tableRef](uint32) { RunDispatcher(L, events, objRef, dispatcherRef, tableRef); }) / counts[c];
+            if (!round || time < dispatcher)
+                dispatcher = time;
+        }
+
+        char buff[64];
+        printf("%u due timers, time per timer\n", counts[c]);
+        snprintf(buff, sizeof(buff), "  one call from C per timer");
+        Report(buff, each);
+        snprintf(buff, sizeof(buff), "  lua dispatcher (removed)");
+        Report(buff, dispatcher, each);
+
+        for (uint32 i = 0; i < counts[c]; ++i)
+            luaL_unref(L, LUA_REGISTRYINDEX, events[i].funcRef);
+        lua_gc(L, LUA_GCCOLLECT, 0);
+    }
+
+    lua_close(L);
+    return 0;
+}
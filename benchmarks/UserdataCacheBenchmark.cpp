@@ -0,0 +1,224 @@
+/*
+* Copyright (C) 2010 - 2014 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+// [user-001] Userdata cache keyed by "%p" strings, as before, against light userdata keys and the
+// handle table, as ElunaTemplate<T>::push and check do now. Pushes of cached objects from C and
+// method calls from lua, where check runs for self on every call.
+
+#include "ElunaBenchmark.h"
+#include "ElunaHandleTable.h"
+
+#define OBJECT_COUNT    1000
+#define OBJECT_MAGIC    0x454C554E
+
+struct FakeCreature
+{
+    uint32 health;
+};
+
+// Same layout as ElunaObject
+struct FakeObject
+{
+    uint32 magic;
+    void* object;
+    uint32 slot;
+    uint32 generation;
+    uint8 tag;
+    bool borrowed;
+};
+
+static FakeCreature creatures[OBJECT_COUNT];
+static int oldTable;
+static int newTable;
+static ElunaHandleTable handles(false);
+
+// ElunaTemplate<T>::push before, the cache is keyed by the formatted pointer
+static void OldPush(lua_State* L, FakeCreature* obj)
+{
+    lua_rawgeti(L, LUA_REGISTRYINDEX, oldTable);
+    lua_pushfstring(L, "%p", obj);
+    lua_gettable(L, -2);
+    if (!lua_isnoneornil(L, -1) && luaL_checkudata(L, -1, "OldCreature"))
+    {
+        lua_remove(L, -2);
+        return;
+    }
+    lua_remove(L, -1);
+
+    FakeCreature** ptrHold = static_cast<FakeCreature**>(lua_newuserdata(L, sizeof(FakeCreature*)));
+    *ptrHold = obj;
+    luaL_getmetatable(L, "OldCreature");
+    lua_setmetatable(L, -2);
+    lua_pushfstring(L, "%p", obj);
+    lua_pushvalue(L, -2);
+    lua_settable(L, -4);
+    lua_remove(L, -2);
+}
+
+// ElunaTemplate<T>::check before, validity is a lookup of the formatted pointer
+static FakeCreature* OldCheck(lua_State* L, int narg)
+{
+    FakeCreature** ptrHold = static_cast<FakeCreature**>(lua_touserdata(L, narg));
+    if (!ptrHold)
+        return NULL;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, oldTable);
+    lua_pushfstring(L, "%p", *ptrHold);
+    lua_gettable(L, -2);
+    lua_remove(L, -2);
+    bool valid = lua_isuserdata(L, -1);
+    lua_remove(L, -1);
+    if (!valid)
+        return NULL;
+    return *ptrHold;
+}
+
+// ElunaTemplate<T>::push now, light userdata keys and the handle table
+static void NewPush(lua_State* L, FakeCreature* obj)
+{
+    lua_rawgeti(L, LUA_REGISTRYINDEX, newTable);
+    lua_pushlightuserdata(L, obj);
+    lua_rawget(L, -2);
+    if (!lua_isnoneornil(L, -1) && luaL_checkudata(L, -1, "NewCreature"))
+    {
+        FakeObject* cached = static_cast<FakeObject*>(lua_touserdata(L, -1));
+        if (handles.IsValid(cached->slot, cached->generation))
+        {
+            lua_remove(L, -2);
+            return;
+        }
+    }
+    lua_remove(L, -1);
+
+    FakeObject* elunaObj = static_cast<FakeObject*>(lua_newuserdata(L, sizeof(FakeObject)));
+    elunaObj->magic = OBJECT_MAGIC;
+    elunaObj->object = obj;
+    elunaObj->slot = handles.Acquire(obj);
+    elunaObj->generation = handles.GetGeneration(elunaObj->slot);
+    elunaObj->tag = 1;
+    elunaObj->borrowed = false;
+    luaL_getmetatable(L, "NewCreature");
+    lua_setmetatable(L, -2);
+    lua_pushlightuserdata(L, obj);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, -4);
+    lua_remove(L, -2);
+}
+
+// ElunaTemplate<T>::check now
+static FakeCreature* NewCheck(lua_State* L, int narg)
+{
+    FakeObject* elunaObj = NULL;
+    if (lua_type(L, narg) == LUA_TUSERDATA && lua_rawlen(L, narg) == sizeof(FakeObject))
+    {
+        elunaObj = static_cast<FakeObject*>(lua_touserdata(L, narg));
+        if (elunaObj->magic != OBJECT_MAGIC)
+            elunaObj = NULL;
+    }
+    if (!elunaObj || !(elunaObj->tag & 1))
+        return NULL;
+    if (!handles.IsValid(elunaObj->slot, elunaObj->generation))
+        return NULL;
+    return static_cast<FakeCreature*>(elunaObj->object);
+}
+
+static int OldGetHealth(lua_State* L)
+{
+    FakeCreature* creature = OldCheck(L, 1);
+    if (!creature)
+        return 0;
+    lua_pushunsigned(L, creature->health);
+    return 1;
+}
+
+static int NewGetHealth(lua_State* L)
+{
+    FakeCreature* creature = NewCheck(L, 1);
+    if (!creature)
+        return 0;
+    lua_pushunsigned(L, creature->health);
+    return 1;
+}
+
+static void RegisterType(lua_State* L, const char* name, lua_CFunction getHealth)
+{
+    luaL_newmetatable(L, name);
+    lua_newtable(L);
+    lua_pushcfunction(L, getHealth);
+    lua_setfield(L, -2, "GetHealth");
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
+}
+
+// Weak valued cache table like userdata_table
+static int NewCacheTable(lua_State* L)
+{
+    lua_newtable(L);
+    lua_newtable(L);
+    lua_pushstring(L, "v");
+    lua_setfield(L, -2, "__mode");
+    lua_setmetatable(L, -2);
+    return luaL_ref(L, LUA_REGISTRYINDEX);
+}
+
+int main()
+{
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+    RegisterType(L, "OldCreature", &OldGetHealth);
+    RegisterType(L, "NewCreature", &NewGetHealth);
+    oldTable = NewCacheTable(L);
+    newTable = NewCacheTable(L);
+
+    // The objects are pushed once and kept alive, so the pushes below hit the cache
+    lua_newtable(L);
+    for (uint32 i = 0; i < OBJECT_COUNT; ++i)
+    {
+        creatures[i].health = i;
+        OldPush(L, &creatures[i]);
+        lua_rawseti(L, -2, i + 1);
+        NewPush(L, &creatures[i]);
+        lua_rawseti(L, -2, OBJECT_COUNT + i + 1);
+    }
+    lua_setglobal(L, "keep");
+
+    printf("Cached push from C, %u objects\n", OBJECT_COUNT);
+    double oldPush = Measure(1000000, [L](uint32 iterations)
+    {
+        for (uint32 i = 0; i < iterations; ++i)
+        {
+            OldPush(L, &creatures[i % OBJECT_COUNT]);
+            lua_pop(L, 1);
+        }
+    });
+    double newPush = Measure(1000000, [L](uint32 iterations)
+    {
+        for (uint32 i = 0; i < iterations; ++i)
+        {
+            NewPush(L, &creatures[i % OBJECT_COUNT]);
+            lua_pop(L, 1);
+        }
+    });
+    Report("push, \"%p\" string key", oldPush);
+    Report("push, light userdata key and handle table", newPush, oldPush);
+
+    printf("\nobj:GetHealth() from lua, check runs for self\n");
+    RunChunk(L,
+        "local old, new = keep[1], keep[1001]\n"
+        "return function(n) for i = 1, n do old:GetHealth() end end,\n"
+        "       function(n) for i = 1, n do new:GetHealth() end end,\n"
+        "       function(n) for i = 1, n do end end\n", 3);
+    double loop = Measure(1000000, [L](uint32 iterations) { CallLua(L, iterations); });
+    lua_pop(L, 1);
+    double newCall = Measure(1000000, [L](uint32 iterations) { CallLua(L, iterations); });
+    lua_pop(L, 1);
+    double oldCall = Measure(1000000, [L](uint32 iterations) { CallLua(L, iterations); });
+    lua_pop(L, 1);
+    Report("GetHealth, \"%p\" string key", oldCall - loop);
+    Report("GetHealth, light userdata key and handle table", newCall - loop, oldCall - loop);
+
+    lua_close(L);
+    return 0;
+}
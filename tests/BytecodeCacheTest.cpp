@@ -0,0 +1,90 @@
+/*
+* Copyright (C) 2010 - 2014 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+#include "ElunaTest.h"
+#include "ElunaBytecodeCache.h"
+
+static const std::string path = "lua_scripts/test.lua";
+static const std::string source = "print('test')\n";
+static const std::string chunk("\x1bLua\x52\x00 chunk", 12);
+
+static std::string MakeEntry(uint64 mtime)
+{
+    std::string entry;
+    ElunaBytecodeCache::Build(entry, path, mtime, source.size(), ElunaBytecodeCache::HashBytes(source.data(), source.size()), chunk);
+    return entry;
+}
+
+static void TestHash()
+{
+    // FNV-1a test vectors
+    CHECK_EQUAL(ElunaBytecodeCache::HashBytes("", 0), UI64LIT(0xcbf29ce484222325));
+    CHECK_EQUAL(ElunaBytecodeCache::HashBytes("a", 1), UI64LIT(0xaf63dc4c8601ec8c));
+}
+
+static void TestFileName()
+{
+    std::string name = ElunaBytecodeCache::GetFileName(path);
+    CHECK_EQUAL(name.length(), size_t(16 + 5));
+    CHECK_EQUAL(name.substr(16), std::string(".luac"));
+    CHECK_EQUAL(name, ElunaBytecodeCache::GetFileName(path));
+    CHECK(name != ElunaBytecodeCache::GetFileName("lua_scripts/other.lua"));
+}
+
+static void TestValid()
+{
+    std::string entry = MakeEntry(100);
+    size_t offset = 0;
+    CHECK_EQUAL(ElunaBytecodeCache::Check(entry, path, 100, source.size(), offset), ElunaBytecodeCache::ENTRY_VALID);
+    CHECK_EQUAL(entry.substr(offset), chunk);
+}
+
+static void TestStale()
+{
+    std::string entry = MakeEntry(100);
+    size_t offset = 0;
+    // The script's size changed
+    CHECK_EQUAL(ElunaBytecodeCache::Check(entry, path, 100, source.size() + 1, offset), ElunaBytecodeCache::ENTRY_STALE);
+    // Another script with the same file name
+    CHECK_EQUAL(ElunaBytecodeCache::Check(entry, "lua_scripts/tests.lua", 100, source.size(), offset), ElunaBytecodeCache::ENTRY_STALE);
+    // Written by another version
+    std::string other = entry;
+    other[7] = '0';
+    CHECK_EQUAL(ElunaBytecodeCache::Check(other, path, 100, source.size(), offset), ElunaBytecodeCache::ENTRY_STALE);
+    // Partial entries
+    CHECK_EQUAL(ElunaBytecodeCache::Check(entry.substr(0, entry.size() - chunk.size()), path, 100, source.size(), offset), ElunaBytecodeCache::ENTRY_STALE);
+    CHECK_EQUAL(ElunaBytecodeCache::Check(entry.substr(0, 10), path, 100, source.size(), offset), ElunaBytecodeCache::ENTRY_STALE);
+    CHECK_EQUAL(ElunaBytecodeCache::Check(std::string(), path, 100, source.size(), offset), ElunaBytecodeCache::ENTRY_STALE);
+}
+
+static void TestModified()
+{
+    std::string entry = MakeEntry(100);
+    size_t offset = 0;
+    CHECK_EQUAL(ElunaBytecodeCache::Check(entry, path, 200, source.size(), offset), ElunaBytecodeCache::ENTRY_CHECK_HASH);
+
+    // Same size, other content
+    std::string edited = source;
+    edited[7] = 'T';
+    CHECK(!ElunaBytecodeCache::MatchesSource(entry, edited));
+
+    // Only touched, the entry is kept with the new modification time
+    CHECK(ElunaBytecodeCache::MatchesSource(entry, source));
+    ElunaBytecodeCache::Touch(entry, 200);
+    CHECK_EQUAL(ElunaBytecodeCache::Check(entry, path, 200, source.size(), offset), ElunaBytecodeCache::ENTRY_VALID);
+    CHECK_EQUAL(entry.substr(offset), chunk);
+    CHECK_EQUAL(ElunaBytecodeCache::Check(entry, path, 100, source.size(), offset), ElunaBytecodeCache::ENTRY_CHECK_HASH);
+}
+
+int main()
+{
+    RUN_TEST(TestHash);
+    RUN_TEST(TestFileName);
+    RUN_TEST(TestValid);
+    RUN_TEST(TestStale);
+    RUN_TEST(TestModified);
+    return ELUNA_TEST_RESULT();
+}
@@ -0,0 +1,28 @@
+/*
+* Copyright (C) 2010 - 2014 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+#ifndef ELUNA_TESTS_COMMON_H
+#define ELUNA_TESTS_COMMON_H
+
+// Stands in for the core's Common.h in the tests
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+
+typedef int64_t int64;
+typedef int32_t int32;
+typedef int16_t int16;
+typedef int8_t int8;
+typedef uint64_t uint64;
+typedef uint32_t uint32;
+typedef uint16_t uint16;
+typedef uint8_t uint8;
+
+#define UNORDERED_MAP std::unordered_map
+#define UI64LIT(N) N##ULL
+
+#endif
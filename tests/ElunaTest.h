@@ -0,0 +1,37 @@
+/*
+* Copyright (C) 2010 - 2014 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+#ifndef ELUNA_TESTS_ELUNATEST_H
+#define ELUNA_TESTS_ELUNATEST_H
+
+#include <cstdio>
+
+// Failed checks are printed and counted, main returns ELUNA_TEST_RESULT()
+static int elunaTestFailures = 0;
+
+#define CHECK(expr) \
+    do \
+    { \
+        if (!(expr)) \
+        { \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #expr); \
+            ++elunaTestFailures; \
+        } \
+    } while (0)
+
+#define CHECK_EQUAL(a, b) CHECK((a) == (b))
+
+#define RUN_TEST(test) \
+    do \
+    { \
+        int failures = elunaTestFailures; \
+        test(); \
+        printf("%s %s\n", failures == elunaTestFailures ? "PASS" : "FAIL", #test); \
+    } while (0)
+
+#define ELUNA_TEST_RESULT() (elunaTestFailures ? 1 : 0)
+
+#endif
@@ -0,0 +1,144 @@
+/*
+* Copyright (C) 2010 - 2014 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+#include "ElunaTest.h"
+#include "ElunaHandleTable.h"
+#include <set>
+#include <thread>
+
+static int objects[2048];
+
+static void TestAcquireRelease()
+{
+    ElunaHandleTable table(false);
+    uint32 slot = table.Acquire(&objects[0]);
+    uint32 generation = table.GetGeneration(slot);
+    CHECK(table.IsValid(slot, generation));
+    CHECK_EQUAL(table.Acquire(&objects[0]), slot);
+    CHECK_EQUAL(table.GetGeneration(slot), generation);
+
+    table.Release(&objects[0]);
+    CHECK(!table.IsValid(slot, generation));
+    table.Release(&objects[0]); // Not in the table anymore
+
+    // A new object at the same address gets a new generation
+    uint32 newSlot = table.Acquire(&objects[0]);
+    CHECK(table.IsValid(newSlot, table.GetGeneration(newSlot)));
+    CHECK(!table.IsValid(slot, generation));
+}
+
+static void TestSlotReuse()
+{
+    ElunaHandleTable table(false);
+    uint32 slot = table.Acquire(&objects[0]);
+    uint32 generation = table.GetGeneration(slot);
+    table.Release(&objects[0]);
+
+    uint32 reused = table.Acquire(&objects[1]);
+    CHECK_EQUAL(reused, slot);
+    CHECK(table.GetGeneration(reused) != generation);
+    CHECK(!table.IsValid(slot, generation));
+    CHECK(table.IsValid(reused, table.GetGeneration(reused)));
+    CHECK(!table.IsValid(12345, 1)); // Slot out of range
+}
+
+static void TestChunks()
+{
+    ElunaHandleTable table(false);
+    std::set<uint32> slots;
+    for (uint32 i = 0; i < 2048; ++i)
+        slots.insert(table.Acquire(&objects[i]));
+    CHECK_EQUAL(slots.size(), size_t(2048));
+    for (uint32 i = 0; i < 2048; ++i)
+    {
+        uint32 slot = table.Acquire(&objects[i]);
+        CHECK(table.IsValid(slot, table.GetGeneration(slot)));
+    }
+}
+
+static void TestRemoteInvalidation()
+{
+    ElunaHandleTable first(true);
+    ElunaHandleTable second(true);
+    uint32 firstSlot = first.Acquire(&objects[0]);
+    uint32 firstGeneration = first.GetGeneration(firstSlot);
+    uint32 secondSlot = second.Acquire(&objects[0]);
+    uint32 secondGeneration = second.GetGeneration(secondSlot);
+
+    std::thread invalidator(&ElunaHandleTable::Invalidate, static_cast<const void*>(&objects[0]));
+    invalidator.join();
+
+    // Both tables see it at once, before releasing anything
+    CHECK(!first.IsValid(firstSlot, firstGeneration));
+    CHECK(!second.IsValid(secondSlot, secondGeneration));
+
+    std::vector<const void*> released;
+    first.ReleasePending(released);
+    CHECK_EQUAL(released.size(), size_t(1));
+    CHECK(!released.empty() && released[0] == &objects[0]);
+
+    // A new object at the address is pushed in the second table before it releases the old slot
+    uint32 newSlot = second.Acquire(&objects[0]);
+    CHECK(newSlot != secondSlot);
+    CHECK(second.IsValid(newSlot, second.GetGeneration(newSlot)));
+
+    released.clear();
+    second.ReleasePending(released);
+    CHECK(released.empty()); // The address belongs to the new object
+    CHECK(second.IsValid(newSlot, second.GetGeneration(newSlot)));
+    CHECK(!second.IsValid(secondSlot, secondGeneration));
+
+    // Nothing left to release
+    first.ReleasePending(released);
+    second.ReleasePending(released);
+    CHECK(released.empty());
+}
+
+static void TestUnshared()
+{
+    ElunaHandleTable shared(true);
+    ElunaHandleTable local(false);
+    uint32 sharedSlot = shared.Acquire(&objects[0], false);
+    uint32 localSlot = local.Acquire(&objects[0]);
+
+    ElunaHandleTable::Invalidate(&objects[0]);
+    CHECK(shared.IsValid(sharedSlot, shared.GetGeneration(sharedSlot)));
+    CHECK(local.IsValid(localSlot, local.GetGeneration(localSlot)));
+}
+
+static void TestLocalReleaseUnregisters()
+{
+    ElunaHandleTable first(true);
+    uint32 slot = first.Acquire(&objects[0]);
+    {
+        ElunaHandleTable second(true);
+        second.Acquire(&objects[0]);
+        second.Acquire(&objects[1]);
+        second.Release(&objects[1]);
+    } // Leaves the registry
+
+    first.Release(&objects[0]);
+    uint32 newSlot = first.Acquire(&objects[0]);
+    CHECK(slot == newSlot);
+    ElunaHandleTable::Invalidate(&objects[0]);
+    ElunaHandleTable::Invalidate(&objects[1]);
+    CHECK(!first.IsValid(newSlot, first.GetGeneration(newSlot)));
+
+    std::vector<const void*> released;
+    first.ReleasePending(released);
+    CHECK_EQUAL(released.size(), size_t(1));
+}
+
+int main()
+{
+    RUN_TEST(TestAcquireRelease);
+    RUN_TEST(TestSlotReuse);
+    RUN_TEST(TestChunks);
+    RUN_TEST(TestRemoteInvalidation);
+    RUN_TEST(TestUnshared);
+    RUN_TEST(TestLocalReleaseUnregisters);
+    return ELUNA_TEST_RESULT();
+}
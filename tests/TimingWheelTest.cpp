@@ -0,0 +1,164 @@
+/*
+* Copyright (C) 2010 - 2014 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+#include "ElunaTest.h"
+#include "ElunaTimingWheel.h"
+#include <cstdlib>
+
+struct TimedItem
+{
+    TimedItem(): expires(0), slot(NULL), slotPrev(NULL), slotNext(NULL), fired(0) { }
+
+    uint64 expires;
+    TimedItem** slot;
+    TimedItem* slotPrev;
+    TimedItem* slotNext;
+    uint64 fired;   // Tick it expired at
+};
+
+typedef ElunaTimingWheel<TimedItem> TestWheel;
+
+static const uint64 delays[] =
+{
+    1, 2, 255, 256, 257, 511, 512, 513, 65535, 65536, 65537, 65539,
+    (1 << 24) - 1, 1 << 24, (1 << 24) + 5, (1 << 24) + 65536 + 3
+};
+static const uint32 delayCount = sizeof(delays) / sizeof(delays[0]);
+
+// Advances the wheel by diff and marks the items expiring on the way
+static void Update(TestWheel& wheel, uint32 diff)
+{
+    for (uint64 target = wheel.GetTick() + diff; wheel.Advance(target);)
+        while (TimedItem* item = wheel.PopExpiring())
+            item->fired = wheel.GetTick();
+}
+
+// Each item fires at its exact tick, whatever the diffs and the tick the wheel was at
+static void CheckCascading(uint64 start, uint32 maxDiff)
+{
+    TestWheel wheel;
+    Update(wheel, 0);
+    while (wheel.GetTick() < start)
+        Update(wheel, uint32(start - wheel.GetTick() < 1000000 ? start - wheel.GetTick() : 1000000));
+
+    TimedItem items[delayCount];
+    for (uint32 i = 0; i < delayCount; ++i)
+    {
+        items[i].expires = wheel.GetTick() + delays[i];
+        wheel.Schedule(&items[i]);
+    }
+
+    uint64 end = start + delays[delayCount - 1];
+    while (wheel.GetTick() < end)
+        Update(wheel, 1 + rand() % maxDiff);
+
+    for (uint32 i = 0; i < delayCount; ++i)
+    {
+        CHECK_EQUAL(items[i].fired, start + delays[i]);
+        CHECK(!items[i].slot);
+    }
+}
+
+static void TestCascading()
+{
+    CheckCascading(0, 1);
+    CheckCascading(0, 50);
+    CheckCascading(0, 100000);
+    CheckCascading(1000, 37);
+    CheckCascading(65530, 300);     // Level 1 and 2 wrap right after scheduling
+    CheckCascading((1 << 24) - 3, 1000);
+}
+
+static void TestPastTick()
+{
+    TestWheel wheel;
+    Update(wheel, 10);
+    TimedItem item;
+    item.expires = 5;
+    wheel.Schedule(&item);
+    CHECK_EQUAL(item.expires, uint64(11));
+    Update(wheel, 1);
+    CHECK_EQUAL(item.fired, uint64(11));
+}
+
+static void TestUnschedule()
+{
+    TestWheel wheel;
+    TimedItem items[3];
+    for (uint32 i = 0; i < 3; ++i)
+    {
+        items[i].expires = 300;
+        wheel.Schedule(&items[i]);
+    }
+    TestWheel::Unschedule(&items[1]);
+    TestWheel::Unschedule(&items[1]); // Not scheduled anymore
+
+    // Items after the one being handled can be unscheduled or rescheduled
+    uint32 popped = 0;
+    for (uint64 target = 300; wheel.Advance(target);)
+    {
+        while (TimedItem* item = wheel.PopExpiring())
+        {
+            ++popped;
+            item->fired = wheel.GetTick();
+            TimedItem* other = (item == &items[0]) ? &items[2] : &items[0];
+            if (other->slot)
+            {
+                TestWheel::Unschedule(other);
+                other->expires = wheel.GetTick() + 10;
+                wheel.Schedule(other);
+            }
+        }
+    }
+    CHECK_EQUAL(popped, uint32(1));
+    CHECK(!items[1].fired);
+    Update(wheel, 10);
+    CHECK(items[0].fired + items[2].fired == 300 + 310);
+}
+
+static void TestExpireList()
+{
+    TestWheel wheel;
+    TimedItem items[2];
+    TimedItem* list = NULL;
+    TestWheel::Link(&items[0], &list);
+    TestWheel::Link(&items[1], &list);
+    wheel.Expire(list);
+    CHECK(!list);
+    CHECK(wheel.PopExpiring() == &items[1]);
+    CHECK(wheel.PopExpiring() == &items[0]);
+    CHECK(!wheel.PopExpiring());
+}
+
+static void TestTakeAll()
+{
+    TestWheel wheel;
+    TimedItem items[delayCount];
+    for (uint32 i = 0; i < delayCount; ++i)
+    {
+        items[i].expires = delays[i];
+        wheel.Schedule(&items[i]);
+    }
+    std::vector<TimedItem*> taken;
+    wheel.TakeAll(taken);
+    CHECK_EQUAL(taken.size(), size_t(delayCount));
+    for (uint32 i = 0; i < delayCount; ++i)
+        CHECK(!items[i].slot);
+    Update(wheel, 70000);
+    for (uint32 i = 0; i < delayCount; ++i)
+        CHECK(!items[i].fired);
+}
+
+int main()
+{
+    srand(1);
+    RUN_TEST(TestCascading);
+    RUN_TEST(TestPastTick);
+    RUN_TEST(TestUnschedule);
+    RUN_TEST(TestExpireList);
+    RUN_TEST(TestTakeAll);
+    return ELUNA_TEST_RESULT();
+}